@@ -0,0 +1,18 @@
+// Counting replacements of the global operator new and delete, linked only
+// into benchmark_alloc so the timings of the benchmark binary do not pay
+// for the counter. They live in their own translation unit so the compiler
+// cannot pair an inlined malloc with a delete expression (or free with a
+// new expression) and warn about it.
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+std::atomic<size_t> allocation_count{0};
+
+void *operator new(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size ? size : 1)) { return p; }
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
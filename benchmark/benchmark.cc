@@ -1,11 +1,14 @@
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <numeric>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -20,6 +23,22 @@ extern "C" {
 using namespace peg;
 using namespace std;
 
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+// Heap allocations made through operator new (see alloc_count.cc), for the
+// "allocations per parse" figures of the precedence climbing and
+// back-reference cases. Only benchmark_alloc counts them.
+extern atomic<size_t> allocation_count;
+
+template <typename F> static void print_allocations(F func) {
+  auto before = allocation_count.load(memory_order_relaxed);
+  func();
+  cout << "    allocations per parse: "
+       << allocation_count.load(memory_order_relaxed) - before << endl;
+}
+#else
+template <typename F> static void print_allocations(F) {}
+#endif
+
 static string read_file(const string &path) {
   ifstream ifs(path, ios::in | ios::binary);
   if (!ifs) {
@@ -138,13 +157,15 @@ BenchResult bench(const string &name, int iterations, F func) {
 // cpp-peglib benchmarks
 static BenchResult bench_sql_parse(const string &name,
                                    const string &sql_grammar,
-                                   const string &sql_input, int iterations) {
+                                   const string &sql_input, int iterations,
+                                   bool compiled = false, bool packrat = true) {
   parser pg(sql_grammar);
   if (!pg) {
     cerr << "Error: failed to parse SQL grammar" << endl;
     exit(1);
   }
-  pg.enable_packrat_parsing();
+  if (packrat) { pg.enable_packrat_parsing(); }
+  if (compiled) { pg.compile(); }
 
   return bench(name, iterations, [&]() { pg.parse(sql_input); });
 }
@@ -170,6 +191,549 @@ static BenchResult bench_sql_parse_ast(const string &name,
   });
 }
 
+// Literal choices: every 'KEYWORD'i of the SQL grammar in one choice,
+// longest first, matched against the keywords of an SQL input. The grammar
+// finalizer turns the choice into a dictionary; `dictionary` decides whether
+// the parse uses it or the first-byte dispatched loop.
+static string sql_keyword_grammar(const string &sql_grammar) {
+  set<string> keywords;
+  for (size_t end = 0; (end = sql_grammar.find("'i", end)) != string::npos;
+       end += 2) {
+    auto begin = sql_grammar.rfind('\'', end - 1);
+    auto word = sql_grammar.substr(begin + 1, end - begin - 1);
+    if (!word.empty() && all_of(word.begin(), word.end(), ::isupper)) {
+      keywords.insert(word);
+    }
+  }
+  vector<string> sorted(keywords.begin(), keywords.end());
+  stable_sort(sorted.begin(), sorted.end(),
+              [](const string &a, const string &b) {
+                return a.size() > b.size();
+              });
+
+  string grammar = "Keywords <- Keyword*\nKeyword <- ";
+  for (size_t i = 0; i < sorted.size(); i++) {
+    grammar += (i ? " / '" : "'") + sorted[i] + "'i";
+  }
+  return grammar + "\n%whitespace <- [ \\t\\r\\n]*\n";
+}
+
+static string sql_keywords(const string &sql_input, const string &grammar) {
+  string keywords;
+  size_t i = 0;
+  while (i < sql_input.size()) {
+    auto j = i;
+    while (j < sql_input.size() && isalpha(static_cast<unsigned char>(
+                                       sql_input[j]))) {
+      j++;
+    }
+    if (j == i) {
+      i++;
+      continue;
+    }
+    auto word = sql_input.substr(i, j - i);
+    auto upper = word;
+    transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    if (grammar.find("'" + upper + "'i") != string::npos) {
+      keywords += word + " ";
+    }
+    i = j;
+  }
+  return keywords;
+}
+
+// Keyword tables: `per_byte` keywords for each of eight first letters, so
+// that the dispatched loop has `per_byte` literals to try at every keyword.
+static string keyword_table_grammar(size_t per_byte, vector<string> &words) {
+  static const char *tails[] = {"ort",    "elect",  "um",    "ascade",
+                                "ount",   "ast",    "ube",   "ross",
+                                "urrent", "ollate", "heck",  "olumn",
+                                "ommit",  "reate",  "ursor", "onstraint"};
+  words.clear();
+  for (auto first : string("abcdefgh")) {
+    for (size_t i = 0; i < per_byte && i < size(tails); i++) {
+      words.push_back(first + string(tails[i]));
+    }
+  }
+
+  string grammar = "Keywords <- Keyword*\nKeyword <- ";
+  for (size_t i = 0; i < words.size(); i++) {
+    grammar += (i ? " / '" : "'") + words[i] + "'i";
+  }
+  return grammar + "\n%whitespace <- [ \\t\\r\\n]*\n";
+}
+
+static string keyword_table_input(const vector<string> &words, size_t size) {
+  string out;
+  uint32_t x = 12345;
+  while (out.size() < size) {
+    x = x * 1103515245 + 12345;
+    out += words[(x >> 8) % words.size()] + " ";
+  }
+  return out;
+}
+
+static BenchResult bench_keywords(const string &name, const string &grammar,
+                                  const string &input, int iterations,
+                                  bool dictionary) {
+  parser pg(grammar);
+  if (!pg) {
+    cerr << "Error: failed to parse keyword grammar" << endl;
+    exit(1);
+  }
+  // Literal-only rules are tokens: the choice sits in a token boundary.
+  auto ope = pg["Keyword"].get_core_operator();
+  if (auto tb = dynamic_cast<TokenBoundary *>(ope.get())) { ope = tb->ope_; }
+  auto choice = dynamic_cast<PrioritizedChoice *>(ope.get());
+  if (!choice || !choice->dictionary_) {
+    cerr << "Error: keyword choice has no dictionary" << endl;
+    exit(1);
+  }
+  choice->use_dictionary_ = dictionary;
+
+  return bench(name, iterations, [&]() { pg.parse(input); });
+}
+
+// Whitespace with comments: the SQL grammar with `--` and `/* */` comments
+// in %whitespace, on an input with a comment after every statement.
+// `scanner` decides whether the parse uses the native whitespace scanner or
+// the operator tree.
+static string sql_comment_grammar(const string &sql_grammar) {
+  auto grammar = sql_grammar;
+  const string ws = "%whitespace <- [ \\t\\n\\r]*";
+  auto pos = grammar.find(ws);
+  if (pos == string::npos) {
+    cerr << "Error: no %whitespace in SQL grammar" << endl;
+    exit(1);
+  }
+  grammar.replace(pos, ws.size(),
+                  "%whitespace <- ([ \\t\\n\\r] / '--' (!'\\n' .)* / "
+                  "'/*' (!'*/' .)* '*/')*");
+  return grammar;
+}
+
+static string sql_with_comments(const string &sql_input) {
+  string out;
+  for (auto ch : sql_input) {
+    out += ch;
+    if (ch == ';') {
+      out += " -- end of statement\n/* the next statement follows */\n";
+    }
+  }
+  return out;
+}
+
+static BenchResult bench_comments(const string &name, const string &grammar,
+                                  const string &input, int iterations,
+                                  bool scanner) {
+  parser pg(grammar);
+  if (!pg) {
+    cerr << "Error: failed to parse comment grammar" << endl;
+    exit(1);
+  }
+  pg.enable_packrat_parsing();
+  auto ws = dynamic_cast<Whitespace *>(pg["Statements"].whitespaceOpe.get());
+  if (!ws || !ws->scanner_) {
+    cerr << "Error: comment grammar has no whitespace scanner" << endl;
+    exit(1);
+  }
+  if (!scanner) { ws->scanner_.reset(); }
+  if (!pg.parse(input)) {
+    cerr << "Error: failed to parse " << name << endl;
+    exit(1);
+  }
+
+  return bench(name, iterations, [&]() { pg.parse(input); });
+}
+
+// %word checks: the SQL grammar with a %word, so every keyword match is
+// followed by a word check. `rule` puts an action on the word rule, which
+// keeps it from running as a byte lookup.
+static string sql_word_grammar(const string &sql_grammar, bool rule) {
+  return sql_grammar + (rule ? "\n%word <- Word\nWord <- [a-zA-Z0-9_]+\n"
+                             : "\n%word <- [a-zA-Z0-9_]+\n");
+}
+
+static BenchResult bench_word(const string &name, const string &input,
+                              const string &sql_grammar, int iterations,
+                              bool rule) {
+  parser pg(sql_word_grammar(sql_grammar, rule));
+  if (!pg) {
+    cerr << "Error: failed to parse word grammar" << endl;
+    exit(1);
+  }
+  pg.enable_packrat_parsing();
+  if (rule) { pg["Word"] = [](const SemanticValues &) {}; }
+  if (!pg.parse(input)) {
+    cerr << "Error: failed to parse " << name << endl;
+    exit(1);
+  }
+
+  return bench(name, iterations, [&]() { pg.parse(input); });
+}
+
+// Unicode first sets: a config language with CJK keys and values, whose
+// choices start with non-ASCII and negated classes.
+static const char *cjk_config_grammar = R"(
+  Config      <- Entry*
+  Entry       <- Key '=' Value ';'
+  Key         <- Kanji / Kana / Latin
+  Value       <- String / Number / Kanji / Kana / Latin / List
+  List        <- '[' Value (',' Value)* ']'
+  Kanji       <- < [一-龯]+ >
+  Kana        <- < [ぁ-んァ-ン]+ >
+  Latin       <- < [a-zA-Z_] [a-zA-Z0-9_]* >
+  Number      <- < [0-9]+ >
+  String      <- '"' < [^"]* > '"'
+  %whitespace <- [ \t\r\n]*
+)";
+
+static string cjk_config(size_t size) {
+  string out;
+  while (out.size() < size) {
+    out += "設定 = \"値\";\nなまえ = [カタカナ, 漢字, 42, abc];\n"
+           "key_1 = 名前;\n";
+  }
+  return out;
+}
+
+static BenchResult bench_cjk(const string &name, const string &input,
+                             int iterations) {
+  parser pg(cjk_config_grammar);
+  if (!pg || !pg.parse(input)) {
+    cerr << "Error: failed to parse " << name << endl;
+    exit(1);
+  }
+
+  return bench(name, iterations, [&]() { pg.parse(input); });
+}
+
+// Keyword-led statements: a script language whose statement keywords share
+// first letters (SELECT / SET / SHOW, CREATE / CALL / COPY, ...).
+// `prefixes` decides whether the statement choice is dispatched on a
+// prefix of the keyword or on its first byte.
+static const char *statement_grammar = R"(
+  Script     <- (Statement ';')*
+  Statement  <- Select / Set / Show / Savepoint / Start / Create / Call
+              / Commit / Copy / Delete / Drop / Describe / Assignment
+  Select     <- 'SELECT'i List 'FROM'i Name
+  Set        <- 'SET'i Name '=' Value
+  Show       <- 'SHOW'i Name
+  Savepoint  <- 'SAVEPOINT'i Name
+  Start      <- 'START'i 'TRANSACTION'i
+  Create     <- 'CREATE'i 'TABLE'i Name '(' List ')'
+  Call       <- 'CALL'i Name '(' List? ')'
+  Commit     <- 'COMMIT'i
+  Copy       <- 'COPY'i Name 'FROM'i Value
+  Delete     <- 'DELETE'i 'FROM'i Name
+  Drop       <- 'DROP'i 'TABLE'i Name
+  Describe   <- 'DESCRIBE'i Name
+  Assignment <- Name '=' Value
+  List       <- Value (',' Value)*
+  Value      <- Name / Number / String
+  Name       <- < [a-z_]i [a-z0-9_]i* >
+  Number     <- < [0-9]+ >
+  String     <- '\'' < [^']* > '\''
+  %whitespace <- [ \t\r\n]*
+)";
+
+static string statement_script(size_t size) {
+  string out;
+  while (out.size() < size) {
+    out += "SELECT a, b FROM t;\nSET x = 1;\nSHOW tables;\n"
+           "CALL refresh(1, 'all');\nCOPY t FROM 'data.csv';\n"
+           "DELETE FROM t;\nDESCRIBE t;\nCOMMIT;\ny = 'value';\n";
+  }
+  return out;
+}
+
+static BenchResult bench_statements(const string &name, const string &input,
+                                    int iterations, bool prefixes) {
+  parser pg(statement_grammar);
+  if (!pg || !pg.parse(input)) {
+    cerr << "Error: failed to parse " << name << endl;
+    exit(1);
+  }
+  auto choice = dynamic_cast<PrioritizedChoice *>(
+      pg["Statement"].get_core_operator().get());
+  if (!choice || !choice->prefix_length_) {
+    cerr << "Error: statement choice has no prefix table" << endl;
+    exit(1);
+  }
+  if (!prefixes) { choice->prefix_length_ = 0; }
+
+  return bench(name, iterations, [&]() { pg.parse(input); });
+}
+
+// Shared prefixes: every Statement alternative starts with a dotted Path.
+// `factored` decides whether the choice parses the Path once or once per
+// alternative; the action on Statement reads vs.choice() either way.
+static const char *shared_prefix_grammar = R"(
+  Script    <- (Statement ';')*
+  Statement <- Path '(' Args? ')' / Path '[' Value ']' '=' Value
+             / Path '=' Value / Path
+  Path      <- Name ('.' Name)*
+  Args      <- Value (',' Value)*
+  Value     <- Path / Number / String
+  Name      <- < [a-z_]i [a-z0-9_]i* >
+  Number    <- < [0-9]+ >
+  String    <- '\'' < [^']* > '\''
+  %whitespace <- [ \t\r\n]*
+)";
+
+static string shared_prefix_script(size_t size) {
+  string out;
+  while (out.size() < size) {
+    out += "app.views.main.refresh(1, session.user.id);\n"
+           "app.cache.items[42] = 'value';\n"
+           "app.config.theme.name = app.defaults.theme;\n"
+           "app.state.ready;\n";
+  }
+  return out;
+}
+
+static BenchResult bench_shared_prefix(const string &name, const string &input,
+                                       int iterations, bool factored) {
+  parser pg(shared_prefix_grammar);
+  size_t choices = 0;
+  pg["Statement"] = [&](const SemanticValues &vs) { choices += vs.choice(); };
+  if (!pg || !pg.parse(input)) {
+    cerr << "Error: failed to parse " << name << endl;
+    exit(1);
+  }
+  auto choice = dynamic_cast<PrioritizedChoice *>(
+      pg["Statement"].get_core_operator().get());
+  if (!choice || choice->shared_prefix_.empty()) {
+    cerr << "Error: statement choice shares no prefix" << endl;
+    exit(1);
+  }
+  if (!factored) { choice->shared_prefix_.clear(); }
+
+  return bench(name, iterations, [&]() { pg.parse(input); });
+}
+
+// Macros: a list language written with List / Parens / Pair macros, and
+// the same language with the macros expanded by hand.
+static const char *macro_list_grammar = R"(
+  S         <- List(Item) !.
+  Item      <- Parens(List(Pair(Num, Word))) / Pair(Num, Word)
+  Pair(A,B) <- A ':' B
+  List(D)   <- D (Sep(',') D)*
+  Sep(X)    <- X ' '?
+  Parens(D) <- '(' D ')'
+  Num       <- [0-9]+
+  Word      <- [a-z]+
+)";
+
+static const char *expanded_list_grammar = R"(
+  S         <- ItemList !.
+  ItemList  <- Item (Comma Item)*
+  Item      <- '(' PairList ')' / Pair
+  PairList  <- Pair (Comma Pair)*
+  Pair      <- Num ':' Word
+  Comma     <- ',' ' '?
+  Num       <- [0-9]+
+  Word      <- [a-z]+
+)";
+
+static string macro_list(size_t size) {
+  string out;
+  for (size_t i = 0; out.size() < size; i++) {
+    if (i) { out += ", "; }
+    out += i % 3 ? to_string(i) + ":xyz" : "(0:ab, 1:ab, 2:ab)";
+  }
+  return out;
+}
+
+static BenchResult bench_macro(const string &name, const char *grammar,
+                               const string &input, int iterations) {
+  parser pg(grammar);
+  if (!pg || !pg.parse(input)) {
+    cerr << "Error: failed to parse " << name << endl;
+    exit(1);
+  }
+
+  return bench(name, iterations, [&]() { pg.parse(input); });
+}
+
+// Left recursion: long left-associative expression chains parsed with
+// grammar/monkey_left_recursive.peg, where every operator grows a seed.
+static string monkey_expressions(size_t size) {
+  static const char *ops[] = {" + ", " * ", " - ", " == "};
+  string out;
+  for (size_t i = 0; out.size() < size; i++) {
+    out += "let x" + to_string(i) + " = ";
+    for (size_t j = 0; j < 50; j++) {
+      if (j) { out += ops[j % 4]; }
+      switch (j % 3) {
+      case 0: out += "f(" + to_string(j) + ")"; break;
+      case 1: out += "a[" + to_string(j) + "]"; break;
+      default: out += to_string(j); break;
+      }
+    }
+    out += ";\n";
+  }
+  return out;
+}
+
+static BenchResult bench_left_recursion(const string &name,
+                                        const string &grammar,
+                                        const string &input, int iterations,
+                                        bool packrat) {
+  parser pg(grammar);
+  if (packrat) { pg.enable_packrat_parsing(); }
+  if (!pg || !pg.parse(input)) {
+    cerr << "Error: failed to parse " << name << endl;
+    exit(1);
+  }
+
+  return bench(name, iterations, [&]() { pg.parse(input); });
+}
+
+// Precedence climbing: the same kind of chains over all four levels of
+// grammar/monkey.peg's operator table.
+static string infix_expressions(size_t size) {
+  static const char *ops[] = {" + ", " * ", " - ", " / ", " < ", " == "};
+  string out;
+  while (out.size() < size) {
+    out += "let x = ";
+    for (size_t j = 0; j < 50; j++) {
+      if (j) { out += ops[j % 6]; }
+      switch (j % 3) {
+      case 0: out += "f(" + to_string(j) + ")"; break;
+      case 1: out += "a[" + to_string(j) + "]"; break;
+      default: out += to_string(j); break;
+      }
+    }
+    out += ";\n";
+  }
+  return out;
+}
+
+// A single expression over five levels with no whitespace between tokens,
+// evaluated by actions, so every operator goes through the climber.
+static const char *dense_expression_grammar = R"(
+  EXPR <- ATOM (OP ATOM)* {
+    precedence
+      L || &&
+      L == !=
+      L < > <= >=
+      L + -
+      L * / %
+  }
+  ATOM <- NUM / '(' EXPR ')'
+  OP   <- < '||' / '&&' / '==' / '!=' / '<=' / '>=' / [-+*/%<>] >
+  NUM  <- < [0-9]+ >
+  %whitespace <- [ \t\n]*
+)";
+
+static string dense_expression(size_t size) {
+  static const char *ops[] = {"+", "*", "-", "<=", "&&",
+                              "==", "/", "||", "%", ">"};
+  string out = "1";
+  for (size_t i = 0; out.size() < size; i++) {
+    out += ops[i % 10] + to_string(i % 9);
+    if (i % 7 == 0) { out += "*(3+4)"; }
+  }
+  return out;
+}
+
+static BenchResult bench_precedence(const string &name, const string &grammar,
+                                    const string &input, int iterations) {
+  parser pg(grammar);
+  if (!pg || !pg.parse(input)) {
+    cerr << "Error: failed to parse " << name << endl;
+    exit(1);
+  }
+
+  print_allocations([&]() { pg.parse(input); });
+  return bench(name, iterations, [&]() { pg.parse(input); });
+}
+
+static BenchResult bench_dense_expression(const string &name,
+                                          const string &input,
+                                          int iterations) {
+  parser pg(dense_expression_grammar);
+  pg["EXPR"] = [](const SemanticValues &vs) {
+    if (vs.size() == 1) { return any_cast<long>(vs[0]); }
+    return any_cast<long>(vs[0]) + any_cast<long>(vs[2]);
+  };
+  pg["NUM"] = [](const SemanticValues &vs) {
+    return vs.token_to_number<long>();
+  };
+  long value;
+  if (!pg || !pg.parse(input, value)) {
+    cerr << "Error: failed to parse " << name << endl;
+    exit(1);
+  }
+
+  print_allocations([&]() { pg.parse(input, value); });
+  return bench(name, iterations, [&]() { pg.parse(input, value); });
+}
+
+// Back-references: shell heredocs, whose body checks the delimiter at every
+// character, and XML elements, whose end tag must repeat the start tag.
+static const char *heredoc_grammar = R"(
+  SCRIPT  <- (HEREDOC / LINE)*
+  HEREDOC <- 'cat' ' <<' $delim<[A-Z_]+> NL (!$delim .)* $delim NL
+  LINE    <- [^\n]* NL
+  NL      <- '\n'
+  %word   <- [A-Za-z_]+
+)";
+
+static const char *xml_grammar = R"(
+  DOC     <- ELEMENT*
+  ELEMENT <- $(STAG CONTENT ETAG)
+  CONTENT <- (ELEMENT / TEXT)*
+  STAG    <- '<' $tag<NAME> '>'
+  ETAG    <- '</' $tag '>'
+  NAME    <- [a-z_]+
+  TEXT    <- [^<]+
+)";
+
+static string heredoc_script(size_t size) {
+  static const char *delims[] = {"EOF", "END_OF_CONFIGURATION",
+                                 "SQL_QUERY_TEXT", "HTML"};
+  string out;
+  for (size_t i = 0; out.size() < size; i++) {
+    string delim = delims[i % 4];
+    out += "echo " + to_string(i) + "\ncat <<" + delim + "\n";
+    for (size_t j = 0; j < 8; j++) {
+      out += "  line " + to_string(j) + " of block " + to_string(i) + "\n";
+    }
+    out += delim + "\n";
+  }
+  return out;
+}
+
+static string xml_document(size_t size) {
+  static const char *names[] = {"configuration_item", "document_title",
+                                "long_description_text", "a", "section"};
+  string out;
+  for (size_t i = 0; out.size() < size; i++) {
+    string open, close;
+    for (size_t j = 0; j < 4; j++) {
+      string name = names[(i + j) % 5];
+      open += "<" + name + ">";
+      close = "</" + name + ">" + close;
+    }
+    out += open + "text " + to_string(i) + close;
+  }
+  return out;
+}
+
+static BenchResult bench_backrefs(const string &name, const char *grammar,
+                                  const string &input, int iterations) {
+  parser pg(grammar);
+  if (!pg || !pg.parse(input)) {
+    cerr << "Error: failed to parse " << name << endl;
+    exit(1);
+  }
+
+  print_allocations([&]() { pg.parse(input); });
+  return bench(name, iterations, [&]() { pg.parse(input); });
+}
+
 // PostgreSQL YACC (libpg_query) benchmarks
 #ifdef HAS_PG_QUERY
 static BenchResult bench_yacc_parse(const string &name, const string &sql_input,
@@ -430,6 +994,7 @@ static int run_profile(const string &data_dir, int argc, char *argv[]) {
 
 int main(int argc, char *argv[]) {
   string data_dir = BENCHMARK_DATA_DIR;
+  string grammar_dir = BENCHMARK_GRAMMAR_DIR;
 
   // Check for subcommands
   if (argc > 1 && strcmp(argv[1], "profile") == 0) {
@@ -483,6 +1048,37 @@ int main(int argc, char *argv[]) {
   results.push_back(bench_sql_parse_ast("PEG-ast: big.sql (~1MB)", sql_grammar,
                                         big_sql, iterations));
 
+  // Without packrat: every rule call goes through the re-entry guard
+  {
+    cout << endl << "--- cpp-peglib (PEG, no packrat) ---" << endl;
+
+    cout << "[" << test_num++ << "] PEG-nopackrat: TPC-H Q1 (" << q1_sql.size()
+         << " bytes)" << endl;
+    results.push_back(bench_sql_parse("PEG-nopackrat: TPC-H Q1", sql_grammar,
+                                      q1_sql, iterations, false, false));
+
+    cout << "[" << test_num++ << "] PEG-nopackrat: big.sql (" << big_sql.size()
+         << " bytes)" << endl;
+    results.push_back(bench_sql_parse("PEG-nopackrat: big.sql (~1MB)",
+                                      sql_grammar, big_sql, iterations, false,
+                                      false));
+  }
+
+  // Same grammar lowered to bytecode (parser::compile)
+  {
+    cout << endl << "--- cpp-peglib (PEG, bytecode VM) ---" << endl;
+
+    cout << "[" << test_num++ << "] PEG-vm: all TPC-H (" << tpch_sql.size()
+         << " bytes)" << endl;
+    results.push_back(bench_sql_parse("PEG-vm: all TPC-H", sql_grammar,
+                                      tpch_sql, iterations, true));
+
+    cout << "[" << test_num++ << "] PEG-vm: big.sql (" << big_sql.size()
+         << " bytes)" << endl;
+    results.push_back(bench_sql_parse("PEG-vm: big.sql (~1MB)", sql_grammar,
+                                      big_sql, iterations, true));
+  }
+
   // Optimized grammar benchmarks
   {
     auto opt_grammar = read_file(data_dir + "/sql-optimized.peg");
@@ -494,6 +1090,184 @@ int main(int argc, char *argv[]) {
                                       big_sql, iterations));
   }
 
+  // Literal choice benchmarks
+  {
+    auto keyword_grammar = sql_keyword_grammar(sql_grammar);
+    auto keywords = sql_keywords(big_sql, keyword_grammar);
+    cout << endl << "--- cpp-peglib (literal choice, SQL keywords) ---" << endl;
+
+    cout << "[" << test_num++ << "] Keywords: loop (" << keywords.size()
+         << " bytes)" << endl;
+    results.push_back(bench_keywords("Keywords: loop", keyword_grammar,
+                                     keywords, iterations, false));
+
+    cout << "[" << test_num++ << "] Keywords: dictionary (" << keywords.size()
+         << " bytes)" << endl;
+    results.push_back(bench_keywords("Keywords: dictionary", keyword_grammar,
+                                     keywords, iterations, true));
+
+    for (size_t per_byte : {1, 2, 4, 16}) {
+      vector<string> words;
+      auto grammar = keyword_table_grammar(per_byte, words);
+      auto input = keyword_table_input(words, 512 * 1024);
+      auto label = "Keywords x" + to_string(per_byte) + ": ";
+
+      cout << "[" << test_num++ << "] " << label << "loop (" << input.size()
+           << " bytes)" << endl;
+      results.push_back(
+          bench_keywords(label + "loop", grammar, input, iterations, false));
+
+      cout << "[" << test_num++ << "] " << label << "dictionary ("
+           << input.size() << " bytes)" << endl;
+      results.push_back(bench_keywords(label + "dictionary", grammar, input,
+                                       iterations, true));
+    }
+  }
+
+  // Whitespace with comments
+  {
+    auto comment_grammar = sql_comment_grammar(sql_grammar);
+    auto commented_sql = sql_with_comments(big_sql);
+    cout << endl << "--- cpp-peglib (whitespace with comments) ---" << endl;
+
+    cout << "[" << test_num++ << "] Comments: tree (" << commented_sql.size()
+         << " bytes)" << endl;
+    results.push_back(bench_comments("Comments: tree", comment_grammar,
+                                     commented_sql, iterations, false));
+
+    cout << "[" << test_num++ << "] Comments: scanner ("
+         << commented_sql.size() << " bytes)" << endl;
+    results.push_back(bench_comments("Comments: scanner", comment_grammar,
+                                     commented_sql, iterations, true));
+  }
+
+  // %word checks
+  {
+    cout << endl << "--- cpp-peglib (%word checks) ---" << endl;
+
+    cout << "[" << test_num++ << "] Word: class (" << big_sql.size()
+         << " bytes)" << endl;
+    results.push_back(
+        bench_word("Word: class", big_sql, sql_grammar, iterations, false));
+
+    cout << "[" << test_num++ << "] Word: rule (" << big_sql.size()
+         << " bytes)" << endl;
+    results.push_back(
+        bench_word("Word: rule", big_sql, sql_grammar, iterations, true));
+  }
+
+  // Unicode first sets
+  {
+    auto config = cjk_config(big_sql.size());
+    cout << endl << "--- cpp-peglib (Unicode first sets) ---" << endl;
+
+    cout << "[" << test_num++ << "] CJK config (" << config.size()
+         << " bytes)" << endl;
+    results.push_back(bench_cjk("CJK config", config, iterations));
+  }
+
+  // Keyword prefixes
+  {
+    auto script = statement_script(big_sql.size());
+    cout << endl << "--- cpp-peglib (keyword prefixes) ---" << endl;
+
+    cout << "[" << test_num++ << "] Statements: first byte (" << script.size()
+         << " bytes)" << endl;
+    results.push_back(
+        bench_statements("Statements: first byte", script, iterations, false));
+
+    cout << "[" << test_num++ << "] Statements: prefixes (" << script.size()
+         << " bytes)" << endl;
+    results.push_back(
+        bench_statements("Statements: prefixes", script, iterations, true));
+  }
+
+  // Shared prefixes
+  {
+    auto script = shared_prefix_script(big_sql.size());
+    cout << endl << "--- cpp-peglib (shared prefixes) ---" << endl;
+
+    cout << "[" << test_num++ << "] Shared prefixes: each alternative ("
+         << script.size() << " bytes)" << endl;
+    results.push_back(bench_shared_prefix("Shared prefixes: each alternative",
+                                          script, iterations, false));
+
+    cout << "[" << test_num++ << "] Shared prefixes: factored ("
+         << script.size() << " bytes)" << endl;
+    results.push_back(bench_shared_prefix("Shared prefixes: factored", script,
+                                          iterations, true));
+  }
+
+  // Macros
+  {
+    auto list = macro_list(big_sql.size());
+    cout << endl << "--- cpp-peglib (macros) ---" << endl;
+
+    cout << "[" << test_num++ << "] Macros: List(...) (" << list.size()
+         << " bytes)" << endl;
+    results.push_back(
+        bench_macro("Macros: List(...)", macro_list_grammar, list, iterations));
+
+    cout << "[" << test_num++ << "] Macros: expanded (" << list.size()
+         << " bytes)" << endl;
+    results.push_back(bench_macro("Macros: expanded", expanded_list_grammar,
+                                  list, iterations));
+  }
+
+  // Left recursion
+  {
+    auto monkey_grammar =
+        read_file(grammar_dir + "/monkey_left_recursive.peg");
+    auto script = monkey_expressions(128 * 1024);
+    cout << endl << "--- cpp-peglib (left recursion) ---" << endl;
+
+    cout << "[" << test_num++ << "] LR: expressions (" << script.size()
+         << " bytes)" << endl;
+    results.push_back(bench_left_recursion(
+        "LR: expressions", monkey_grammar, script, iterations, false));
+
+    cout << "[" << test_num++ << "] LR: expressions, packrat ("
+         << script.size() << " bytes)" << endl;
+    results.push_back(bench_left_recursion("LR: expressions, packrat",
+                                           monkey_grammar, script, iterations,
+                                           true));
+  }
+
+  // Precedence climbing
+  {
+    auto monkey_grammar = read_file(grammar_dir + "/monkey.peg");
+    auto script = infix_expressions(128 * 1024);
+    cout << endl << "--- cpp-peglib (precedence climbing) ---" << endl;
+
+    cout << "[" << test_num++ << "] Precedence: expressions ("
+         << script.size() << " bytes)" << endl;
+    results.push_back(bench_precedence("Precedence: expressions",
+                                       monkey_grammar, script, iterations));
+
+    auto dense = dense_expression(1024 * 1024);
+    cout << "[" << test_num++ << "] Precedence: dense expression ("
+         << dense.size() << " bytes)" << endl;
+    results.push_back(bench_dense_expression("Precedence: dense expression",
+                                             dense, iterations));
+  }
+
+  // Back-references
+  {
+    auto script = heredoc_script(big_sql.size());
+    auto doc = xml_document(big_sql.size());
+    cout << endl << "--- cpp-peglib (back-references) ---" << endl;
+
+    cout << "[" << test_num++ << "] Backrefs: heredocs (" << script.size()
+         << " bytes)" << endl;
+    results.push_back(bench_backrefs("Backrefs: heredocs", heredoc_grammar,
+                                     script, iterations));
+
+    cout << "[" << test_num++ << "] Backrefs: XML tags (" << doc.size()
+         << " bytes)" << endl;
+    results.push_back(
+        bench_backrefs("Backrefs: XML tags", xml_grammar, doc, iterations));
+  }
+
   // YACC benchmarks
 #ifdef HAS_PG_QUERY
   cout << endl << "--- PostgreSQL YACC (libpg_query) ---" << endl;
@@ -523,6 +1297,7 @@ int main(int argc, char *argv[]) {
     print_result(r);
   }
 
+#ifdef HAS_PG_QUERY
   // Print ratios for big.sql
   auto find_result = [&](const string &name) -> double {
     for (const auto &r : results) {
@@ -531,7 +1306,6 @@ int main(int argc, char *argv[]) {
     return 0.0;
   };
 
-#ifdef HAS_PG_QUERY
   auto peg_big = find_result("PEG: big.sql (~1MB)");
   auto peg_ast_big = find_result("PEG-ast: big.sql (~1MB)");
   auto yacc_big = find_result("YACC: big.sql (~1MB)");
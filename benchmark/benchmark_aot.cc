@@ -0,0 +1,98 @@
+// Ahead-of-time compiled SQL parser (peglint --emit-cpp) against the
+// interpreted one, on the same grammar and inputs as benchmark.cc.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <peglib.h>
+
+#include "sql_peg.h" // generated from data/sql.peg at build time
+
+using namespace peg;
+using namespace std;
+
+static string read_file(const string &path) {
+  ifstream ifs(path, ios::in | ios::binary);
+  if (!ifs) {
+    cerr << "Error: cannot open " << path << endl;
+    exit(1);
+  }
+  return string((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+}
+
+template <typename F> static double median_ms(int iterations, F func) {
+  func(); // warmup
+
+  vector<double> durations;
+  for (int i = 0; i < iterations; i++) {
+    auto start = chrono::high_resolution_clock::now();
+    func();
+    auto end = chrono::high_resolution_clock::now();
+    durations.push_back(
+        chrono::duration_cast<chrono::microseconds>(end - start).count() /
+        1000.0);
+  }
+  sort(durations.begin(), durations.end());
+  auto n = durations.size();
+  return n % 2 == 0 ? (durations[n / 2 - 1] + durations[n / 2]) / 2.0
+                    : durations[n / 2];
+}
+
+int main(int argc, char *argv[]) {
+  string data_dir = BENCHMARK_DATA_DIR;
+  int iterations = 10;
+  if (argc > 1) { iterations = atoi(argv[1]); }
+
+  parser tree(sql_peg::grammar);
+  parser vm(sql_peg::grammar);
+  parser aot(sql_peg::grammar);
+  if (!tree || !vm || !aot) {
+    cerr << "Error: failed to parse SQL grammar" << endl;
+    return 1;
+  }
+  tree.enable_packrat_parsing();
+  vm.enable_packrat_parsing();
+  aot.enable_packrat_parsing();
+  vm.compile();
+  if (!sql_peg::compile(aot)) {
+    cerr << "Error: sql_peg.h was generated from a different grammar" << endl;
+    return 1;
+  }
+
+  struct Input {
+    const char *name;
+    string text;
+  };
+  vector<Input> inputs = {
+      {"TPC-H Q1", read_file(data_dir + "/q1.sql")},
+      {"all TPC-H", read_file(data_dir + "/all-tpch.sql")},
+      {"big.sql", read_file(data_dir + "/big.sql")},
+  };
+
+  cout << "=== Ahead-of-time parser (peglint --emit-cpp), " << iterations
+       << " iterations ===" << endl
+       << endl;
+  cout << "  " << left << setw(12) << "input" << right << setw(14) << "tree"
+       << setw(14) << "bytecode VM" << setw(14) << "AOT" << setw(12)
+       << "tree/AOT" << endl;
+
+  for (const auto &input : inputs) {
+    if (!tree.parse(input.text) || !aot.parse(input.text)) {
+      cerr << "Error: failed to parse " << input.name << endl;
+      return 1;
+    }
+    auto t = median_ms(iterations, [&]() { tree.parse(input.text); });
+    auto v = median_ms(iterations, [&]() { vm.parse(input.text); });
+    auto a = median_ms(iterations, [&]() { aot.parse(input.text); });
+    cout << "  " << left << setw(12) << input.name << right << fixed
+         << setprecision(3) << setw(11) << t << " ms" << setw(11) << v
+         << " ms" << setw(11) << a << " ms" << setw(11) << setprecision(2)
+         << t / a << "x" << endl;
+  }
+  return 0;
+}
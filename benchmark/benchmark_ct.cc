@@ -0,0 +1,150 @@
+// Compile-time combinators (peg::ct) against the same config-file grammar
+// built from the runtime combinators.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <peglib.h>
+
+using namespace peg;
+using namespace std;
+
+// Config  <- (_ Line? _ Comment? '\n')*
+// Line    <- Section / Pair
+// Section <- '[' Name ']'
+// Pair    <- Name _ '=' _ Value
+// Value   <- Number / Bool / String / Name
+// Comment <- '#' (!'\n' .)*
+// _       <- [ \t]*
+
+namespace config_ct {
+
+constexpr char kName[] = "a-zA-Z_.";
+constexpr char kNameRest[] = "a-zA-Z_.0-9-";
+constexpr char kDigit[] = "0-9";
+constexpr char kBlank[] = " \t";
+constexpr char kStringChar[] = "\"\n";
+constexpr char kLineChar[] = "\n";
+constexpr char kTrue[] = "true";
+constexpr char kFalse[] = "false";
+
+struct Sp : ct::zom<ct::cls<kBlank>> {};
+struct Name : ct::seq<ct::cls<kName>, ct::zom<ct::cls<kNameRest>>> {};
+struct Digits : ct::oom<ct::cls<kDigit>> {};
+struct Number : ct::seq<ct::opt<ct::chr<'-'>>, Digits,
+                        ct::opt<ct::seq<ct::chr<'.'>, Digits>>> {};
+struct Bool : ct::cho<ct::lit<kTrue>, ct::lit<kFalse>> {};
+struct String
+    : ct::seq<ct::chr<'"'>, ct::zom<ct::ncls<kStringChar>>, ct::chr<'"'>> {};
+struct Value : ct::cho<Number, Bool, String, Name> {};
+struct Section : ct::seq<ct::chr<'['>, Name, ct::chr<']'>> {};
+struct Pair : ct::seq<Name, Sp, ct::chr<'='>, Sp, Value> {};
+struct Comment : ct::seq<ct::chr<'#'>, ct::zom<ct::ncls<kLineChar>>> {};
+struct Config : ct::zom<ct::seq<Sp, ct::opt<ct::cho<Section, Pair>>, Sp,
+                                ct::opt<Comment>, ct::chr<'\n'>>> {};
+
+} // namespace config_ct
+
+struct ConfigRuntime {
+  Definition CONFIG, LINE, SECTION, PAIR, VALUE, NAME, NUMBER, BOOL, STRING,
+      COMMENT, SP;
+
+  ConfigRuntime() {
+    CONFIG <= zom(seq(SP, opt(LINE), SP, opt(COMMENT), chr('\n')));
+    LINE <= cho(SECTION, PAIR);
+    SECTION <= seq(chr('['), NAME, chr(']'));
+    PAIR <= seq(NAME, SP, chr('='), SP, VALUE);
+    VALUE <= cho(NUMBER, BOOL, STRING, NAME);
+    NAME <= seq(cls("a-zA-Z_."), zom(cls("a-zA-Z_.0-9-")));
+    NUMBER <= seq(opt(chr('-')), oom(cls("0-9")),
+                  opt(seq(chr('.'), oom(cls("0-9")))));
+    BOOL <= cho(lit("true"), lit("false"));
+    STRING <= seq(chr('"'), zom(ncls("\"\n")), chr('"'));
+    COMMENT <= seq(chr('#'), zom(ncls("\n")));
+    SP <= zom(cls(" \t"));
+  }
+};
+
+static string make_config(size_t sections) {
+  string s;
+  for (size_t i = 0; i < sections; i++) {
+    s += "[section." + to_string(i) + "]  # generated\n";
+    s += "name = \"server-" + to_string(i) + "\"\n";
+    s += "port\t= " + to_string(8000 + i) + "\n";
+    s += "ratio = -" + to_string(i % 10) + ".25\n";
+    s += "enabled = true\n";
+    s += "mode = passive-" + to_string(i % 3) + "\n";
+    s += "\n";
+  }
+  return s;
+}
+
+template <typename F> static double median_ms(int iterations, F func) {
+  func(); // warmup
+
+  vector<double> durations;
+  for (int i = 0; i < iterations; i++) {
+    auto start = chrono::high_resolution_clock::now();
+    func();
+    auto end = chrono::high_resolution_clock::now();
+    durations.push_back(
+        chrono::duration_cast<chrono::microseconds>(end - start).count() /
+        1000.0);
+  }
+  sort(durations.begin(), durations.end());
+  auto n = durations.size();
+  return n % 2 == 0 ? (durations[n / 2 - 1] + durations[n / 2]) / 2.0
+                    : durations[n / 2];
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = 10;
+  if (argc > 1) { iterations = atoi(argv[1]); }
+
+  ConfigRuntime runtime;
+
+  struct Input {
+    const char *name;
+    string text;
+  };
+  vector<Input> inputs = {
+      {"small", make_config(10)},
+      {"medium", make_config(1000)},
+      {"large", make_config(50000)},
+  };
+
+  cout << "=== Config grammar: runtime vs compile-time combinators, "
+       << iterations << " iterations ===" << endl
+       << endl;
+  cout << "  " << left << setw(10) << "input" << right << setw(12) << "bytes"
+       << setw(14) << "runtime" << setw(14) << "peg::ct" << setw(12)
+       << "speedup" << endl;
+
+  for (const auto &input : inputs) {
+    const auto &text = input.text;
+    auto r = runtime.CONFIG.parse(text.data(), text.size());
+    auto len = config_ct::Config::match(text.data(), text.size());
+    if (!r.ret || r.len != text.size() || len != text.size()) {
+      cerr << "Error: failed to parse " << input.name << endl;
+      return 1;
+    }
+
+    auto rt = median_ms(iterations, [&]() {
+      runtime.CONFIG.parse(text.data(), text.size());
+    });
+    volatile size_t sink = 0;
+    auto st = median_ms(iterations, [&]() {
+      sink = config_ct::Config::match(text.data(), text.size());
+    });
+    cout << "  " << left << setw(10) << input.name << right << setw(12)
+         << text.size() << fixed << setprecision(3) << setw(11) << rt
+         << " ms" << setw(11) << st << " ms" << setw(11) << setprecision(1)
+         << rt / st << "x" << endl;
+  }
+  return 0;
+}
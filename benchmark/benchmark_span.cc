@@ -0,0 +1,229 @@
+// Span kernels (the ISpan fast path of `[...]*` over ASCII classes) per
+// class shape and run length: the scalar loop against the vector kernels
+// this CPU supports. Then scan-until loops (`(!Stop .)*`) in a parser, run
+// through the operator tree and as one search, and repetitions of classes
+// that are not ASCII-only, per code point and as one decode loop.
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <peglib.h>
+
+using namespace peg;
+using namespace std;
+
+struct Shape {
+  const char *name;
+  string members; // every byte of the class
+  char stop;      // a byte outside the class that ends each run
+};
+
+static bitset<256> class_bits(const string &members) {
+  bitset<256> bits;
+  for (auto ch : members) {
+    bits.set(static_cast<uint8_t>(ch));
+  }
+  return bits;
+}
+
+// Runs of `run` class bytes, each followed by the stop byte.
+static string make_runs(const Shape &shape, size_t run, size_t size) {
+  string s;
+  size_t k = 0;
+  while (s.size() < size) {
+    for (size_t i = 0; i < run; i++) {
+      s += shape.members[k++ % shape.members.size()];
+    }
+    s += shape.stop;
+  }
+  return s;
+}
+
+struct Until {
+  const char *name;
+  const char *grammar;
+  string text;
+};
+
+// The `(!Stop .)*` loop of S; clearing its until_ makes the operator tree
+// step through it one code point at a time.
+static Repetition &until_loop(parser &pg) {
+  auto ope = pg["S"].get_core_operator();
+  auto seq = dynamic_cast<Sequence *>(ope.get());
+  auto rep = seq ? dynamic_cast<Repetition *>(seq->opes_[1].get()) : nullptr;
+  if (!rep || !rep->until_) {
+    cerr << "Error: no scan-until loop" << endl;
+    exit(1);
+  }
+  return *rep;
+}
+
+// The `[...]*` of S; clearing its class_ makes the operator tree match one
+// code point at a time.
+static Repetition &class_loop(parser &pg) {
+  auto ope = pg["S"].get_core_operator();
+  auto seq = dynamic_cast<Sequence *>(ope.get());
+  auto rep = seq ? dynamic_cast<Repetition *>(seq->opes_[0].get()) : nullptr;
+  if (!rep || !rep->class_) {
+    cerr << "Error: no class loop" << endl;
+    exit(1);
+  }
+  return *rep;
+}
+
+template <typename F> static double median_ms(int iterations, F func) {
+  func(); // warmup
+
+  vector<double> durations;
+  for (int i = 0; i < iterations; i++) {
+    auto start = chrono::high_resolution_clock::now();
+    func();
+    auto end = chrono::high_resolution_clock::now();
+    durations.push_back(
+        chrono::duration_cast<chrono::microseconds>(end - start).count() /
+        1000.0);
+  }
+  sort(durations.begin(), durations.end());
+  auto n = durations.size();
+  return n % 2 == 0 ? (durations[n / 2 - 1] + durations[n / 2]) / 2.0
+                    : durations[n / 2];
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = 10;
+  if (argc > 1) { iterations = atoi(argv[1]); }
+
+  string printable; // [ -!#-~], a string body
+  for (char ch = ' '; ch <= '~'; ch++) {
+    if (ch != '"') { printable += ch; }
+  }
+  vector<Shape> shapes = {
+      {"identifier",
+       "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789",
+       ' '},
+      {"digits", "0123456789", ','},
+      {"whitespace", " \t\r\n", 'x'},
+      {"string body", printable, '"'},
+  };
+  vector<size_t> runs = {8, 32, 256, 4096};
+  const size_t size = 8 << 20;
+
+  using Kernel = SpanSet::Kernel;
+  vector<pair<const char *, Kernel>> kernels = {{"scalar", Kernel::Scalar}};
+  auto best = SpanSet::best_kernel();
+  if (best != Kernel::Scalar) { kernels.push_back({"ssse3", Kernel::SSSE3}); }
+  if (best == Kernel::AVX2) { kernels.push_back({"avx2", Kernel::AVX2}); }
+
+  cout << "=== Span kernels, MB/s over " << (size >> 20) << " MB, "
+       << iterations << " iterations ===" << endl
+       << endl;
+  cout << "  " << left << setw(14) << "class" << right << setw(6) << "run";
+  for (const auto &k : kernels) {
+    cout << setw(10) << k.first;
+  }
+  cout << endl;
+
+  for (const auto &shape : shapes) {
+    auto bits = class_bits(shape.members);
+    for (auto run : runs) {
+      auto text = make_runs(shape, run, size);
+      cout << "  " << left << setw(14) << shape.name << right << setw(6)
+           << run;
+      for (const auto &k : kernels) {
+        SpanSet set(bits, k.second);
+        volatile size_t sink = 0;
+        auto ms = median_ms(iterations, [&]() {
+          size_t i = 0;
+          while (i < text.size()) {
+            i += set.span(text.data() + i, text.size() - i) + 1;
+          }
+          sink = sink + i;
+        });
+        cout << setw(10) << fixed << setprecision(0)
+             << text.size() / ms / 1000.0;
+      }
+      cout << endl;
+    }
+  }
+
+  string body;
+  while (body.size() < size) {
+    body += "lorem ipsum * dolor / sit amet, caf\xC3\xA9\n";
+  }
+  vector<Until> untils = {
+      {"line comment", R"(S <- '--' (!'\n' .)* .*)",
+       "--" + string(size, '-')},
+      {"block comment", R"(S <- '/*' (!'*/' .)* '*/')",
+       "/*" + body + "*/"},
+      {"string body", R"(S <- '"' (!["\\] .)* .*)", "\"" + body},
+  };
+
+  cout << endl
+       << "=== Scan until, MB/s over " << (size >> 20) << " MB, "
+       << iterations << " iterations ===" << endl
+       << endl;
+  cout << "  " << left << setw(16) << "loop" << right << setw(10) << "tree"
+       << setw(10) << "search" << endl;
+  for (const auto &until : untils) {
+    parser pg(until.grammar);
+    if (!pg || !pg.parse(until.text)) {
+      cerr << "Error: failed to parse " << until.name << endl;
+      return 1;
+    }
+    auto &rep = until_loop(pg);
+    auto search = rep.until_;
+    cout << "  " << left << setw(16) << until.name << right;
+    for (auto use_search : {false, true}) {
+      rep.until_ = use_search ? search : nullptr;
+      auto ms = median_ms(iterations, [&]() { pg.parse(until.text); });
+      cout << setw(10) << fixed << setprecision(0)
+           << until.text.size() / ms / 1000.0;
+    }
+    cout << endl;
+  }
+
+  string kana, greek, text;
+  while (kana.size() < size) {
+    kana += "ひらがなカタカナ漢字";
+  }
+  while (greek.size() < size) {
+    greek += "alpha\xCE\xB1" "beta\xCE\xB2" "gamma\xCE\xB3";
+  }
+  while (text.size() < size) {
+    text += "caf\xC3\xA9, na\xC3\xAFve, \xE6\x97\xA5\xE6\x9C\xAC; ";
+  }
+  vector<Until> classes = {
+      {"kana/kanji", R"(S <- [ぁ-んァ-ン一-龯]* .*)", kana},
+      {"latin/greek", R"(S <- [a-zα-ω]* .*)", greek},
+      {"negated", R"(S <- [^"]* .*)", text},
+  };
+
+  cout << endl
+       << "=== Non-ASCII classes, MB/s over " << (size >> 20) << " MB, "
+       << iterations << " iterations ===" << endl
+       << endl;
+  cout << "  " << left << setw(16) << "class" << right << setw(10) << "tree"
+       << setw(10) << "decode" << endl;
+  for (const auto &cls : classes) {
+    parser pg(cls.grammar);
+    if (!pg || !pg.parse(cls.text)) {
+      cerr << "Error: failed to parse " << cls.name << endl;
+      return 1;
+    }
+    auto &rep = class_loop(pg);
+    auto body = rep.class_;
+    cout << "  " << left << setw(16) << cls.name << right;
+    for (auto use_decode : {false, true}) {
+      rep.class_ = use_decode ? body : nullptr;
+      auto ms = median_ms(iterations, [&]() { pg.parse(cls.text); });
+      cout << setw(10) << fixed << setprecision(0)
+           << cls.text.size() / ms / 1000.0;
+    }
+    cout << endl;
+  }
+  return 0;
+}
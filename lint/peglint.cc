@@ -45,6 +45,8 @@ int main(int argc, const char **argv) {
   auto opt_verbose = false;
   auto opt_profile = false;
   auto opt_blob = false;
+  auto opt_emit_cpp = false;
+  string opt_namespace;
   vector<const char *> path_list;
 
   auto argi = 1;
@@ -79,6 +81,10 @@ int main(int argc, const char **argv) {
       opt_verbose = true;
     } else if (string("--blob") == arg) {
       opt_blob = true;
+    } else if (string("--emit-cpp") == arg) {
+      opt_emit_cpp = true;
+    } else if (string("--namespace") == arg) {
+      if (argi < argc) { opt_namespace = argv[argi++]; }
     } else {
       path_list.push_back(arg);
     }
@@ -98,6 +104,10 @@ int main(int argc, const char **argv) {
     --verbose: verbose output for trace and profile
     --blob: write a serialized grammar blob to stdout (load it later with
             peg::parser::load_blob to skip the meta-parse on startup)
+    --emit-cpp: write a C++ header with the grammar's rules compiled ahead
+                of time to stdout (attach them with NAMESPACE::compile)
+    --namespace: namespace of the --emit-cpp header (default: the grammar
+                 file name with `_peg` appended, e.g. `sql_peg` for sql.peg)
     --version: show version information
 )";
 
@@ -133,6 +143,31 @@ int main(int argc, const char **argv) {
     return 0;
   }
 
+  if (opt_emit_cpp) {
+    if (opt_namespace.empty()) {
+      string name = syntax_path;
+      auto slash = name.find_last_of("/\\");
+      if (slash != string::npos) { name = name.substr(slash + 1); }
+      name = name.substr(0, name.find('.'));
+      for (auto &ch : name) {
+        if (!isalnum(static_cast<unsigned char>(ch))) { ch = '_'; }
+      }
+      if (name.empty() || isdigit(static_cast<unsigned char>(name[0]))) {
+        name = "_" + name;
+      }
+      opt_namespace = name + "_peg";
+    }
+    try {
+      parser.compile();
+      cout << peg::bytecode_to_cpp(*parser.get_bytecode(), opt_namespace,
+                                   string_view(syntax.data(), syntax.size()));
+    } catch (const std::exception &e) {
+      cerr << "cannot emit C++: " << e.what() << endl;
+      return -1;
+    }
+    return 0;
+  }
+
   {
     using namespace peg;
     auto &grammar = parser.get_grammar();
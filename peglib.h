@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <any>
+#include <array>
 #include <bitset>
 #include <cassert>
 #include <cctype>
@@ -44,6 +45,12 @@
 #include <utility>
 #include <vector>
 
+#if !defined(CPPPEGLIB_NO_SIMD) && defined(__x86_64__) &&                     \
+    (defined(__GNUC__) || defined(__clang__))
+#define CPPPEGLIB_SPAN_X86 1
+#include <immintrin.h>
+#endif
+
 #if !defined(__cplusplus) || __cplusplus < 201703L
 #error "Requires complete C++17 support"
 #endif
@@ -449,75 +456,407 @@ inline std::string to_lower(std::string s) {
 class Trie {
 public:
   Trie(const std::vector<std::string> &items, bool ignore_case)
-      : ignore_case_(ignore_case), items_count_(items.size()) {
-    size_t id = 0;
+      : ignore_case_(ignore_case) {
+    items_.reserve(items.size());
     for (const auto &item : items) {
-      const auto &s = ignore_case ? to_lower(item) : item;
-      if (item.size() > max_len_) { max_len_ = item.size(); }
-      for (size_t len = 1; len <= item.size(); len++) {
-        auto last = len == item.size();
-        std::string_view sv(s.data(), len);
-        auto it = dic_.find(sv);
-        if (it == dic_.end()) {
-          dic_.emplace(sv, Info{last, last, id});
-        } else if (last) {
-          it->second.match = true;
-        } else {
-          it->second.done = false;
+      items_.push_back(ignore_case ? to_lower(item) : item);
+    }
+
+    // Bytes that occur in no item share class 0, which has no transitions.
+    for (const auto &item : items_) {
+      for (auto ch : item) {
+        auto &cls = classes_[static_cast<unsigned char>(ch)];
+        if (!cls) { cls = static_cast<uint16_t>(++width_); }
+      }
+    }
+    width_++;
+    if (ignore_case) {
+      // Fold case into the classes, with the mapping of to_lower (and of
+      // Context::tolower_table), so matching needs no lowered copy.
+      auto folded = classes_;
+      for (size_t ch = 0; ch < 256; ch++) {
+        folded[ch] = classes_[static_cast<unsigned char>(
+            std::tolower(static_cast<int>(ch)))];
+      }
+      classes_ = folded;
+    }
+
+    // State 0 is the root. No transition leads back to it, so 0 in next_
+    // also means "no transition".
+    next_.assign(width_, 0);
+    accept_.push_back(kNoItem);
+    for (size_t id = 0; id < items_.size(); id++) {
+      uint32_t state = 0;
+      for (auto ch : items_[id]) {
+        auto cell = state * width_ + classes_[static_cast<unsigned char>(ch)];
+        if (!next_[cell]) {
+          next_[cell] = static_cast<uint32_t>(accept_.size());
+          next_.resize(next_.size() + width_, 0);
+          accept_.push_back(kNoItem);
         }
+        state = next_[cell];
+      }
+      // A duplicate keeps the first id, as the first alternative wins.
+      if (state && accept_[state] == kNoItem) {
+        accept_[state] = static_cast<uint32_t>(id);
       }
-      id++;
     }
   }
 
+  // Longest item that the text starts with, in one pass over the text.
   size_t match(const char *text, size_t text_len, size_t &id) const {
-    auto limit = std::min(text_len, max_len_);
-    std::string lower_text;
-    if (ignore_case_) {
-      lower_text = to_lower(std::string(text, limit));
-      text = lower_text.data();
-    }
-
     size_t match_len = 0;
-    auto done = false;
-    size_t len = 1;
-    while (!done && len <= limit) {
-      std::string_view sv(text, len);
-      auto it = dic_.find(sv);
-      if (it == dic_.end()) {
-        done = true;
-      } else {
-        if (it->second.match) {
-          match_len = len;
-          id = it->second.id;
-        }
-        if (it->second.done) { done = true; }
+    uint32_t state = 0;
+    for (size_t i = 0; i < text_len; i++) {
+      state = next_[state * width_ +
+                    classes_[static_cast<unsigned char>(text[i])]];
+      if (!state) { break; }
+      if (accept_[state] != kNoItem) {
+        match_len = i + 1;
+        id = accept_[state];
       }
-      len += 1;
     }
     return match_len;
   }
 
-  size_t size() const { return dic_.size(); }
-  size_t items_count() const { return items_count_; }
+  // Number of distinct item prefixes
+  size_t size() const { return accept_.size() - 1; }
+  size_t items_count() const { return items_.size(); }
+
+  // The items in id order, lowercased when case is ignored.
+  const std::vector<std::string> &items() const { return items_; }
 
   friend struct ComputeFirstSet;
   friend struct GrammarBlob;
 
 private:
-  struct Info {
-    bool done;
-    bool match;
-    size_t id;
+  static constexpr uint32_t kNoItem = std::numeric_limits<uint32_t>::max();
+
+  bool ignore_case_;
+  std::vector<std::string> items_;
+
+  // A byte-transition DFA over byte classes: next_[state * width_ + class]
+  // is the state after that byte, and accept_[state] the id of the item
+  // ending there.
+  std::array<uint16_t, 256> classes_{};
+  size_t width_ = 0;
+  std::vector<uint32_t> next_;
+  std::vector<uint32_t> accept_;
+};
+
+/*-----------------------------------------------------------------------------
+ *  Span kernels
+ *---------------------------------------------------------------------------*/
+
+// Length of the longest prefix made of bytes in an ASCII byte set: the inner
+// loop of repetitions over ASCII character classes. The vector kernels look
+// up 16 or 32 bytes at a time with two nibble tables: the high nibble
+// selects a bit (only nibbles 0-7 occur in ASCII, so other bytes never
+// match) and lo_[low nibble] has that bit set for each byte in the set.
+// SSSE3 and AVX2 are detected at run time; define CPPPEGLIB_NO_SIMD to
+// always use the scalar loop.
+class SpanSet {
+public:
+  enum class Kernel { Scalar, SSSE3, AVX2 };
+
+  SpanSet() = default;
+
+  explicit SpanSet(const std::bitset<256> &bits, Kernel kernel = best_kernel())
+      : bits_(bits), kernel_(kernel) {
+    for (size_t ch = 0; ch < 256; ch++) {
+      if (!bits.test(ch)) { continue; }
+      if (ch >= 0x80) {
+        kernel_ = Kernel::Scalar;
+        continue;
+      }
+      lo_[ch & 0x0F] |= static_cast<uint8_t>(1u << (ch >> 4));
+    }
+  }
+
+  static Kernel best_kernel() {
+#ifdef CPPPEGLIB_SPAN_X86
+    static const auto kernel = []() {
+      __builtin_cpu_init(); // may run before main, from a static parser
+      if (__builtin_cpu_supports("avx2")) { return Kernel::AVX2; }
+      if (__builtin_cpu_supports("ssse3")) { return Kernel::SSSE3; }
+      return Kernel::Scalar;
+    }();
+    return kernel;
+#else
+    return Kernel::Scalar;
+#endif
+  }
+
+  size_t span(const char *s, size_t n) const {
+    size_t i = 0;
+#ifdef CPPPEGLIB_SPAN_X86
+    if (kernel_ != Kernel::Scalar) {
+      i = kernel_ == Kernel::AVX2 ? span_avx2(s, n) : span_ssse3(s, n);
+      if (i % 16 || i + 16 <= n) { return i; } // stopped inside a block
+    }
+#endif
+    while (i < n && bits_.test(static_cast<unsigned char>(s[i]))) {
+      i++;
+    }
+    return i;
+  }
+
+  bool test(unsigned char ch) const { return bits_.test(ch); }
+  const std::bitset<256> &bits() const { return bits_; }
+  Kernel kernel() const { return kernel_; }
+
+private:
+#ifdef CPPPEGLIB_SPAN_X86
+  // Both return the index of the first byte outside the set, or the end of
+  // the last whole block when every block was in the set.
+  __attribute__((target("ssse3"))) size_t span_ssse3(const char *s,
+                                                     size_t n) const {
+    const auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo_));
+    const auto hi = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0,
+                                  0, 0, 0);
+    const auto nibble = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+      auto l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble));
+      auto h = _mm_shuffle_epi8(
+          hi, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+      auto out = _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128());
+      auto mask = static_cast<unsigned>(_mm_movemask_epi8(out));
+      if (mask) { return i + static_cast<size_t>(__builtin_ctz(mask)); }
+    }
+    return i;
+  }
+
+  __attribute__((target("avx2"))) size_t span_avx2(const char *s,
+                                                   size_t n) const {
+    const auto lo = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo_)));
+    const auto hi = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128,
+                                     0, 0, 0, 0, 0, 0, 0, 0);
+    const auto nibble = _mm256_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+      auto l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble));
+      auto h = _mm256_shuffle_epi8(
+          hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+      auto out =
+          _mm256_cmpeq_epi8(_mm256_and_si256(l, h), _mm256_setzero_si256());
+      auto mask = static_cast<unsigned>(_mm256_movemask_epi8(out));
+      if (mask) { return i + static_cast<size_t>(__builtin_ctz(mask)); }
+    }
+    if (i + 16 <= n) { return i + span_ssse3(s + i, n - i); }
+    return i;
+  }
+#endif
+
+  std::bitset<256> bits_;
+  alignas(16) uint8_t lo_[16] = {};
+  Kernel kernel_ = Kernel::Scalar;
+};
+
+// `(!Stop .)*` run over bytes, where Stop is a choice of literals or an
+// ASCII character class. Every stop begins with an ASCII byte, so the
+// vector kernels span the other ASCII bytes and only the bytes they stop at
+// need a closer look. `.` steps over a non-ASCII code point at a time, and
+// ends the scan where it fails: at an invalid lead byte, or at a code point
+// cut off by the end of the input. (memchr-style searches cannot stand in
+// for the loop: a lead byte takes the next bytes with it, even an ASCII
+// one that starts a stop.)
+class ScanUntil {
+public:
+  // Literal stops, tried in order; each non-empty and starting with ASCII.
+  explicit ScanUntil(std::vector<std::string> stops)
+      : stops_(std::move(stops)) {
+    std::bitset<256> firsts;
+    for (const auto &stop : stops_) {
+      firsts.set(static_cast<uint8_t>(stop[0]));
+    }
+    init(firsts);
+  }
+
+  // Stop bytes of an ASCII class.
+  explicit ScanUntil(const std::bitset<256> &stop_bytes)
+      : stop_bytes_(stop_bytes) {
+    init(stop_bytes);
+  }
+
+  // Length up to the first stop, or to where `.` fails. `stop` is set to
+  // the length of the stop found there, or 0 if there is none.
+  size_t scan(const char *s, size_t n, size_t &stop) const {
+    stop = 0;
+    size_t i = 0;
+    while (true) {
+      i += body_.span(s + i, n - i);
+      if (i == n) { return i; }
+      auto ch = static_cast<uint8_t>(s[i]);
+      if (ch < 0x80) {
+        if (stop_bytes_.test(ch)) {
+          stop = 1;
+          return i;
+        }
+        for (const auto &lit : stops_) {
+          if (n - i >= lit.size() &&
+              !lit.compare(0, lit.size(), s + i, lit.size())) {
+            stop = lit.size();
+            return i;
+          }
+        }
+        i++;
+        continue;
+      }
+      do {
+        // A class sees the decoded code point, which an overlong sequence
+        // can make ASCII.
+        if (stop_bytes_.any()) {
+          char32_t cp = 0;
+          auto len = decode_codepoint(s + i, n - i, cp);
+          if (cp < 0x80 && stop_bytes_.test(cp)) {
+            stop = len;
+            return i;
+          }
+        }
+        auto len = codepoint_length(s + i, n - i);
+        if (!len) { return i; } // `.` fails here
+        i += len;
+      } while (i < n && static_cast<uint8_t>(s[i]) >= 0x80);
+    }
+  }
+
+  size_t scan(const char *s, size_t n) const {
+    size_t stop;
+    return scan(s, n, stop);
+  }
+
+  const std::vector<std::string> &stops() const { return stops_; }
+  const std::bitset<256> &stop_bytes() const { return stop_bytes_; }
+
+private:
+  void init(const std::bitset<256> &firsts) {
+    std::bitset<256> body;
+    for (size_t ch = 0; ch < 0x80; ch++) {
+      if (!firsts.test(ch)) { body.set(ch); }
+    }
+    body_ = SpanSet(body);
+  }
+
+  SpanSet body_; // ASCII bytes that start no stop
+  std::bitset<256> stop_bytes_;
+  std::vector<std::string> stops_;
+};
+
+// A %whitespace body of the shape `(A / B / ...)*` run as one native loop.
+// Each alternative is one of
+//   - a class: an ASCII character class, `[...]+`, or a one-byte literal;
+//   - a literal;
+//   - a comment: `'open' (!Close .)*`, optionally followed by `Close` or
+//     `Close?`, where the body is a ScanUntil.
+// Alternatives are tried in order, like the choice they come from. A class
+// consumes its whole run at once when no earlier alternative can start
+// with one of its bytes.
+class WhitespaceScanner {
+public:
+  enum class Close { None, Optional, Required };
+
+  struct Item {
+    enum class Kind { Class, Literal, Comment };
+
+    Kind kind = Kind::Class;
+    SpanSet set;                     // Class
+    bool run = false;                // Class: consume the whole run
+    std::string open;                // Literal, Comment
+    std::shared_ptr<ScanUntil> body; // Comment
+    Close close_mode = Close::None;
+
+    static Item byte_class(const std::bitset<256> &bits, bool run) {
+      Item item;
+      item.set = SpanSet(bits);
+      item.run = run;
+      return item;
+    }
+
+    static Item literal(const std::string &lit) {
+      Item item;
+      item.kind = Kind::Literal;
+      item.open = lit;
+      return item;
+    }
+
+    static Item comment(const std::string &open,
+                        std::shared_ptr<ScanUntil> body, Close close_mode) {
+      Item item;
+      item.kind = Kind::Comment;
+      item.open = open;
+      item.body = std::move(body);
+      item.close_mode = close_mode;
+      return item;
+    }
+
+    bool first(unsigned char ch) const {
+      return kind == Kind::Class ? set.test(ch)
+                                 : static_cast<uint8_t>(open[0]) == ch;
+    }
+
+    // Length matched at s, or -1.
+    size_t match(const char *s, size_t n) const {
+      if (kind == Kind::Class) {
+        if (!set.test(static_cast<uint8_t>(*s))) {
+          return static_cast<size_t>(-1);
+        }
+        return run ? set.span(s, n) : 1;
+      }
+      if (n < open.size() || open.compare(0, open.size(), s, open.size())) {
+        return static_cast<size_t>(-1);
+      }
+      if (kind == Kind::Literal) { return open.size(); }
+
+      size_t stop;
+      auto i = open.size();
+      i += body->scan(s + i, n - i, stop);
+      if (!stop) {
+        return close_mode == Close::Required ? static_cast<size_t>(-1) : i;
+      }
+      return close_mode == Close::None ? i : i + stop;
+    }
   };
 
-  // TODO: Use unordered_map when heterogeneous lookup is supported in C++20
-  // std::unordered_map<std::string, Info> dic_;
-  std::map<std::string, Info, std::less<>> dic_;
+  explicit WhitespaceScanner(std::vector<Item> items)
+      : items_(std::move(items)) {
+    first_.fill(static_cast<uint8_t>(items_.size()));
+    for (size_t ch = 0; ch < 256; ch++) {
+      for (size_t j = 0; j < items_.size(); j++) {
+        if (items_[j].first(static_cast<unsigned char>(ch))) {
+          first_[ch] = static_cast<uint8_t>(j);
+          break;
+        }
+      }
+    }
+  }
 
-  bool ignore_case_;
-  size_t items_count_;
-  size_t max_len_ = 0;
+  size_t scan(const char *s, size_t n) const {
+    size_t i = 0;
+    while (i < n) {
+      auto len = static_cast<size_t>(-1);
+      for (size_t j = first_[static_cast<uint8_t>(s[i])];
+           j < items_.size() && len == static_cast<size_t>(-1); j++) {
+        len = items_[j].match(s + i, n - i);
+      }
+      if (len == static_cast<size_t>(-1)) { break; }
+      i += len;
+    }
+    return i;
+  }
+
+  const std::vector<Item> &items() const { return items_; }
+
+  static constexpr size_t kMaxItems = 255;
+
+private:
+  std::vector<Item> items_;
+  // Index of the first alternative that can start with each byte.
+  std::array<uint8_t, 256> first_{};
 };
 
 /*-----------------------------------------------------------------------------
@@ -884,6 +1223,10 @@ private:
  * Context
  */
 class Ope;
+class BytecodeVM;
+class Dictionary;
+class LiteralString;
+class CharacterClass;
 
 using TracerEnter = std::function<void(
     const Ope &name, const char *s, size_t n, const SemanticValues &vs,
@@ -1027,11 +1370,42 @@ public:
   size_t in_token_boundary_count = 0;
 
   std::shared_ptr<Ope> whitespaceOpe;
+  // Set at parse start when whitespaceOpe runs as a native scanner.
+  const WhitespaceScanner *whitespace_scanner = nullptr;
   bool in_whitespace = false;
 
   std::shared_ptr<Ope> wordOpe;
+  // Set at parse start when %word is a class or a class sequence: %word
+  // then matches exactly where the next character is in this set.
+  const std::bitset<256> *word_first = nullptr;
+  // Otherwise the context the word checks run in, made on first use.
+  std::unique_ptr<Context> word_context;
+
+  // Bytecode VM of this parse when the grammar was lowered by
+  // parser::compile(), else null (everything runs on the operator tree).
+  BytecodeVM *vm = nullptr;
+
+  // Named captures ($name<...>) in match order, with the text pointing into
+  // the input. An entry links to the previous capture of the same name id
+  // and capture_last holds the newest entry per id, so a back-reference
+  // finds its text without a scan. Only truncate_captures shortens the list.
+  struct CaptureEntry {
+    std::string_view name;
+    std::string_view text;
+    size_t id;   // interned at grammar load, or -1 when only named
+    size_t prev; // index of the previous entry with this id, or -1
+  };
+  std::vector<CaptureEntry> capture_entries;
+  std::vector<size_t> capture_last;
+
+  // NUL-terminated copies of back-reference texts named in expected-token
+  // lists, which keep a plain pointer. Only filled while reporting errors.
+  std::set<std::string, std::less<>> error_literals;
 
-  std::vector<std::pair<std::string_view, std::string>> capture_entries;
+  // Operator rule of the innermost PrecedenceClimbing while it parses an
+  // operator, and the token that rule matched last.
+  const Definition *binop_rule = nullptr;
+  std::string_view binop_token;
 
   // False when the grammar contains no Cut or Recovery ope (determined once
   // at id-assignment time); lets PrioritizedChoice skip all cut_stack work.
@@ -1052,8 +1426,31 @@ public:
   // are not memoized (replaces the per-position bitvector for them).
   std::vector<const char *> active_pos;
 
+  // Re-entry guard of parses without packrat (see guard_reentry): the
+  // innermost active call per rule id. The rule is kept along with the
+  // position, since a rule shared by two start rules keeps the id the last
+  // one gave it.
+  struct ActiveCall {
+    const Definition *def = nullptr;
+    size_t macro_inst = 0;
+    const char *pos = nullptr;
+  };
+  std::vector<ActiveCall> active_rules;
+  // Calls active_rules cannot key: instantiations of a left-recursive macro,
+  // and rules whose slot is taken. Holds only calls that are running, so it
+  // stays a few entries deep.
+  std::vector<ActiveCall> active_calls;
+
   PackratCache cache_values;
 
+  // What a memoized macro instance added to its caller's scope; a cache hit
+  // appends it again (see Reference::parse_instance).
+  struct MacroMemo {
+    std::vector<std::any> values;
+    std::vector<unsigned int> tags;
+    std::vector<std::string_view> tokens;
+  };
+
   // Left recursion support
   struct LRMemo {
     size_t len = static_cast<size_t>(-1);
@@ -1064,17 +1461,114 @@ public:
   // instantiation it was invoked with (0 for a plain rule). Two
   // instantiations of the same macro grow independent seeds.
   using LRRule = std::pair<const Definition *, size_t>;
-  using LRKey = std::pair<LRRule, const char *>;
-
-  std::map<LRKey, LRMemo> lr_memo;
 
-  // Rules whose lr_memo was hit during the current parse scope.
-  // Used to track LR cycle membership.
-  std::set<LRRule> lr_refs_hit;
+  // Left-recursion memo, flat and indexed by position: the head of a
+  // position (see lr_chain) is its first entry (1-based, 0 = none) and the
+  // entries at one position are chained through `next`. A seed only ever
+  // invalidates entries at its own position, so it walks one short chain
+  // instead of the whole memo. Erased entries go to a free chain for reuse.
+  struct LREntry {
+    LRRule rule;
+    const char *pos = nullptr;
+    LRMemo memo;
+    // In its seeding/growing phase; inner growers must not erase it.
+    bool seeding = false;
+    uint32_t next = 0;
+  };
+  // Heads in chunks of kLRChunk positions, allocated when an entry is first
+  // inserted into them: left recursion in a few places of a large input
+  // costs a few chunks, not a head per input byte.
+  static constexpr size_t kLRChunkBits = 10;
+  static constexpr size_t kLRChunk = size_t(1) << kLRChunkBits;
+  std::vector<std::unique_ptr<uint32_t[]>> lr_heads;
+  std::vector<LREntry> lr_entries;
+  uint32_t lr_free = 0;
+  // Positions outside the input share one chain: a %word check runs on the
+  // text of a literal (see is_word_literal).
+  uint32_t lr_outside = 0;
+
+  // Rules whose LR memo was hit during the current parse scope.
+  // Used to track LR cycle membership. Holds a handful of rules at most, so
+  // a vector beats a set.
+  std::vector<LRRule> lr_refs_hit;
+
+  // The head of the chain at `pos`, or null when its chunk has no entries
+  // and `grow` is false.
+  uint32_t *lr_chain(const char *pos, bool grow) {
+    if (pos < s || pos > s + l) { return &lr_outside; }
+    auto off = static_cast<size_t>(pos - s);
+    auto chunk = off >> kLRChunkBits;
+    if (chunk >= lr_heads.size() || !lr_heads[chunk]) {
+      if (!grow) { return nullptr; }
+      if (chunk >= lr_heads.size()) { lr_heads.resize(chunk + 1); }
+      lr_heads[chunk] = std::make_unique<uint32_t[]>(kLRChunk);
+    }
+    return &lr_heads[chunk][off & (kLRChunk - 1)];
+  }
+
+  // Index of the entry for `rule` at `pos` in lr_entries, or -1.
+  int64_t find_lr(const char *pos, const LRRule &rule) {
+    if (lr_entries.empty()) { return -1; }
+    auto head = lr_chain(pos, false);
+    if (!head) { return -1; }
+    for (auto i = *head; i;) {
+      const auto &e = lr_entries[i - 1];
+      if (e.rule == rule && e.pos == pos) {
+        return static_cast<int64_t>(i - 1);
+      }
+      i = e.next;
+    }
+    return -1;
+  }
+
+  // Add an entry for `rule` at `pos` (not present yet) and return its
+  // index. Indices stay valid until the entry is erased; references into
+  // lr_entries do not survive a later insert.
+  size_t insert_lr(const char *pos, const LRRule &rule, LRMemo memo) {
+    uint32_t i;
+    if (lr_free) {
+      i = lr_free;
+      lr_free = lr_entries[i - 1].next;
+    } else {
+      lr_entries.emplace_back();
+      i = static_cast<uint32_t>(lr_entries.size());
+    }
+    auto &head = *lr_chain(pos, true);
+    auto &e = lr_entries[i - 1];
+    e.rule = rule;
+    e.pos = pos;
+    e.memo = std::move(memo);
+    e.seeding = false;
+    e.next = head;
+    head = i;
+    return i - 1;
+  }
+
+  // Erase the entries at `pos` for which pred(entry) holds.
+  template <typename Pred> void erase_lr_if(const char *pos, Pred pred) {
+    if (lr_entries.empty()) { return; }
+    auto *link = lr_chain(pos, false);
+    if (!link) { return; }
+    while (*link) {
+      auto i = *link;
+      auto &e = lr_entries[i - 1];
+      if (e.pos == pos && pred(e)) {
+        *link = e.next;
+        e.memo.val.reset();
+        e.next = lr_free;
+        lr_free = i;
+      } else {
+        link = &e.next;
+      }
+    }
+  }
 
-  // Rules currently in their seeding/growing phase at a given position.
-  // Protected from having their lr_memo erased by inner growers.
-  std::set<LRKey> lr_active_seeds;
+  void note_lr_hit(const LRRule &rule) {
+    if (std::find(lr_refs_hit.begin(), lr_refs_hit.end(), rule) ==
+        lr_refs_hit.end()) {
+      lr_refs_hit.push_back(rule);
+    }
+  }
 
   // Interned macro instantiations: (definition, resolved arguments) -> id.
   std::map<std::vector<const void *>, size_t> macro_inst_ids;
@@ -1087,6 +1581,12 @@ public:
     return def_id < packrat_index->size() ? (*packrat_index)[def_id] : -1;
   }
 
+  // Whether a memo id has a slot in the cache tables. Macro instances are
+  // numbered after the definitions, so only the filtered tables cover them.
+  bool memoizes(size_t id) const {
+    return enablePackratParsing && packrat_index && cache_slot(id) >= 0;
+  }
+
   void clear_packrat_cache(const char *pos, size_t def_id) {
     if (!enablePackratParsing) { return; }
     auto slot = cache_slot(def_id);
@@ -1142,6 +1642,24 @@ public:
   // can be attached between parses).
   bool recognize_only = false;
 
+  // True when a rule has an enter or leave handler. Those see every rule
+  // call, even one that fails at its first byte, so the first-set guards
+  // in Holder and Repetition stay off. Decided at parse start, like
+  // recognize_only.
+  bool has_enter_leave = false;
+
+  // True when a rule has an action, predicate or enter/leave handler, and
+  // when one of the rules %whitespace or %word reach has one. A choice only
+  // parses the elements its alternatives share once when no rule behind
+  // them has a callback (see PrioritizedChoice::elements_).
+  bool has_rule_callbacks = false;
+  bool whitespace_callbacks = false;
+
+  // True when a log or error reporter is attached (and not silenced by a
+  // Recovery running its recovery expression). Without one, failures record
+  // no error position or expected tokens.
+  bool reports_errors;
+
   // True when error reporting or tracing is active, i.e. when rule_stack
   // must reflect the full chain of rules being parsed. Without them only
   // rules whose body invokes a macro need to appear on the stack (their
@@ -1175,15 +1693,16 @@ public:
                       ? new uint32_t[this->packrat_cached_count * (l + 1)]
                       : nullptr),
         active_pos(enablePackratParsing ? def_count : 0, nullptr),
+        active_rules(enablePackratParsing ? 0 : def_count),
         cache_values(enablePackratParsing ? (packrat_index ? l / 8 + 16 : l / 2)
                                           : 0),
         tracer_enter(tracer_enter), tracer_leave(tracer_leave),
         has_tracer(tracer_enter && tracer_leave), trace_data(trace_data),
         verbose_trace(verbose_trace),
+        reports_errors(static_cast<bool>(log) ||
+                       static_cast<bool>(error_reporter)),
         needs_rule_stack(static_cast<bool>(tracer_enter) ||
-                         static_cast<bool>(tracer_leave) ||
-                         static_cast<bool>(log) ||
-                         static_cast<bool>(error_reporter)),
+                         static_cast<bool>(tracer_leave) || reports_errors),
         log(log), error_reporter(error_reporter) {
 
     for (size_t i = 0; i < 256; i++) {
@@ -1271,6 +1790,84 @@ public:
     }
   }
 
+  // Re-entry guard for parses without packrat: a rule that is already
+  // running at `a_s` fails instead of recursing without end (left recursion
+  // the grammar check did not catch). Calls fn otherwise.
+  template <typename T>
+  void guard_reentry(const char *a_s, const Definition *def, size_t def_id,
+                     size_t &len, T fn) {
+    auto inst = top_macro_inst();
+    if (!inst && def_id < active_rules.size()) {
+      auto &slot = active_rules[def_id];
+      if (slot.def == def && slot.pos == a_s) {
+        len = static_cast<size_t>(-1);
+        return;
+      }
+      if (!slot.def || slot.def == def) {
+        auto save = slot;
+        slot = {def, 0, a_s};
+        fn();
+        active_rules[def_id] = save;
+        return;
+      }
+    }
+
+    for (const auto &call : active_calls) {
+      if (call.def == def && call.macro_inst == inst && call.pos == a_s) {
+        len = static_cast<size_t>(-1);
+        return;
+      }
+    }
+    active_calls.push_back({def, inst, a_s});
+    fn();
+    active_calls.pop_back();
+  }
+
+  // Named captures
+  void push_capture(size_t id, std::string_view name, std::string_view text) {
+    auto prev = static_cast<size_t>(-1);
+    if (id != static_cast<size_t>(-1)) {
+      if (id >= capture_last.size()) {
+        capture_last.resize(id + 1, static_cast<size_t>(-1));
+      }
+      prev = capture_last[id];
+      capture_last[id] = capture_entries.size();
+    }
+    capture_entries.push_back({name, text, id, prev});
+  }
+
+  // A capture that only bkr(name) can find, e.g. one pushed from a cap()
+  // callback. The text must stay valid for the rest of the parse.
+  void push_capture(std::string_view name, std::string_view text) {
+    push_capture(static_cast<size_t>(-1), name, text);
+  }
+
+  void truncate_captures(size_t size) {
+    while (capture_entries.size() > size) {
+      const auto &e = capture_entries.back();
+      if (e.id != static_cast<size_t>(-1)) { capture_last[e.id] = e.prev; }
+      capture_entries.pop_back();
+    }
+  }
+
+  const CaptureEntry *find_capture(size_t id) const {
+    if (id >= capture_last.size()) { return nullptr; }
+    auto i = capture_last[id];
+    return i == static_cast<size_t>(-1) ? nullptr : &capture_entries[i];
+  }
+
+  const CaptureEntry *find_capture(std::string_view name) const {
+    for (auto it = capture_entries.rbegin(); it != capture_entries.rend();
+         ++it) {
+      if (it->name == name) { return &*it; }
+    }
+    return nullptr;
+  }
+
+  const char *keep_error_literal(std::string_view lit) {
+    return error_literals.emplace(lit).first->c_str();
+  }
+
   // Semantic values
   SemanticValues &push_semantic_values_scope() {
     assert(value_stack_size <= value_stack.size());
@@ -1377,7 +1974,7 @@ public:
     vs.sv_ = snap.sv_sv;
     vs.choice_count_ = snap.choice_count;
     vs.choice_ = snap.choice;
-    capture_entries.resize(snap.capture_size);
+    truncate_captures(snap.capture_size);
   }
 
   // Skip trailing whitespace with trace suppression.
@@ -1387,7 +1984,12 @@ public:
                          std::any &dt);
 
   // Error
-  void set_error_pos(const char *a_s, const char *literal = nullptr);
+  // The check stays inline so that failures cost one branch in parses
+  // that report nothing.
+  void set_error_pos(const char *a_s, const char *literal = nullptr) {
+    if (reports_errors) { record_error_pos(a_s, literal); }
+  }
+  void record_error_pos(const char *a_s, const char *literal);
 
   // Trace
   void trace_enter(const Ope &ope, const char *a_s, size_t n,
@@ -1396,6 +1998,17 @@ public:
                    const SemanticValues &vs, std::any &dt, size_t len);
   bool is_traceable(const Ope &ope) const;
 
+  // Runs `fn` with the operators it parses hidden from the tracer, unless
+  // the trace is verbose. ignore_trace_state is only read when a tracer is
+  // attached, so without one this is a plain call.
+  template <typename F> auto untraced(F fn) {
+    if (!has_tracer) { return fn(); }
+    auto save = ignore_trace_state;
+    ignore_trace_state = !verbose_trace;
+    auto se = scope_exit([&]() { ignore_trace_state = save; });
+    return fn();
+  }
+
   // Line info
   std::pair<size_t, size_t> line_info(const char *cur) const {
     // A Context belongs to one parse on one thread, so a plain flag is
@@ -1458,7 +2071,7 @@ public:
 // Avoids bloating all Sequence objects with bitsets and keyword sets.
 struct KeywordGuardData {
   std::bitset<256> identifier_first;        // first char of identifier
-  std::bitset<256> identifier_rest;         // subsequent chars of identifier
+  SpanSet identifier_rest;                  // subsequent chars of identifier
   std::vector<std::string> exact_keywords;  // single-word keywords (lowercase)
   std::vector<std::string> prefix_keywords; // first word of compound keywords
   size_t min_keyword_len = 0;
@@ -1504,6 +2117,7 @@ public:
 
 private:
   friend struct SetupFirstSets;
+  friend struct LowerToBytecode;
   std::unique_ptr<KeywordGuardData> kw_guard_;
 
   // Returns parse result, or nullopt to fall through to normal path
@@ -1515,12 +2129,8 @@ private:
       c.set_error_pos(s);
       return static_cast<size_t>(-1);
     }
-    // Scan identifier using bitset
-    size_t id_len = 1;
-    while (id_len < n &&
-           kw.identifier_rest.test(static_cast<unsigned char>(s[id_len]))) {
-      id_len++;
-    }
+    // Scan identifier using the span kernel
+    auto id_len = 1 + kw.identifier_rest.span(s + 1, n - 1);
     // Skip keyword matching if identifier length is out of range
     if (id_len >= kw.min_keyword_len && id_len <= kw.max_keyword_len) {
       char lower_buf[64];
@@ -1569,6 +2179,12 @@ struct FirstSet {
     if (other.any_char) { any_char = true; }
     // Note: first_literal/first_rule are NOT merged — per-alternative
   }
+
+  // False when the expression cannot match at `s`.
+  bool admits(const char *s, size_t n) const {
+    return any_char || can_be_empty ||
+           (n > 0 && chars.test(static_cast<unsigned char>(*s)));
+  }
 };
 
 class PrioritizedChoice : public Ope {
@@ -1598,15 +2214,40 @@ public:
       if (track_cut) { c.cut_stack.pop_back(); }
     });
 
-    size_t id = 0;
-    for (const auto &ope : opes_) {
+    // Literal-only choice: one trie walk instead of one literal per
+    // alternative. Like the dispatch below, it leaves out the tried
+    // alternatives' error bookkeeping (and trace).
+    if (use_dictionary_ && !c.reports_errors && !c.has_tracer) {
+      if (auto len = parse_dictionary(s, n, vs, c, dt)) { return *len; }
+    }
+
+    // First-byte dispatch: only the alternatives that can start with the
+    // next byte (or the next prefix_length_ bytes) are tried. Skipped
+    // alternatives contribute expected tokens to error messages, so parses
+    // that report errors take the loop below.
+    if (n > 0 && !candidates_.empty() && !c.reports_errors) {
+      const auto &ids =
+          prefix_length_ && n >= prefix_length_
+              ? prefix_dispatch(s, c)
+              : candidates_[dispatch_[static_cast<unsigned char>(*s)]];
+      if (factors_prefixes(c)) {
+        len = parse_factored(ids, s, n, vs, c, dt);
+      } else {
+        for (auto id : ids) {
+          if (parse_alternative(id, s, n, vs, c, dt, len)) { break; }
+        }
+      }
+      c.error_info.keep_previous_token = false;
+      return len;
+    }
+
+    for (size_t id = 0; id < opes_.size(); id++) {
       // First-Set filtering: skip if next byte cannot start this alternative
       if (n > 0 && id < first_sets_.size()) {
         const auto &fs = first_sets_[id];
         if (!fs.any_char && !fs.can_be_empty &&
             !fs.chars.test(static_cast<unsigned char>(*s))) {
-          if ((c.log || c.error_reporter) &&
-              (fs.first_literal || fs.first_rule)) {
+          if (c.reports_errors && (fs.first_literal || fs.first_rule)) {
             if (c.error_info.error_pos <= s) {
               if (c.error_info.error_pos < s || !(id > 0)) {
                 c.error_info.error_pos = s;
@@ -1619,29 +2260,11 @@ public:
               }
             }
           }
-          id++;
           continue;
         }
       }
 
-      if (c.has_cut && !c.cut_stack.empty()) { c.cut_stack.back() = false; }
-
-      auto snap = c.snapshot(vs);
-      c.error_info.keep_previous_token = id > 0;
-
-      len = ope->parse(s, n, vs, c, dt);
-
-      if (success(len)) {
-        vs.choice_count_ = opes_.size();
-        vs.choice_ = id;
-        break;
-      }
-
-      c.rollback(vs, snap);
-
-      if (c.has_cut && !c.cut_stack.empty() && c.cut_stack.back()) { break; }
-
-      id++;
+      if (parse_alternative(id, s, n, vs, c, dt, len)) { break; }
     }
 
     c.error_info.keep_previous_token = false;
@@ -1652,9 +2275,148 @@ public:
 
   size_t size() const { return opes_.size(); }
 
+  // Builds the first-byte dispatch table from first_sets_.
+  void setup_dispatch() {
+    candidates_.clear();
+    if (first_sets_.size() != opes_.size()) { return; }
+
+    std::map<std::vector<uint32_t>, uint8_t> index;
+    for (size_t ch = 0; ch < 256; ch++) {
+      std::vector<uint32_t> ids;
+      for (size_t id = 0; id < first_sets_.size(); id++) {
+        const auto &fs = first_sets_[id];
+        if (fs.any_char || fs.can_be_empty || fs.chars.test(ch)) {
+          ids.push_back(static_cast<uint32_t>(id));
+        }
+      }
+      auto it = index.find(ids);
+      if (it == index.end()) {
+        it = index.emplace(ids, static_cast<uint8_t>(candidates_.size())).first;
+        candidates_.push_back(std::move(ids));
+      }
+      dispatch_[ch] = it->second;
+    }
+  }
+
   std::vector<std::shared_ptr<Ope>> opes_;
   bool for_label_ = false;
   std::vector<FirstSet> first_sets_;
+
+  // dispatch_[byte] indexes the list in candidates_ of the alternatives,
+  // in order, whose first set admits that byte (those that can be empty or
+  // start with any character are in every list). Empty until
+  // setup_dispatch() runs.
+  std::vector<std::vector<uint32_t>> candidates_;
+  std::array<uint8_t, 256> dispatch_{};
+
+  // Prefix dispatch, set up with the first sets when alternatives that share
+  // a first byte start with different literals (`SELECT` / `SET` / `SHOW`).
+  // The next prefix_length_ bytes, folded to lower case, are looked up in
+  // prefix_slots_, an open-addressing table of (key, list index + 1) with 0
+  // marking an empty slot; the list in prefix_candidates_ holds the
+  // alternatives with a matching prefix, and those without a prefix of that
+  // length whose first set admits the key's first byte. Keys not in the
+  // table take prefix_fallback_[first byte], which only has the latter.
+  // prefix_length_ is 0 when there is no table.
+  static constexpr size_t kMaxPrefixKeys = 256;
+  size_t prefix_length_ = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> prefix_slots_;
+  std::vector<std::vector<uint32_t>> prefix_candidates_;
+  std::array<uint32_t, 256> prefix_fallback_{};
+
+  static size_t prefix_slot(uint32_t key, size_t mask) {
+    return (key * 0x9E3779B1u >> 16) & mask;
+  }
+
+  // Set up with the first sets when every alternative is a non-empty
+  // literal of the same case sensitivity and no literal is a prefix of a
+  // later one: then the longest match, which the dictionary finds, is also
+  // the first in order. dictionary_prefix_free_ is true when no literal is a
+  // prefix of another at all. use_dictionary_ is set along with the
+  // dictionary: the trie walk is faster than the dispatched loop even with a
+  // single candidate per first byte. Clearing it makes the choice take the
+  // loop.
+  std::shared_ptr<Dictionary> dictionary_;
+  bool dictionary_prefix_free_ = false;
+  bool use_dictionary_ = false;
+
+  // Left-factoring, set up with the first sets. elements_[id] are the
+  // sequence elements of alternative `id`, and shared_prefix_[id] is how many
+  // of them it has in common with alternative id - 1 (equal OpeSignature, at
+  // most kMaxSharedPrefix). When the alternative tried before `id` failed
+  // past the elements the two share, `id` resumes after them; when it failed
+  // inside one of them, `id` fails without being tried. That is the parse of
+  // `A B / A C` as `A (B / C)`, and vs.choice() and the values are those of
+  // the choice as written. prefix_rules_ are the rules the shared elements
+  // reach: an action, predicate or enter/leave handler on one of them would
+  // see those elements parsed once, so such a parse takes the plain loop, as
+  // does one with more rules behind its shared elements than
+  // kMaxPrefixRules (many_prefix_rules_). The vectors are empty when no
+  // neighbors share an element.
+  static constexpr size_t kMaxSharedPrefix = 8;
+  static constexpr size_t kMaxPrefixRules = 32;
+  std::vector<std::vector<std::shared_ptr<Ope>>> elements_;
+  std::vector<uint8_t> shared_prefix_;
+  size_t max_shared_prefix_ = 0;
+  std::vector<const Definition *> prefix_rules_;
+  bool many_prefix_rules_ = false;
+
+private:
+  mutable std::once_flag init_dictionary_words_;
+  mutable bool dictionary_words_ = false;
+
+  std::optional<size_t> parse_dictionary(const char *s, size_t n,
+                                         SemanticValues &vs, Context &c,
+                                         std::any &dt) const;
+
+  bool factors_prefixes(const Context &c) const;
+  size_t parse_factored(const std::vector<uint32_t> &ids, const char *s,
+                        size_t n, SemanticValues &vs, Context &c,
+                        std::any &dt) const;
+
+  // The candidates for the prefix at `s` (at least prefix_length_ bytes).
+  const std::vector<uint32_t> &prefix_dispatch(const char *s,
+                                               Context &c) const {
+    uint32_t key = 0;
+    for (size_t i = 0; i < prefix_length_; i++) {
+      key |= static_cast<uint32_t>(
+                 c.tolower_table[static_cast<unsigned char>(s[i])])
+             << (8 * i);
+    }
+    auto mask = prefix_slots_.size() - 1;
+    for (auto i = prefix_slot(key, mask);; i = (i + 1) & mask) {
+      const auto &slot = prefix_slots_[i];
+      if (!slot.second) {
+        return prefix_candidates_
+            [prefix_fallback_[static_cast<unsigned char>(*s)]];
+      }
+      if (slot.first == key) { return prefix_candidates_[slot.second - 1]; }
+    }
+  }
+
+  // Tries alternative `id`. Returns true when the choice is settled: the
+  // alternative matched, or it failed past a cut.
+  bool parse_alternative(size_t id, const char *s, size_t n,
+                         SemanticValues &vs, Context &c, std::any &dt,
+                         size_t &len) const {
+    if (c.has_cut && !c.cut_stack.empty()) { c.cut_stack.back() = false; }
+
+    auto snap = c.snapshot(vs);
+    c.error_info.keep_previous_token = id > 0;
+
+    len = opes_[id]->parse(s, n, vs, c, dt);
+
+    if (success(len)) {
+      vs.choice_count_ = opes_.size();
+      vs.choice_ = id;
+      return true;
+    }
+
+    c.rollback(vs, snap);
+
+    return c.has_cut && !c.cut_stack.empty() && c.cut_stack.back();
+  }
+
 };
 
 class Repetition : public Ope {
@@ -1664,23 +2426,11 @@ public:
 
   size_t parse_core(const char *s, size_t n, SemanticValues &vs, Context &c,
                     std::any &dt) const override {
-    // ISpan fast path: tight loop for ASCII CharacterClass repetition.
+    // ISpan fast path: span kernel for ASCII CharacterClass repetition.
     // Safe because each ASCII match is exactly 1 byte, so byte count == match
     // count.
-    if (span_bitset_) {
-      const auto &bitset = *span_bitset_;
-      size_t i = 0;
-      if (max_ == std::numeric_limits<size_t>::max()) {
-        // Unbounded repetition (*, +): no per-iteration max check
-        while (i < n && bitset.test(static_cast<unsigned char>(s[i]))) {
-          i++;
-        }
-      } else {
-        auto limit = std::min(n, max_);
-        while (i < limit && bitset.test(static_cast<unsigned char>(s[i]))) {
-          i++;
-        }
-      }
+    if (span_) {
+      auto i = span_->span(s, std::min(n, max_));
       if (i < min_) {
         c.set_error_pos(s + i);
         return static_cast<size_t>(-1);
@@ -1688,9 +2438,31 @@ public:
       return i;
     }
 
+    // Scan-until fast path; min_ is 0 or 1, and one code point is at least
+    // one byte.
+    if (until_ && use_until(c)) {
+      auto i = until_->scan(s, n);
+      return i < min_ ? static_cast<size_t>(-1) : i;
+    }
+
+    // Other classes span in a decode loop, where no error positions or
+    // traces are kept.
+    if (class_ && !c.reports_errors && !c.has_tracer) {
+      return span_class(s, n);
+    }
+
+    // First-set guard: an iteration that cannot start at the next byte
+    // fails without its snapshot. Nothing else would observe the failure
+    // without error positions, traces, a cut or enter/leave handlers.
+    const auto guard = guard_ && !c.reports_errors && !c.has_tracer &&
+                       !c.has_cut && !c.has_enter_leave;
+
     size_t count = 0;
     size_t i = 0;
     while (count < min_) {
+      if (guard && !first_set_.admits(s + i, n - i)) {
+        return static_cast<size_t>(-1);
+      }
       auto len = ope_->parse(s + i, n - i, vs, c, dt);
       if (fail(len)) { return len; }
       i += len;
@@ -1698,6 +2470,7 @@ public:
     }
 
     while (count < max_) {
+      if (guard && !first_set_.admits(s + i, n - i)) { break; }
       auto snap = c.snapshot(vs);
       auto len = ope_->parse(s + i, n - i, vs, c, dt);
       if (fail(len)) {
@@ -1733,8 +2506,23 @@ public:
   std::shared_ptr<Ope> ope_;
   size_t min_;
   size_t max_;
-  const std::bitset<256> *span_bitset_ =
-      nullptr; // non-owning, set by SetupFirstSets
+  const SpanSet *span_ = nullptr; // non-owning, set by SetupFirstSets
+  // The body when it is a class that is not ASCII-only; likewise.
+  const CharacterClass *class_ = nullptr;
+
+  // `(!Stop .)*` or `(!Stop .)+`, set by SetupFirstSets, with the literals
+  // of Stop.
+  std::shared_ptr<ScanUntil> until_;
+  std::vector<const LiteralString *> until_literals_;
+
+  // The first set of the body, set by SetupFirstSets; guard_ when it can
+  // rule out an iteration.
+  FirstSet first_set_;
+  bool guard_ = false;
+
+private:
+  bool use_until(Context &c) const;
+  size_t span_class(const char *s, size_t n) const;
 };
 
 class AndPredicate : public Ope {
@@ -1841,6 +2629,7 @@ public:
     }
     assert(!ranges_.empty());
     setup_ascii_bitset();
+    setup_matcher();
   }
 
   CharacterClass(const std::vector<std::pair<char32_t, char32_t>> &ranges,
@@ -1848,47 +2637,76 @@ public:
       : ranges_(ranges), negated_(negated), ignore_case_(ignore_case) {
     assert(!ranges_.empty());
     setup_ascii_bitset();
+    setup_matcher();
   }
 
   size_t parse_core(const char *s, size_t n, SemanticValues & /*vs*/,
                     Context &c, std::any & /*dt*/) const override {
-    if (n < 1) {
-      c.set_error_pos(s);
-      return static_cast<size_t>(-1);
-    }
+    auto len = match(s, n);
+    if (fail(len)) { c.set_error_pos(s); }
+    return len;
+  }
+
+  void accept(Visitor &v) override;
+
+  friend struct ComputeFirstSet;
+  friend struct GrammarBlob;
+  friend struct OpeSignature;
 
+  bool is_ascii_only() const { return is_ascii_only_; }
+  const std::bitset<256> &ascii_bitset() const { return ascii_bitset_; }
+  const SpanSet &ascii_span() const { return ascii_span_; }
+
+  // Length of the code point at `s` if the class matches it, else -1.
+  size_t match(const char *s, size_t n) const {
+    if (n < 1) { return static_cast<size_t>(-1); }
+    auto b = static_cast<uint8_t>(s[0]);
+    if (b < 0x80) { return narrow_.test(b) ? 1 : static_cast<size_t>(-1); }
     char32_t cp = 0;
     auto len = decode_codepoint(s, n, cp);
+    return match_codepoint(cp) ? len : static_cast<size_t>(-1);
+  }
 
-    for (const auto &range : ranges_) {
-      if (in_range(range, cp)) {
-        if (negated_) {
-          c.set_error_pos(s);
-          return static_cast<size_t>(-1);
-        } else {
-          return len;
-        }
-      }
-    }
-
-    if (negated_) {
-      return len;
-    } else {
-      c.set_error_pos(s);
-      return static_cast<size_t>(-1);
+  // Bytes taken by up to `max` consecutive matches at `s`, with their
+  // number in `count`: ASCII runs go through the span kernels, the rest
+  // through the decoder. Stops at an undecodable byte, which the class
+  // would match without consuming.
+  size_t span(const char *s, size_t n, size_t max, size_t &count) const {
+    size_t i = 0;
+    count = 0;
+    while (count < max && i < n) {
+      if (static_cast<uint8_t>(s[i]) < 0x80) {
+        auto k = narrow_span_.span(s + i, std::min(n - i, max - count));
+        if (!k) { break; }
+        i += k;
+        count += k;
+        continue;
+      }
+      // Decode and test apart, so the next step need not wait for the test
+      char32_t cp = 0;
+      auto len = decode_codepoint(s + i, n - i, cp);
+      if (!len || !match_codepoint(cp)) { break; }
+      i += len;
+      count++;
     }
+    return i;
   }
 
-  void accept(Visitor &v) override;
-
-  friend struct ComputeFirstSet;
-  friend struct GrammarBlob;
-  friend struct OpeSignature;
-
-  bool is_ascii_only() const { return is_ascii_only_; }
-  const std::bitset<256> &ascii_bitset() const { return ascii_bitset_; }
-
 private:
+  bool match_codepoint(char32_t cp) const {
+    if (cp < 0x100) { return narrow_.test(cp); }
+    if (cp < 0x10000 && !bmp_index_.empty()) {
+      return bmp_blocks_[bmp_index_[cp >> 8]].test(cp & 0xFF);
+    }
+    auto it = std::upper_bound(
+        wide_.begin(), wide_.end(), cp,
+        [](char32_t x, const std::pair<char32_t, char32_t> &range) {
+          return x < range.first;
+        });
+    auto in = it != wide_.begin() && cp <= std::prev(it)->second;
+    return in != negated_;
+  }
+
   bool in_range(const std::pair<char32_t, char32_t> &range, char32_t cp) const {
     if (ignore_case_) {
       auto cpl = std::tolower(cp);
@@ -1915,12 +2733,91 @@ private:
         }
       }
     }
+    ascii_span_ = SpanSet(ascii_bitset_);
+  }
+
+  // The compiled matcher: the answer for each code point below 0x100 (with
+  // negation and case folding applied), and the ranges above it sorted and
+  // merged, bounds folded. tolower leaves code points above 0xFF alone.
+  // Ranges in the BMP also go into a two-level table of 256-code-point
+  // blocks, where block 0 is empty, block 1 full, and the rest partial.
+  void setup_matcher() {
+    std::bitset<256> ascii;
+    for (char32_t cp = 0; cp < 0x100; cp++) {
+      auto in = std::any_of(ranges_.begin(), ranges_.end(),
+                            [&](const std::pair<char32_t, char32_t> &range) {
+                              return in_range(range, cp);
+                            });
+      if (in != negated_) {
+        narrow_.set(cp);
+        if (cp < 0x80) { ascii.set(cp); }
+      }
+    }
+    narrow_span_ = SpanSet(ascii);
+
+    for (auto [lo, hi] : ranges_) {
+      if (ignore_case_) {
+        lo = static_cast<char32_t>(std::tolower(lo));
+        hi = static_cast<char32_t>(std::tolower(hi));
+      }
+      if (hi < 0x100 || lo > hi) { continue; }
+      wide_.emplace_back(std::max<char32_t>(lo, 0x100), hi);
+    }
+    std::sort(wide_.begin(), wide_.end());
+    size_t merged = 0;
+    for (const auto &range : wide_) {
+      if (merged && range.first <= wide_[merged - 1].second + 1) {
+        wide_[merged - 1].second =
+            std::max(wide_[merged - 1].second, range.second);
+      } else {
+        wide_[merged++] = range;
+      }
+    }
+    wide_.resize(merged);
+
+    if (wide_.empty() || wide_.front().first >= 0x10000) { return; }
+    bmp_index_.assign(256, 0);
+    bmp_blocks_.resize(2);
+    bmp_blocks_[1].set();
+    for (const auto &[lo, hi] : wide_) {
+      for (auto block = lo >> 8; block <= std::min<char32_t>(hi, 0xFFFF) >> 8;
+           block++) {
+        char32_t first = block << 8;
+        char32_t last = first + 0xFF;
+        if (lo <= first && last <= hi) {
+          bmp_index_[block] = 1;
+          continue;
+        }
+        if (bmp_index_[block] == 0) {
+          bmp_index_[block] = static_cast<uint16_t>(bmp_blocks_.size());
+          bmp_blocks_.emplace_back();
+        }
+        auto &bits = bmp_blocks_[bmp_index_[block]];
+        for (auto cp = std::max(lo, first); cp <= std::min(hi, last); cp++) {
+          bits.set(cp & 0xFF);
+        }
+      }
+    }
+    if (negated_) {
+      for (size_t i = 2; i < bmp_blocks_.size(); i++) {
+        bmp_blocks_[i].flip();
+      }
+      for (auto &index : bmp_index_) {
+        if (index < 2) { index ^= 1; }
+      }
+    }
   }
 
   std::vector<std::pair<char32_t, char32_t>> ranges_;
   bool negated_;
   bool ignore_case_;
   std::bitset<256> ascii_bitset_;
+  SpanSet ascii_span_;
+  std::bitset<256> narrow_;
+  SpanSet narrow_span_;
+  std::vector<std::pair<char32_t, char32_t>> wide_;
+  std::vector<uint16_t> bmp_index_;
+  std::vector<std::bitset<256>> bmp_blocks_;
   bool is_ascii_only_ = false;
 };
 
@@ -1974,7 +2871,7 @@ public:
                     std::any &dt) const override {
     auto cap_snap = c.capture_entries.size();
     auto len = ope_->parse(s, n, vs, c, dt);
-    c.capture_entries.resize(cap_snap); // Always rollback (isolation)
+    c.truncate_captures(cap_snap); // Always rollback (isolation)
     return len;
   }
 
@@ -2086,6 +2983,11 @@ public:
   mutable std::once_flag trace_name_init_;
   mutable std::string trace_name_;
 
+  // The first set of the rule, set by SetupFirstSets; guard_ when it can
+  // rule out an invocation.
+  FirstSet first_set_;
+  bool guard_ = false;
+
   friend class Definition;
 
 private:
@@ -2095,6 +2997,14 @@ private:
 
 using Grammar = std::unordered_map<std::string, Definition>;
 
+// A macro body instantiated for one argument tuple (see instantiate_macros).
+struct MacroInstance {
+  std::shared_ptr<Ope> ope;
+  // Packrat memo id, numbered after the definition ids of the start rule
+  // that reaches the instance (see AssignIDToDefinition).
+  size_t id = 0;
+};
+
 class Reference : public Ope, public std::enable_shared_from_this<Reference> {
 public:
   Reference(const Grammar &grammar, const std::string &name, const char *s,
@@ -2119,9 +3029,19 @@ public:
   Definition *rule_;
   size_t iarg_;
 
+  // Set by instantiate_macros for a macro invocation. The arguments mention
+  // no macro parameter, so they are used as written instead of being
+  // resolved against the caller's frame.
+  bool args_closed_ = false;
+  // The macro body with these arguments substituted, or null when the
+  // invocation expands at parse time. Owned by rule_->macro_instances.
+  MacroInstance *inst_ = nullptr;
+
 private:
   size_t parse_dispatch(const char *s, size_t n, SemanticValues &vs, Context &c,
                         std::any &dt) const;
+  size_t parse_instance(const char *s, size_t n, SemanticValues &vs, Context &c,
+                        std::any &dt) const;
 };
 
 class Whitespace : public Ope {
@@ -2138,14 +3058,26 @@ public:
 
   void accept(Visitor &v) override;
 
+  // The scanner for this parse, if the body has one and nothing in the
+  // parse can tell the difference.
+  const WhitespaceScanner *scanner(Context &c) const;
+
   std::shared_ptr<Ope> ope_;
+
+  // Set by SetupFirstSets, with the rules and literals the scanner
+  // inlined: actions or a %word can rule it out per parse.
+  std::unique_ptr<WhitespaceScanner> scanner_;
+  std::vector<const Definition *> scanner_rules_;
+  std::vector<const LiteralString *> scanner_literals_;
 };
 
 class BackReference : public Ope {
 public:
-  BackReference(std::string &&name) : name_(std::move(name)) {}
+  BackReference(std::string &&name, size_t id = static_cast<size_t>(-1))
+      : name_(std::move(name)), id_(id) {}
 
-  BackReference(const std::string &name) : name_(name) {}
+  BackReference(const std::string &name, size_t id = static_cast<size_t>(-1))
+      : name_(name), id_(id) {}
 
   size_t parse_core(const char *s, size_t n, SemanticValues &vs, Context &c,
                     std::any &dt) const override;
@@ -2153,6 +3085,9 @@ public:
   void accept(Visitor &v) override;
 
   std::string name_;
+  // Capture name id interned by the grammar loader. A back-reference built
+  // without one finds its capture by name.
+  size_t id_;
 };
 
 class PrecedenceClimbing : public Ope {
@@ -2162,7 +3097,16 @@ public:
   PrecedenceClimbing(const std::shared_ptr<Ope> &atom,
                      const std::shared_ptr<Ope> &binop, const BinOpeInfo &info,
                      const Definition &rule)
-      : atom_(atom), binop_(binop), info_(info), rule_(rule) {}
+      : atom_(atom), binop_(binop), rule_(rule) {
+    // Own the operator names: the caller's keys may point into grammar text
+    // that does not outlive the parser.
+    info_keys_.reserve(info.size());
+    for (const auto &[key, pri] : info) {
+      info_keys_.emplace_back(key);
+      info_.emplace(info_keys_.back(), pri);
+    }
+    index_operators();
+  }
 
   size_t parse_core(const char *s, size_t n, SemanticValues &vs, Context &c,
                     std::any &dt) const override {
@@ -2174,13 +3118,43 @@ public:
   std::shared_ptr<Ope> atom_;
   std::shared_ptr<Ope> binop_;
   BinOpeInfo info_;
-  // Owned backing storage for info_ keys when this node is built by
-  // GrammarBlob::deserialize. Grammars parsed from source leave this empty and
-  // point info_ keys into the retained grammar text instead.
+  // Backing storage for the info_ keys (never reallocated after the
+  // constructor, and the node is never moved once held by shared_ptr).
   std::vector<std::string> info_keys_;
   const Definition &rule_;
 
 private:
+  struct BinOpe {
+    std::string_view key;
+    size_t level;
+    char assoc;
+  };
+
+  // info_ flattened and grouped by the operator's first byte (the empty
+  // operator last): the operators starting with byte b are
+  // opes_[first_[b]] .. opes_[first_[b + 1] - 1].
+  std::vector<BinOpe> opes_;
+  std::array<uint32_t, 258> first_{};
+
+  static size_t bucket(std::string_view key) {
+    return key.empty() ? 256 : static_cast<unsigned char>(key[0]);
+  }
+
+  const BinOpe *find_operator(std::string_view tok) const {
+    auto b = bucket(tok);
+    for (auto i = first_[b]; i < first_[b + 1]; i++) {
+      const auto &ope = opes_[i];
+      if (ope.key.size() == tok.size() &&
+          (tok.empty() ||
+           std::memcmp(ope.key.data(), tok.data(), tok.size()) == 0)) {
+        return &ope;
+      }
+    }
+    return nullptr;
+  }
+
+  void index_operators();
+
   size_t parse_expression(const char *s, size_t n, SemanticValues &vs,
                           Context &c, std::any &dt, size_t min_prec) const;
 
@@ -2325,8 +3299,9 @@ inline std::shared_ptr<Ope> wsp(const std::shared_ptr<Ope> &ope) {
   return std::make_shared<Whitespace>(std::make_shared<Ignore>(ope));
 }
 
-inline std::shared_ptr<Ope> bkr(std::string &&name) {
-  return std::make_shared<BackReference>(name);
+inline std::shared_ptr<Ope> bkr(std::string &&name,
+                                size_t id = static_cast<size_t>(-1)) {
+  return std::make_shared<BackReference>(std::move(name), id);
 }
 
 inline std::shared_ptr<Ope> pre(const std::shared_ptr<Ope> &atom,
@@ -2342,6 +3317,276 @@ inline std::shared_ptr<Ope> rec(const std::shared_ptr<Ope> &ope) {
 
 inline std::shared_ptr<Ope> cut() { return std::make_shared<Cut>(); }
 
+/*
+ * Compile-time combinators
+ *
+ * Type-level counterparts of the factories above. A grammar is a type, every
+ * expression is a struct with a static `match` function, and literals and
+ * class bitsets are fixed at compile time, so the compiler can inline the
+ * whole recognizer with no virtual dispatch:
+ *
+ *   constexpr char kTrue[] = "true";
+ *   struct Digits : peg::ct::oom<peg::ct::cls<kDigit>> {};
+ *   struct Value : peg::ct::cho<Digits, peg::ct::lit<kTrue>> {};
+ *
+ * Rules may refer to rules declared later, which is how recursive grammars
+ * are written. Whitespace is not skipped implicitly. `ope<P>()` wraps a
+ * static grammar so that it can be used as a rule in a dynamic one.
+ */
+namespace ct {
+
+namespace detail {
+
+constexpr size_t npos = static_cast<size_t>(-1);
+
+constexpr size_t length(const char *s) {
+  size_t n = 0;
+  while (s[n]) {
+    n++;
+  }
+  return n;
+}
+
+constexpr char ascii_lower(char c) {
+  return ('A' <= c && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+struct ClassBits {
+  uint64_t words[4] = {};
+  bool ascii = true;
+
+  constexpr void set(size_t ch) { words[ch / 64] |= uint64_t(1) << (ch % 64); }
+  constexpr bool test(uint8_t ch) const {
+    return (words[ch / 64] >> (ch % 64)) & 1;
+  }
+};
+
+// Same spec syntax as the runtime `cls`: single characters and `a-z` ranges.
+constexpr ClassBits class_bits(const char *spec) {
+  ClassBits bits;
+  auto n = length(spec);
+  size_t i = 0;
+  while (i < n) {
+    auto lo = static_cast<uint8_t>(spec[i]);
+    auto hi = lo;
+    if (i + 2 < n && spec[i + 1] == '-') {
+      hi = static_cast<uint8_t>(spec[i + 2]);
+      i += 3;
+    } else {
+      i += 1;
+    }
+    if (lo >= 0x80 || hi >= 0x80) { bits.ascii = false; }
+    for (size_t ch = lo; ch <= hi; ch++) {
+      bits.set(ch);
+    }
+  }
+  return bits;
+}
+
+struct Utf8 {
+  char bytes[4] = {};
+  size_t size = 0;
+};
+
+constexpr Utf8 encode(char32_t cp) {
+  Utf8 u;
+  if (cp < 0x80) {
+    u.bytes[0] = static_cast<char>(cp);
+    u.size = 1;
+  } else if (cp < 0x800) {
+    u.bytes[0] = static_cast<char>(0xC0 | (cp >> 6));
+    u.bytes[1] = static_cast<char>(0x80 | (cp & 0x3F));
+    u.size = 2;
+  } else if (cp < 0x10000) {
+    u.bytes[0] = static_cast<char>(0xE0 | (cp >> 12));
+    u.bytes[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    u.bytes[2] = static_cast<char>(0x80 | (cp & 0x3F));
+    u.size = 3;
+  } else {
+    u.bytes[0] = static_cast<char>(0xF0 | (cp >> 18));
+    u.bytes[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    u.bytes[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    u.bytes[3] = static_cast<char>(0x80 | (cp & 0x3F));
+    u.size = 4;
+  }
+  return u;
+}
+
+// Tokens pushed by `tok` inside a failed alternative are dropped again.
+inline size_t token_mark(SemanticValues *vs) {
+  return vs ? vs->tokens.size() : 0;
+}
+
+inline void token_rollback(SemanticValues *vs, size_t mark) {
+  if (vs) { vs->tokens.resize(mark); }
+}
+
+template <typename P>
+bool match_next(const char *s, size_t n, SemanticValues *vs, size_t &i) {
+  auto len = P::match(s + i, n - i, vs);
+  if (fail(len)) { return false; }
+  i += len;
+  return true;
+}
+
+template <typename P>
+bool match_alt(const char *s, size_t n, SemanticValues *vs, size_t mark,
+               size_t &len) {
+  len = P::match(s, n, vs);
+  if (success(len)) { return true; }
+  token_rollback(vs, mark);
+  return false;
+}
+
+} // namespace detail
+
+template <typename... Ps> struct seq {
+  static size_t match(const char *s, size_t n, SemanticValues *vs = nullptr) {
+    size_t i = 0;
+    if ((detail::match_next<Ps>(s, n, vs, i) && ...)) { return i; }
+    return detail::npos;
+  }
+};
+
+template <typename... Ps> struct cho {
+  static size_t match(const char *s, size_t n, SemanticValues *vs = nullptr) {
+    auto mark = detail::token_mark(vs);
+    size_t len = detail::npos;
+    if ((detail::match_alt<Ps>(s, n, vs, mark, len) || ...)) { return len; }
+    return detail::npos;
+  }
+};
+
+template <typename P, size_t Min, size_t Max> struct rep {
+  static size_t match(const char *s, size_t n, SemanticValues *vs = nullptr) {
+    size_t count = 0;
+    size_t i = 0;
+    while (count < Min) {
+      if (!detail::match_next<P>(s, n, vs, i)) { return detail::npos; }
+      count++;
+    }
+    while (count < Max) {
+      auto mark = detail::token_mark(vs);
+      auto start = i;
+      if (!detail::match_next<P>(s, n, vs, i)) {
+        detail::token_rollback(vs, mark);
+        break;
+      }
+      count++;
+      // An iteration that consumed nothing would repeat forever
+      if (i == start) { break; }
+    }
+    return i;
+  }
+};
+
+template <typename P>
+struct zom : rep<P, 0, std::numeric_limits<size_t>::max()> {};
+
+template <typename P>
+struct oom : rep<P, 1, std::numeric_limits<size_t>::max()> {};
+
+template <typename P> struct opt : rep<P, 0, 1> {};
+
+template <typename P> struct apd {
+  static size_t match(const char *s, size_t n, SemanticValues *vs = nullptr) {
+    auto mark = detail::token_mark(vs);
+    auto len = P::match(s, n, vs);
+    detail::token_rollback(vs, mark);
+    return success(len) ? 0 : detail::npos;
+  }
+};
+
+template <typename P> struct npd {
+  static size_t match(const char *s, size_t n, SemanticValues *vs = nullptr) {
+    auto mark = detail::token_mark(vs);
+    auto len = P::match(s, n, vs);
+    detail::token_rollback(vs, mark);
+    return success(len) ? detail::npos : 0;
+  }
+};
+
+template <const char *Str> struct lit {
+  static constexpr size_t size = detail::length(Str);
+
+  static size_t match(const char *s, size_t n, SemanticValues * = nullptr) {
+    if (n < size) { return detail::npos; }
+    for (size_t i = 0; i < size; i++) {
+      if (s[i] != Str[i]) { return detail::npos; }
+    }
+    return size;
+  }
+};
+
+template <const char *Str> struct liti {
+  static constexpr size_t size = detail::length(Str);
+
+  static size_t match(const char *s, size_t n, SemanticValues * = nullptr) {
+    if (n < size) { return detail::npos; }
+    for (size_t i = 0; i < size; i++) {
+      if (detail::ascii_lower(s[i]) != detail::ascii_lower(Str[i])) {
+        return detail::npos;
+      }
+    }
+    return size;
+  }
+};
+
+template <const char *Spec, bool Negated> struct class_match {
+  static constexpr detail::ClassBits bits = detail::class_bits(Spec);
+  static_assert(bits.ascii, "peg::ct classes are limited to ASCII");
+
+  static size_t match(const char *s, size_t n, SemanticValues * = nullptr) {
+    if (n < 1) { return detail::npos; }
+    auto b = static_cast<uint8_t>(s[0]);
+    if (b < 0x80) { return bits.test(b) != Negated ? 1 : detail::npos; }
+    if (!Negated) { return detail::npos; }
+    char32_t cp = 0;
+    auto len = decode_codepoint(s, n, cp);
+    return len < 1 ? detail::npos : len;
+  }
+};
+
+template <const char *Spec> struct cls : class_match<Spec, false> {};
+
+template <const char *Spec> struct ncls : class_match<Spec, true> {};
+
+template <char32_t Ch> struct chr {
+  static constexpr detail::Utf8 utf8 = detail::encode(Ch);
+
+  static size_t match(const char *s, size_t n, SemanticValues * = nullptr) {
+    if (n < utf8.size) { return detail::npos; }
+    for (size_t i = 0; i < utf8.size; i++) {
+      if (s[i] != utf8.bytes[i]) { return detail::npos; }
+    }
+    return utf8.size;
+  }
+};
+
+struct dot {
+  static size_t match(const char *s, size_t n, SemanticValues * = nullptr) {
+    auto len = codepoint_length(s, n);
+    return len < 1 ? detail::npos : len;
+  }
+};
+
+// Records the match in `vs.tokens` when run through `ope`.
+template <typename P> struct tok {
+  static size_t match(const char *s, size_t n, SemanticValues *vs = nullptr) {
+    auto len = P::match(s, n, vs);
+    if (vs && success(len)) { vs->tokens.emplace_back(s, len); }
+    return len;
+  }
+};
+
+template <typename P> std::shared_ptr<Ope> ope() {
+  return usr([](const char *s, size_t n, SemanticValues &vs, std::any &) {
+    return P::match(s, n, &vs);
+  });
+}
+
+} // namespace ct
+
 /*
  * Visitor
  */
@@ -2451,11 +3696,17 @@ struct AssignIDToDefinition : public TraversalVisitor {
   void visit(User &) override { has_opaque_ope = true; }
 
   std::unordered_map<void *, size_t> ids;
+  // Macro instances reached, in the order of their memo ids (which follow
+  // the definition ids).
+  std::vector<MacroInstance *> instances;
+  std::unordered_set<const MacroInstance *> instance_set;
   Definition *current_def = nullptr; // rule whose body is being walked
   bool has_cut = false;              // grammar contains a Cut or Recovery ope
   // Grammar contains an ope whose semantic-value use cannot be seen from
-  // Definition callbacks alone (User callbacks, PrecedenceClimbing's
-  // in-parse action swapping); disqualifies recognizer mode.
+  // Definition callbacks alone (User callbacks; PrecedenceClimbing, which
+  // builds values and reports the operator token through
+  // Context::binop_rule/binop_token outside Definition callbacks);
+  // disqualifies recognizer mode.
   bool has_opaque_ope = false;
 };
 
@@ -2666,8 +3917,12 @@ struct OpeSignature : public Ope::Visitor {
   void visit(Recovery &ope) override { unary("rec", *ope.ope_); }
   // A rule is named, never expanded — that is what keeps a recursive
   // grammar's signature finite. WeakHolder only ever wraps a Holder, so
-  // descending through it lands on a name too.
-  void visit(Holder &ope) override { s += "(hld " + ope.name() + ")"; }
+  // descending through it lands on a name too. Combinator-built rules may
+  // share a name (or have none), so a Holder also carries its Definition.
+  void visit(Holder &ope) override {
+    s += "(hld " + ope.name() + " " +
+         std::to_string(reinterpret_cast<std::uintptr_t>(ope.outer_)) + ")";
+  }
   void visit(WeakHolder &ope) override {
     if (auto p = ope.weak_.lock()) {
       unary("wek", *p);
@@ -2736,6 +3991,29 @@ private:
   }
 };
 
+// The rules an operator reaches, through references and macro instances.
+// `opaque` is set when it reaches a cut, a left-recursive rule, or an
+// operator that runs a callback of its own (User, Capture,
+// PrecedenceClimbing).
+struct CollectReachableRules : public TraversalVisitor {
+  using TraversalVisitor::visit;
+
+  void visit(Holder &ope) override;
+  void visit(Reference &ope) override;
+  void visit(Capture &) override { opaque = true; }
+  void visit(User &) override { opaque = true; }
+  void visit(PrecedenceClimbing &) override { opaque = true; }
+  void visit(Recovery &) override { opaque = true; }
+  void visit(Cut &) override { opaque = true; }
+
+  std::vector<const Definition *> rules;
+  bool opaque = false;
+
+private:
+  std::unordered_set<const Definition *> seen_;
+  std::unordered_set<const MacroInstance *> instances_;
+};
+
 struct HasEmptyElement : public TraversalVisitor {
   using TraversalVisitor::visit;
 
@@ -2858,6 +4136,49 @@ private:
   const std::vector<std::string> &params_;
 };
 
+// What the inlining pass needs to know about a rule body: its number of
+// operators, the rules it references (macro arguments included, rule bodies
+// not walked) and whether it calls a macro or reads a macro parameter.
+struct CollectRuleShape : public TraversalVisitor {
+  using TraversalVisitor::visit;
+
+  void visit(Sequence &ope) override { nest(ope); }
+  void visit(PrioritizedChoice &ope) override { nest(ope); }
+  void visit(Repetition &ope) override { nest(ope); }
+  void visit(AndPredicate &ope) override { nest(ope); }
+  void visit(NotPredicate &ope) override { nest(ope); }
+  void visit(CaptureScope &ope) override { nest(ope); }
+  void visit(Capture &ope) override { nest(ope); }
+  void visit(TokenBoundary &ope) override { nest(ope); }
+  void visit(Ignore &ope) override { nest(ope); }
+  void visit(Whitespace &ope) override { nest(ope); }
+  void visit(Recovery &ope) override { nest(ope); }
+  void visit(Dictionary &) override { opes++; }
+  void visit(LiteralString &) override { opes++; }
+  void visit(CharacterClass &) override { opes++; }
+  void visit(Character &) override { opes++; }
+  void visit(AnyCharacter &) override { opes++; }
+  void visit(User &) override { opes++; }
+  void visit(BackReference &) override { opes++; }
+  void visit(Cut &) override { opes++; }
+  void visit(PrecedenceClimbing &) override {
+    opes = std::numeric_limits<size_t>::max() / 2;
+  }
+  void visit(WeakHolder &ope) override;
+  void visit(Holder &ope) override;
+  void visit(Reference &ope) override;
+
+  size_t opes = 0;
+  std::unordered_set<const Definition *> rules;
+  bool calls_macro = false;
+
+private:
+  template <typename T> void nest(T &ope) {
+    opes++;
+    TraversalVisitor::visit(ope);
+  }
+};
+
 struct FindReference : public Ope::Visitor {
   using Ope::Visitor::visit;
 
@@ -2942,6 +4263,82 @@ private:
   const std::vector<std::string> &params_;
 };
 
+// Copies a macro body with its parameters replaced by the arguments of one
+// invocation (see instantiate_macros). Subtrees that mention no parameter
+// are shared rather than copied. A macro invocation whose arguments change
+// becomes a new Reference, collected in `calls` for the caller to
+// instantiate in turn.
+struct SubstituteMacroParams : public Ope::Visitor {
+  using Ope::Visitor::visit;
+
+  SubstituteMacroParams(const std::vector<std::shared_ptr<Ope>> &args)
+      : args_(args) {}
+
+  // The substituted operator, or `ope` itself when nothing in it changes.
+  std::shared_ptr<Ope> apply(const std::shared_ptr<Ope> &ope) {
+    auto save = std::move(result_);
+    ope->accept(*this);
+    auto ret = result_ ? std::move(result_) : ope;
+    result_ = std::move(save);
+    return ret;
+  }
+
+  void visit(Sequence &ope) override {
+    auto opes = apply_all(ope.opes_);
+    if (!opes.empty()) { result_ = std::make_shared<Sequence>(opes); }
+  }
+  void visit(PrioritizedChoice &ope) override {
+    auto opes = apply_all(ope.opes_);
+    if (!opes.empty()) {
+      auto choice = std::make_shared<PrioritizedChoice>(opes);
+      choice->for_label_ = ope.for_label_;
+      result_ = choice;
+    }
+  }
+  void visit(Repetition &ope) override {
+    unary(ope.ope_, [&](auto p) { return rep(p, ope.min_, ope.max_); });
+  }
+  void visit(AndPredicate &ope) override { unary(ope.ope_, apd); }
+  void visit(NotPredicate &ope) override { unary(ope.ope_, npd); }
+  void visit(CaptureScope &ope) override { unary(ope.ope_, csc); }
+  void visit(Capture &ope) override {
+    unary(ope.ope_, [&](auto p) { return cap(p, ope.match_action_); });
+  }
+  void visit(TokenBoundary &ope) override { unary(ope.ope_, tok); }
+  void visit(Ignore &ope) override { unary(ope.ope_, ign); }
+  void visit(Reference &ope) override;
+  void visit(Whitespace &ope) override { unary(ope.ope_, wsp); }
+  // The operator table resolves its binop through the argument frame.
+  void visit(PrecedenceClimbing &) override { failed = true; }
+  void visit(Recovery &ope) override { unary(ope.ope_, rec); }
+
+  std::vector<Reference *> calls;
+  bool failed = false;
+
+private:
+  // The substituted operators, or none when all of them are unchanged.
+  std::vector<std::shared_ptr<Ope>>
+  apply_all(const std::vector<std::shared_ptr<Ope>> &opes) {
+    std::vector<std::shared_ptr<Ope>> ret;
+    for (size_t i = 0; i < opes.size(); i++) {
+      auto op = apply(opes[i]);
+      if (op != opes[i] && ret.empty()) {
+        ret.assign(opes.begin(), opes.begin() + static_cast<ptrdiff_t>(i));
+      }
+      if (!ret.empty() || op != opes[i]) { ret.push_back(std::move(op)); }
+    }
+    return ret;
+  }
+
+  template <typename F> void unary(const std::shared_ptr<Ope> &ope, F make) {
+    auto op = apply(ope);
+    if (op != ope) { result_ = make(op); }
+  }
+
+  const std::vector<std::shared_ptr<Ope>> &args_;
+  std::shared_ptr<Ope> result_;
+};
+
 /*
  * First-Set computation
  */
@@ -2983,8 +4380,10 @@ struct ComputeFirstSet : public TraversalVisitor {
   void visit(AndPredicate &) override { result_.can_be_empty = true; }
   void visit(NotPredicate &) override { result_.can_be_empty = true; }
   void visit(Dictionary &ope) override {
-    for (const auto &[key, info] : ope.trie_.dic_) {
-      if (!key.empty()) {
+    for (const auto &key : ope.trie_.items()) {
+      if (key.empty()) {
+        result_.can_be_empty = true;
+      } else {
         auto ch = static_cast<unsigned char>(key[0]);
         result_.chars.set(ch);
         if (ope.trie_.ignore_case_) {
@@ -3008,31 +4407,38 @@ struct ComputeFirstSet : public TraversalVisitor {
     }
   }
   void visit(CharacterClass &ope) override {
+    std::bitset<256> chars;
     for (const auto &range : ope.ranges_) {
       auto cp1 = range.first;
       auto cp2 = range.second;
-      if (cp1 > 0x7F || cp2 > 0x7F) {
-        // Non-ASCII range: conservative fallback
-        result_.any_char = true;
-        return;
-      }
-      for (auto cp = cp1; cp <= cp2; cp++) {
+      for (auto cp = cp1; cp <= std::min<char32_t>(cp2, 0x7F); cp++) {
         auto ch = static_cast<unsigned char>(cp);
-        result_.chars.set(ch);
+        chars.set(ch);
         if (ope.ignore_case_) {
-          result_.chars.set(static_cast<unsigned char>(std::toupper(ch)));
-          result_.chars.set(static_cast<unsigned char>(std::tolower(ch)));
+          chars.set(static_cast<unsigned char>(std::toupper(ch)));
+          chars.set(static_cast<unsigned char>(std::tolower(ch)));
         }
       }
+      if (cp2 > 0x7F && !ope.negated_) {
+        add_lead_bytes(chars, std::max<char32_t>(cp1, 0x80), cp2);
+        // A locale's tolower can fold Latin-1 code points onto the range
+        if (ope.ignore_case_) { add_lead_bytes(chars, 0x80, 0xFF); }
+      }
     }
     if (ope.negated_) {
-      result_.chars.flip();
-      result_.any_char = true; // negated class can match non-ASCII
+      // Any non-ASCII code point may fall outside the ranges
+      for (size_t ch = 0; ch < 0x80; ch++) {
+        chars.flip(ch);
+      }
+      for (size_t ch = 0x80; ch < 0x100; ch++) {
+        chars.set(ch);
+      }
     }
+    result_.chars |= chars;
   }
   void visit(Character &ope) override {
     if (ope.ch_ > 0x7F) {
-      result_.any_char = true;
+      add_lead_bytes(result_.chars, ope.ch_, ope.ch_);
     } else {
       result_.chars.set(static_cast<unsigned char>(ope.ch_));
     }
@@ -3053,44 +4459,208 @@ struct ComputeFirstSet : public TraversalVisitor {
 
   explicit ComputeFirstSet(FirstSetCache &cache) : cache_(cache) {}
 
+  // The first set of a whole rule, as a reference to it sees it.
+  const FirstSet &rule(Definition &def);
+
+  // Whether the computation went around a cycle (left recursion). Treating
+  // a nullable rule on the cycle as non-empty can then lose first bytes.
+  bool hit_cycle() const { return cycle_count_ > 0; }
+
   FirstSet result_;
 
 private:
+  // The lead bytes of UTF-8 sequences that decode_codepoint reads as a code
+  // point in [lo, hi], overlong forms included (lo >= 0x80).
+  static void add_lead_bytes(std::bitset<256> &chars, char32_t lo,
+                             char32_t hi) {
+    for (size_t b = 0xC0; b < 0xF8; b++) {
+      char32_t first, last;
+      if (b < 0xE0) {
+        first = static_cast<char32_t>(b & 0x1F) << 6;
+        last = first + 0x3F;
+      } else if (b < 0xF0) {
+        first = static_cast<char32_t>(b & 0x0F) << 12;
+        last = first + 0xFFF;
+      } else {
+        first = static_cast<char32_t>(b & 0x07) << 18;
+        last = first + 0x3FFFF;
+      }
+      if (first <= hi && lo <= last) { chars.set(b); }
+    }
+  }
+
   FirstSetCache &cache_;
   std::unordered_set<const Definition *> refs_;
+  std::unordered_set<const MacroInstance *> insts_;
   size_t cycle_count_ = 0;
 };
 
-struct SetupFirstSets : public TraversalVisitor {
-  using TraversalVisitor::visit;
+/*
+ * Prefix computation
+ */
+// The leading bytes, up to kMaxLength and folded with to_lower, that every
+// match of an expression starts with: one string per way it can start.
+// Literals and dictionaries give prefixes, through sequences (after their
+// predicates), choices, `+`, captures and rules; any other start leaves
+// result_ empty.
+struct ComputePrefixes : public Ope::Visitor {
+  using Ope::Visitor::visit;
 
-  void visit(Sequence &ope) override;
-  void setup_keyword_guarded_identifier(Sequence &ope);
+  static constexpr size_t kMaxLength = 4;
+  static constexpr size_t kMaxPrefixes = 64;
 
-  void visit(PrioritizedChoice &ope) override {
-    ope.first_sets_.clear();
-    ope.first_sets_.reserve(ope.opes_.size());
-    for (const auto &op : ope.opes_) {
-      ComputeFirstSet cfs(first_set_cache_);
-      op->accept(cfs);
-      ope.first_sets_.push_back(cfs.result_);
-    }
+  using Prefixes = std::optional<std::vector<std::string>>;
+  using PrefixCache = std::unordered_map<const Definition *, Prefixes>;
+
+  explicit ComputePrefixes(PrefixCache &cache) : cache_(cache) {}
+
+  // Sets result_ and zero_width_ for `ope`.
+  void compute(Ope &ope) {
+    result_.reset();
+    zero_width_ = false;
+    ope.accept(*this);
+  }
+
+  void visit(Sequence &ope) override {
     for (const auto &op : ope.opes_) {
-      op->accept(*this);
+      compute(*op);
+      if (!zero_width_) { return; }
     }
   }
-  void visit(Repetition &ope) override {
-    ope.ope_->accept(*this);
+  void visit(PrioritizedChoice &ope) override {
+    std::vector<std::string> prefixes;
+    for (const auto &op : ope.opes_) {
+      compute(*op);
+      if (!result_) {
+        zero_width_ = false;
+        return;
+      }
+      for (auto &prefix : *result_) {
+        add(prefixes, std::move(prefix));
+      }
+    }
+    set(std::move(prefixes));
+  }
+  void visit(Repetition &ope) override {
+    if (ope.min_ > 0) { ope.ope_->accept(*this); }
+  }
+  void visit(AndPredicate &) override { zero_width_ = true; }
+  void visit(NotPredicate &) override { zero_width_ = true; }
+  void visit(Cut &) override { zero_width_ = true; }
+  void visit(Dictionary &ope) override {
+    std::vector<std::string> prefixes;
+    for (const auto &key : ope.trie_.items()) {
+      if (key.empty()) { return; }
+      add(prefixes, to_lower(key.substr(0, kMaxLength)));
+    }
+    set(std::move(prefixes));
+  }
+  void visit(LiteralString &ope) override {
+    if (!ope.lit_.empty()) {
+      set({to_lower(ope.lit_.substr(0, kMaxLength))});
+    }
+  }
+  void visit(CaptureScope &ope) override { ope.ope_->accept(*this); }
+  void visit(Capture &ope) override { ope.ope_->accept(*this); }
+  void visit(TokenBoundary &ope) override { ope.ope_->accept(*this); }
+  void visit(Ignore &ope) override { ope.ope_->accept(*this); }
+  void visit(WeakHolder &ope) override { ope.weak_.lock()->accept(*this); }
+  void visit(Holder &ope) override { ope.ope_->accept(*this); }
+  void visit(Reference &ope) override;
+
+  Prefixes result_;
+  bool zero_width_ = false;
+
+private:
+  static void add(std::vector<std::string> &prefixes, std::string prefix) {
+    if (std::find(prefixes.begin(), prefixes.end(), prefix) ==
+        prefixes.end()) {
+      prefixes.push_back(std::move(prefix));
+    }
+  }
+
+  void set(std::vector<std::string> prefixes) {
+    if (prefixes.size() <= kMaxPrefixes) { result_ = std::move(prefixes); }
+  }
+
+  // A rule on a cycle has no prefixes, so every result is complete and
+  // cached.
+  PrefixCache &cache_;
+  std::unordered_set<const Definition *> refs_;
+};
+
+struct SetupFirstSets : public TraversalVisitor {
+  using TraversalVisitor::visit;
+
+  void visit(Sequence &ope) override;
+  void setup_keyword_guarded_identifier(Sequence &ope);
+  void setup_literal_dictionary(PrioritizedChoice &ope);
+  void setup_prefix_dispatch(PrioritizedChoice &ope);
+  void setup_shared_prefixes(PrioritizedChoice &ope);
+  void setup_whitespace_scanner(Whitespace &ope);
+
+  // The step `!Stop .` of a scan-until loop, where Stop is a literal, a
+  // choice of literals or an ASCII class. `resolve` looks through
+  // operators that do not change the match; the stop literals are added
+  // to `literals`, and the stop operator goes to `stop_ope`.
+  template <typename Resolve>
+  static std::shared_ptr<ScanUntil>
+  scan_until(const std::shared_ptr<Ope> &step, Resolve resolve,
+             std::vector<const LiteralString *> &literals,
+             std::shared_ptr<Ope> *stop_ope = nullptr);
+
+  void visit(PrioritizedChoice &ope) override {
+    ope.first_sets_.clear();
+    ope.first_sets_.reserve(ope.opes_.size());
+    for (const auto &op : ope.opes_) {
+      ComputeFirstSet cfs(first_set_cache_);
+      op->accept(cfs);
+      ope.first_sets_.push_back(cfs.result_);
+    }
+    ope.setup_dispatch();
+    setup_literal_dictionary(ope);
+    setup_prefix_dispatch(ope);
+    for (const auto &op : ope.opes_) {
+      op->accept(*this);
+    }
+    setup_shared_prefixes(ope);
+  }
+  void visit(Repetition &ope) override {
+    ComputeFirstSet cfs(first_set_cache_);
+    ope.ope_->accept(cfs);
+    ope.first_set_ = cfs.result_;
+    ope.guard_ = !ope.first_set_.any_char && !ope.first_set_.can_be_empty &&
+                 !cfs.hit_cycle();
+    ope.ope_->accept(*this);
     // ISpan optimization: detect Repetition + ASCII CharacterClass
     auto cc = dynamic_cast<CharacterClass *>(ope.ope_.get());
-    if (cc && cc->is_ascii_only()) { ope.span_bitset_ = &cc->ascii_bitset(); }
+    if (cc && cc->is_ascii_only()) {
+      ope.span_ = &cc->ascii_span();
+    } else if (cc) {
+      ope.class_ = cc;
+    }
+
+    // `(!Stop .)*` and `(!Stop .)+` as one search
+    ope.until_.reset();
+    ope.until_literals_.clear();
+    if (ope.min_ <= 1 && ope.max_ == std::numeric_limits<size_t>::max()) {
+      ope.until_ = scan_until(
+          ope.ope_, [](const std::shared_ptr<Ope> &op) { return op; },
+          ope.until_literals_);
+    }
+  }
+  void visit(Whitespace &ope) override {
+    ope.ope_->accept(*this);
+    setup_whitespace_scanner(ope);
   }
   void visit(Reference &ope) override;
   void visit(Holder &ope) override;
 
 private:
   ComputeFirstSet::FirstSetCache first_set_cache_;
+  ComputePrefixes::PrefixCache prefix_cache_;
   std::unordered_set<const Definition *> visited_rules_;
+  std::unordered_set<const MacroInstance *> visited_instances_;
 };
 
 /*
@@ -3103,6 +4673,8 @@ static const char *RECOVER_DEFINITION_NAME = "%recover";
 /*
  * Definition
  */
+class Bytecode;
+
 class Definition {
 public:
   struct Result {
@@ -3304,6 +4876,16 @@ public:
   // innermost rule on rule_stack; computed by AssignIDToDefinition. The
   // conservative default keeps the stack maintained until then.
   bool has_macro_ref = true;
+  // Set by mark_inline_candidates for small rules whose references may parse
+  // the body in place of calling the rule.
+  bool is_inline_candidate = false;
+  // For a macro: the bodies instantiated by instantiate_macros, one per
+  // distinct argument tuple.
+  std::vector<std::unique_ptr<MacroInstance>> macro_instances;
+  // Set by fold_left_recursion for a rule that is only directly
+  // left-recursive (`E <- E op T / T`): per alternative of its choice, what
+  // follows the leading `E`, or null for an alternative without one.
+  std::vector<std::shared_ptr<Ope>> lr_tails;
 
   TracerEnter tracer_enter;
   TracerLeave tracer_leave;
@@ -3320,6 +4902,11 @@ public:
 
   bool eoi_check = true;
 
+  // Set by parser::compile(): the lowered grammar (held by the start rule)
+  // and this rule's index into it.
+  std::shared_ptr<const Bytecode> bytecode;
+  size_t bytecode_rule = static_cast<size_t>(-1);
+
   // Per-rule packrat stats (optional, for profiling)
   mutable bool collect_packrat_stats = false;
   mutable std::vector<Context::PackratStats> packrat_stats_;
@@ -3327,6 +4914,7 @@ public:
 private:
   friend class Reference;
   friend class ParserGenerator;
+  friend class Bytecode;
 
   Definition &operator=(const Definition &rhs);
   Definition &operator=(Definition &&rhs);
@@ -3337,21 +4925,30 @@ private:
       holder_->accept(vis);
       if (whitespaceOpe) { whitespaceOpe->accept(vis); }
       if (wordOpe) { wordOpe->accept(vis); }
+      for (size_t i = 0; i < vis.instances.size(); i++) {
+        vis.instances[i]->id = vis.ids.size() + i;
+      }
       definition_ids_.swap(vis.ids);
+      macro_instances_.swap(vis.instances);
       has_cut_ = vis.has_cut;
       has_opaque_ope_ = vis.has_opaque_ope;
+      CollectReachableRules ws_vis;
+      if (whitespaceOpe) { whitespaceOpe->accept(ws_vis); }
+      if (wordOpe) { wordOpe->accept(ws_vis); }
+      whitespace_rules_ = std::move(ws_vis.rules);
+      if (wordOpe) { word_first_ = word_first_set(*wordOpe); }
     });
   }
 
   void initialize_packrat_filter() const;
 
+  static std::optional<std::bitset<256>> word_first_set(const Ope &ope);
+
   Result parse_core(const char *s, size_t n, SemanticValues &vs, std::any &dt,
                     const char *path, Log log,
                     ErrorReporter error_reporter = nullptr) const {
     initialize_definition_ids();
 
-    std::shared_ptr<Ope> ope = holder_;
-
     std::any trace_data;
     if (tracer_start) { tracer_start(trace_data); }
     auto se = scope_exit([&]() {
@@ -3374,6 +4971,7 @@ private:
               enablePackratParsing, tracer_enter, tracer_leave, trace_data,
               verbose_trace, log, error_reporter, packrat_index,
               packrat_cached_count, has_cut_);
+    if (word_first_) { c.word_first = &*word_first_; }
 
     if (collect_packrat_stats) {
       packrat_stats_.resize(definition_ids_.size());
@@ -3383,27 +4981,56 @@ private:
     // Recognizer mode: nothing in this parse observes semantic values, so
     // rule invocations skip the semantic-value machinery entirely. The
     // callback scan runs per parse; actions can be attached between parses.
+    for (const auto &entry : definition_ids_) {
+      auto def = static_cast<Definition *>(entry.first);
+      if (def->enter || def->leave) {
+        c.has_enter_leave = true;
+        c.has_rule_callbacks = true;
+        break;
+      }
+      if (def->action || def->predicate) { c.has_rule_callbacks = true; }
+    }
+    if (c.has_rule_callbacks) {
+      c.whitespace_callbacks = std::any_of(
+          whitespace_rules_.begin(), whitespace_rules_.end(),
+          [](const Definition *def) {
+            return def->action || def->predicate || def->enter || def->leave;
+          });
+    }
     if (!has_opaque_ope_ && !c.has_tracer && !c.needs_rule_stack) {
-      auto recognize_only = true;
-      for (const auto &entry : definition_ids_) {
-        auto def = static_cast<Definition *>(entry.first);
-        if (def->action || def->enter || def->leave || def->predicate) {
-          recognize_only = false;
-          break;
-        }
+      c.recognize_only = !c.has_rule_callbacks;
+    }
+
+    // The whitespace scanner records no error positions and is invisible
+    // to tracers.
+    if (whitespaceOpe && !c.needs_rule_stack) {
+      if (auto ws = dynamic_cast<const Whitespace *>(whitespaceOpe.get())) {
+        c.whitespace_scanner = ws->scanner(c);
       }
-      c.recognize_only = recognize_only;
     }
 
-    size_t i = 0;
+    // The VM keeps neither the rule stack nor error positions, so it only
+    // takes parses that report nothing beyond the match itself.
+    if (bytecode && !c.needs_rule_stack) {
+      return parse_compiled(s, n, vs, c, dt);
+    }
+    return parse_input(s, n, vs, c, dt);
+  }
 
-    if (whitespaceOpe) {
-      auto save_ignore_trace_state = c.ignore_trace_state;
-      c.ignore_trace_state = !c.verbose_trace;
-      auto se =
-          scope_exit([&]() { c.ignore_trace_state = save_ignore_trace_state; });
+  Result parse_compiled(const char *s, size_t n, SemanticValues &vs,
+                        Context &c, std::any &dt) const;
+
+  Result parse_input(const char *s, size_t n, SemanticValues &vs, Context &c,
+                     std::any &dt) const {
+    std::shared_ptr<Ope> ope = holder_;
+
+    size_t i = 0;
 
-      auto len = whitespaceOpe->parse(s, n, vs, c, dt);
+    if (c.whitespace_scanner) {
+      i = c.whitespace_scanner->scan(s, n);
+    } else if (whitespaceOpe) {
+      auto len =
+          c.untraced([&]() { return whitespaceOpe->parse(s, n, vs, c, dt); });
       if (fail(len)) { return Result{false, c.recovered, i, c.error_info}; }
 
       i = len;
@@ -3432,17 +5059,279 @@ private:
   mutable std::once_flag assign_id_to_definition_init_;
   mutable std::once_flag definition_ids_init_;
   mutable std::unordered_map<void *, size_t> definition_ids_;
+  mutable std::vector<MacroInstance *> macro_instances_;
   mutable bool has_cut_ = false;
   mutable bool has_opaque_ope_ = false;
+  // Rules %whitespace and %word reach
+  mutable std::vector<const Definition *> whitespace_rules_;
+  mutable std::optional<std::bitset<256>> word_first_;
   mutable std::once_flag packrat_filter_init_;
   mutable std::vector<int32_t> packrat_index_; // def_id -> cache slot or -1
   mutable size_t packrat_cached_count_ = 0;
 };
 
+/*
+ * Bytecode
+ */
+
+// Instruction set of the bytecode parser::compile() lowers a grammar into.
+// Control flow follows LPeg's parsing machine: Choice pushes a backtrack
+// entry, Commit drops it, and a failure unwinds to the newest entry and
+// resumes at its alternative from its input position.
+enum class OpCode : uint8_t {
+  End,           // leave the dispatch loop (bottom frame of a run)
+  Char,          // one byte equal to `arg`
+  Any,           // one UTF-8 code point
+  Set,           // one byte in sets[arg]
+  Span,          // spans[arg]: min..max bytes of its set
+  Literal,       // literals[arg], then its word check and whitespace
+  Tree,          // opes[arg], parsed by the operator tree
+  TestSet,       // jump to `target` if the next byte is not in sets[arg]
+  Choice,        // push a backtrack entry resuming at `target`
+  Commit,        // pop the backtrack entry, jump to `target`
+  PartialCommit, // move the backtrack entry to the current position, jump
+  BackCommit,    // pop the entry, go back to its position, jump (`&e`)
+  FailTwice,     // pop the entry and fail (`!e`)
+  Fail,
+  Jump,
+  Call,          // rules[arg]
+  Return,
+  TokenBegin,    // enter a token boundary (`< >`, no_whitespace)
+  TokenEnd,      // leave it and skip whitespace
+};
+
+// A rule compiled ahead of time into C++ by bytecode_to_cpp(): the same
+// instructions as the rule's bytecode, run natively. Returns the match
+// length from `s`, or -1.
+using NativeRule = size_t (*)(BytecodeVM &vm, const char *s, const char *e);
+
+// The generated functions of a grammar, indexed like Bytecode::rules, and the
+// fingerprint of the bytecode they were generated from.
+struct NativeRules {
+  uint64_t fingerprint = 0;
+  std::vector<NativeRule> rules;
+};
+
+// A grammar lowered to one flat instruction array. Rules whose body holds
+// something the VM does not model (captures, back references, cut,
+// recovery, User and precedence operators, macros) stay on the operator
+// tree, and so does every rule that reaches one. Left-recursive rules are
+// not lowered either; the VM hands them to the seed-growing interpreter.
+class Bytecode {
+public:
+  struct Instruction {
+    OpCode op;
+    uint32_t arg = 0;
+    uint32_t target = 0;
+  };
+
+  struct Rule {
+    const Definition *def = nullptr; // null for the whitespace body
+    uint32_t entry = 0;              // 0 when not lowered
+    bool opaque = false;             // never run by the VM
+    std::vector<uint32_t> callers;
+    NativeRule native = nullptr; // runs instead of the bytecode when set
+  };
+
+  struct Span {
+    SpanSet set;
+    size_t min;
+    size_t max;
+  };
+
+  // What the VM reads of a literal: a slice of `chars` (lowered when
+  // ignore_case), so matching never goes through the LiteralString.
+  struct Text {
+    uint32_t offset;
+    uint32_t size;
+    bool ignore_case;
+  };
+
+  // What the VM reads of a rule on every Call, packed apart from `rules`.
+  struct Callee {
+    uint32_t entry;
+    uint32_t def_id;
+    NativeRule native;
+  };
+
+  // Rules are numbered in name order, so the same grammar always lowers to
+  // the same code; `natives` are attached when their fingerprint matches.
+  static std::shared_ptr<const Bytecode>
+  compile(Grammar &grammar, const std::string &start,
+          const NativeRules *natives = nullptr);
+
+  // Hash of everything generated code depends on: instructions, sets,
+  // spans, literals, tree operators, and rule entries.
+  uint64_t fingerprint() const;
+
+  void finalize();
+
+  std::vector<Instruction> code;
+  std::vector<std::bitset<256>> sets;
+  std::vector<Span> spans;
+  std::vector<const LiteralString *> literals;
+  std::vector<const Ope *> opes;
+  std::vector<Rule> rules;
+
+  // Filled by finalize() once the rules are lowered: everything a parse
+  // that stays in the VM touches lives in these arrays and the ones above.
+  std::string chars;
+  std::vector<Text> texts;
+  std::vector<Callee> callees;
+
+  // The `%whitespace` body, lowered as a pseudo-rule (no Definition).
+  const Ope *whitespaceOpe = nullptr;
+  size_t whitespace_rule = static_cast<size_t>(-1);
+};
+
+// Per-parse state of the bytecode VM. Which rules it may run is settled at
+// parse start: a rule qualifies when nothing it reaches has an action,
+// enter/leave callback, or predicate, because then no semantic value it
+// produces can be observed and skipping the value machinery is invisible.
+// Every other rule keeps running on the operator tree.
+class BytecodeVM {
+public:
+  BytecodeVM(const Bytecode &bc, Context &c);
+
+  bool runs(const Definition &def) const {
+    auto i = def.bytecode_rule;
+    return i < pure_.size() && bc_.rules[i].def == &def &&
+           bc_.rules[i].entry && pure_[i] && !def.action;
+  }
+
+  size_t run_rule(const Definition &def, const char *s, size_t n,
+                  std::any &dt) {
+    dt_ = &dt;
+    const auto &r = bc_.rules[def.bytecode_rule];
+    return r.native ? r.native(*this, s, s + n) : run(r.entry, s, s + n);
+  }
+
+  // Entry points of generated code (see bytecode_to_cpp()).
+  Context &context() { return c_; }
+
+  template <NativeRule F>
+  size_t call(uint32_t rule, const char *p, const char *e) {
+    if (!c_.enablePackratParsing) { return F(*this, p, e); }
+    return call_memo(rule, F, p, e);
+  }
+
+  size_t after_literal(uint32_t lit, const char *p, const char *e);
+  size_t tree(uint32_t ope, const char *p, const char *e);
+  size_t skip_whitespace(const char *p, const char *e);
+
+private:
+  static constexpr uint32_t kChoice = UINT32_MAX;
+  static constexpr uint32_t kBottom = UINT32_MAX - 1;
+
+  struct Frame {
+    const char *p;    // choice: resume position; rule: start position
+    const char *save; // rule: enclosing active position (guard-only packrat)
+    uint32_t pc;      // choice: alternative; rule: return address
+    uint32_t rule;    // rule index, kChoice, or kBottom
+    size_t tb;        // choice: token boundary depth to restore
+  };
+
+  size_t run(uint32_t pc, const char *s, const char *e);
+  size_t call_memo(uint32_t rule, NativeRule fn, const char *p,
+                   const char *e);
+  void leave_rule(const Frame &f, size_t len);
+  void reset_scratch();
+
+  const Bytecode &bc_;
+  Context &c_;
+  std::vector<bool> pure_;
+  uint32_t whitespace_entry_ = 0;
+  NativeRule whitespace_native_ = nullptr;
+  std::vector<Frame> stack_;
+  SemanticValues scratch_;
+  std::any *dt_ = nullptr;
+};
+
 /*
  * Implementations
  */
 
+// Whether %word matches at `s`. The word rule runs in a context of its
+// own, which has no tracer, so a class-shaped %word is a set lookup on
+// ASCII; past that the rule runs (an overlong form can still spell ASCII).
+inline bool match_word(const char *s, size_t n, Context &c) {
+  if (c.word_first) {
+    if (!n) { return false; }
+    auto b = static_cast<uint8_t>(s[0]);
+    if (b < 0x80) { return c.word_first->test(b); }
+  }
+  if (!c.word_context) {
+    c.word_context = std::make_unique<Context>(
+        nullptr, c.s, c.l, 0, nullptr, nullptr, false, nullptr, nullptr,
+        nullptr, false, nullptr);
+  }
+  SemanticValues dummy_vs;
+  std::any dummy_dt;
+  return success(c.wordOpe->parse(s, n, dummy_vs, *c.word_context, dummy_dt));
+}
+
+// Whether %word matches at the start of `lit`, decided once per literal.
+inline bool is_word_literal(Context &c, const std::string &lit,
+                            std::once_flag &init_is_word, bool &is_word) {
+  std::call_once(init_is_word,
+                 [&]() { is_word = match_word(lit.data(), lit.size(), c); });
+  return is_word;
+}
+
+// Word check after a matched literal: a literal that is itself a `%word`
+// must not run on into more word characters. Returns false if it does.
+inline bool match_word_boundary(const char *s, size_t n, Context &c,
+                                const std::string &lit,
+                                std::once_flag &init_is_word, bool &is_word) {
+  if (!c.wordOpe) { return true; }
+  return !is_word_literal(c, lit, init_is_word, is_word) ||
+         !match_word(s, n, c);
+}
+
+// The scan stands in for the loop when nothing can tell them apart: no
+// error positions or traces are kept, %word makes no stop literal a word,
+// and the whitespace a stop literal skips after itself cannot fail (the
+// predicate discards its length).
+inline bool Repetition::use_until(Context &c) const {
+  if (c.reports_errors || c.has_tracer) { return false; }
+  if (until_literals_.empty()) { return true; }
+  if (c.whitespaceOpe && !c.whitespace_scanner && !c.in_whitespace &&
+      !c.in_token_boundary_count) {
+    return false;
+  }
+  if (c.wordOpe) {
+    for (auto lit : until_literals_) {
+      if (is_word_literal(c, lit->lit_, lit->init_is_word_, lit->is_word_)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+inline size_t Repetition::span_class(const char *s, size_t n) const {
+  size_t count;
+  auto i = class_->span(s, n, max_, count);
+  return count < min_ ? static_cast<size_t>(-1) : i;
+}
+
+inline const WhitespaceScanner *Whitespace::scanner(Context &c) const {
+  if (!scanner_) { return nullptr; }
+  for (auto def : scanner_rules_) {
+    if (def->action || def->enter || def->leave || def->predicate) {
+      return nullptr;
+    }
+  }
+  if (c.wordOpe) {
+    for (auto lit : scanner_literals_) {
+      if (is_word_literal(c, lit->lit_, lit->init_is_word_, lit->is_word_)) {
+        return nullptr;
+      }
+    }
+  }
+  return scanner_.get();
+}
+
 inline size_t parse_literal(const char *s, size_t n, SemanticValues &vs,
                             Context &c, std::any &dt, const std::string &lit,
                             std::once_flag &init_is_word, bool &is_word,
@@ -3460,38 +5349,9 @@ inline size_t parse_literal(const char *s, size_t n, SemanticValues &vs,
     }
   }
 
-  // Word check
-  if (c.wordOpe) {
-    auto save_ignore_trace_state = c.ignore_trace_state;
-    c.ignore_trace_state = !c.verbose_trace;
-    auto se =
-        scope_exit([&]() { c.ignore_trace_state = save_ignore_trace_state; });
-
-    std::call_once(init_is_word, [&]() {
-      SemanticValues dummy_vs;
-      Context dummy_c(nullptr, c.s, c.l, 0, nullptr, nullptr, false, nullptr,
-                      nullptr, nullptr, false, nullptr);
-      std::any dummy_dt;
-
-      auto len =
-          c.wordOpe->parse(lit.data(), lit.size(), dummy_vs, dummy_c, dummy_dt);
-      is_word = success(len);
-    });
-
-    if (is_word) {
-      SemanticValues dummy_vs;
-      Context dummy_c(nullptr, c.s, c.l, 0, nullptr, nullptr, false, nullptr,
-                      nullptr, nullptr, false, nullptr);
-      std::any dummy_dt;
-
-      NotPredicate ope(c.wordOpe);
-      auto len = ope.parse(s + i, n - i, dummy_vs, dummy_c, dummy_dt);
-      if (fail(len)) {
-        c.set_error_pos(s, lit.data());
-        return len;
-      }
-      i += len;
-    }
+  if (!match_word_boundary(s + i, n - i, c, lit, init_is_word, is_word)) {
+    c.set_error_pos(s, lit.data());
+    return static_cast<size_t>(-1);
   }
 
   // Skip whitespace
@@ -3600,43 +5460,40 @@ inline void ErrorInfo::output_log(const Log &log, const ErrorReporter &reporter,
 inline size_t Context::skip_whitespace(const char *a_s, size_t n,
                                        SemanticValues &vs, std::any &dt) {
   if (in_token_boundary_count || !whitespaceOpe) { return 0; }
-  auto save = ignore_trace_state;
-  ignore_trace_state = !verbose_trace;
-  auto se = scope_exit([&]() { ignore_trace_state = save; });
-  return whitespaceOpe->parse(a_s, n, vs, *this, dt);
-}
-
-inline void Context::set_error_pos(const char *a_s, const char *literal) {
-  if (log || error_reporter) {
-    if (error_info.error_pos <= a_s) {
-      if (error_info.error_pos < a_s || !error_info.keep_previous_token) {
-        error_info.error_pos = a_s;
-        error_info.expected_tokens.clear();
-      }
-
-      const char *error_literal = nullptr;
-      const Definition *error_rule = nullptr;
-
-      if (literal) {
-        error_literal = literal;
-      } else if (!rule_stack.empty()) {
-        auto rule = rule_stack.back();
-        auto ope = rule->get_core_operator();
-        if (auto token = FindLiteralToken::token(*ope);
-            token && token[0] != '\0') {
-          error_literal = token;
-        }
-      }
+  if (whitespace_scanner) { return whitespace_scanner->scan(a_s, n); }
+  return untraced(
+      [&]() { return whitespaceOpe->parse(a_s, n, vs, *this, dt); });
+}
 
-      for (auto r : rule_stack) {
-        error_rule = r;
-        if (r->is_token()) { break; }
-      }
+inline void Context::record_error_pos(const char *a_s, const char *literal) {
+  if (error_info.error_pos <= a_s) {
+    if (error_info.error_pos < a_s || !error_info.keep_previous_token) {
+      error_info.error_pos = a_s;
+      error_info.expected_tokens.clear();
+    }
 
-      if (error_literal || error_rule) {
-        error_info.add(error_literal, error_rule);
+    const char *error_literal = nullptr;
+    const Definition *error_rule = nullptr;
+
+    if (literal) {
+      error_literal = literal;
+    } else if (!rule_stack.empty()) {
+      auto rule = rule_stack.back();
+      auto ope = rule->get_core_operator();
+      if (auto token = FindLiteralToken::token(*ope);
+          token && token[0] != '\0') {
+        error_literal = token;
       }
     }
+
+    for (auto r : rule_stack) {
+      error_rule = r;
+      if (r->is_token()) { break; }
+    }
+
+    if (error_literal || error_rule) {
+      error_info.add(error_literal, error_rule);
+    }
   }
 }
 
@@ -3687,26 +5544,9 @@ inline size_t Dictionary::parse_core(const char *s, size_t n,
   vs.choice_ = id;
 
   // Word check
-  if (c.wordOpe) {
-    auto save_ignore_trace_state = c.ignore_trace_state;
-    c.ignore_trace_state = !c.verbose_trace;
-    auto se =
-        scope_exit([&]() { c.ignore_trace_state = save_ignore_trace_state; });
-
-    {
-      SemanticValues dummy_vs;
-      Context dummy_c(nullptr, c.s, c.l, 0, nullptr, nullptr, false, nullptr,
-                      nullptr, nullptr, false, nullptr);
-      std::any dummy_dt;
-
-      NotPredicate ope(c.wordOpe);
-      auto len = ope.parse(s + i, n - i, dummy_vs, dummy_c, dummy_dt);
-      if (fail(len)) {
-        c.set_error_pos(s);
-        return len;
-      }
-      i += len;
-    }
+  if (c.wordOpe && match_word(s + i, n - i, c)) {
+    c.set_error_pos(s);
+    return static_cast<size_t>(-1);
   }
 
   // Skip whitespace
@@ -3717,6 +5557,97 @@ inline size_t Dictionary::parse_core(const char *s, size_t n,
   return i;
 }
 
+inline std::optional<size_t>
+PrioritizedChoice::parse_dictionary(const char *s, size_t n,
+                                    SemanticValues &vs, Context &c,
+                                    std::any &dt) const {
+  // The dictionary checks %word after any literal, a literal only when it is
+  // a word itself; and where a longer literal fails the check, the choice
+  // would still try the shorter ones. So with %word, only prefix-free sets
+  // of words qualify.
+  if (c.wordOpe) {
+    if (!dictionary_prefix_free_) { return std::nullopt; }
+    std::call_once(init_dictionary_words_, [&]() {
+      dictionary_words_ = std::all_of(
+          opes_.begin(), opes_.end(), [&](const std::shared_ptr<Ope> &op) {
+            const auto &lit = static_cast<const LiteralString &>(*op);
+            return is_word_literal(c, lit.lit_, lit.init_is_word_,
+                                   lit.is_word_);
+          });
+    });
+    if (!dictionary_words_) { return std::nullopt; }
+  }
+
+  auto snap = c.snapshot(vs);
+  auto len = dictionary_->parse_core(s, n, vs, c, dt);
+  if (fail(len)) { c.rollback(vs, snap); }
+  return len;
+}
+
+inline bool PrioritizedChoice::factors_prefixes(const Context &c) const {
+  if (shared_prefix_.empty() || c.reports_errors || c.has_tracer ||
+      c.has_cut) {
+    return false;
+  }
+  if (!c.has_rule_callbacks) { return true; }
+  if (many_prefix_rules_ || c.whitespace_callbacks) { return false; }
+  return std::none_of(prefix_rules_.begin(), prefix_rules_.end(),
+                      [](const Definition *def) {
+                        return def->action || def->predicate || def->enter ||
+                               def->leave;
+                      });
+}
+
+inline size_t PrioritizedChoice::parse_factored(
+    const std::vector<uint32_t> &ids, const char *s, size_t n,
+    SemanticValues &vs, Context &c, std::any &dt) const {
+  // The state after each leading element of the last alternative tried
+  std::array<Context::Snapshot, kMaxSharedPrefix + 1> snaps;
+  std::array<size_t, kMaxSharedPrefix + 1> ends;
+  snaps[0] = c.snapshot(vs);
+  ends[0] = 0;
+
+  auto last = static_cast<size_t>(-1);
+  size_t matched = 0; // leading elements of `last` that matched
+  for (auto id : ids) {
+    size_t k = 0;
+    if (last != static_cast<size_t>(-1)) {
+      k = kMaxSharedPrefix;
+      for (auto i = last + 1; i <= id; i++) {
+        k = std::min<size_t>(k, shared_prefix_[i]);
+      }
+      // `last` failed inside an element this alternative starts with too
+      if (k > matched) { continue; }
+    }
+
+    c.rollback(vs, snaps[k]);
+    c.error_info.keep_previous_token = id > 0;
+
+    const auto &elements = elements_[id];
+    auto i = ends[k];
+    auto e = k;
+    for (; e < elements.size(); e++) {
+      auto len = elements[e]->parse(s + i, n - i, vs, c, dt);
+      if (fail(len)) { break; }
+      i += len;
+      if (e < max_shared_prefix_) {
+        ends[e + 1] = i;
+        snaps[e + 1] = c.snapshot(vs);
+      }
+    }
+    if (e == elements.size()) {
+      vs.choice_count_ = opes_.size();
+      vs.choice_ = id;
+      return i;
+    }
+    last = id;
+    matched = std::min(e, max_shared_prefix_);
+  }
+
+  c.rollback(vs, snaps[0]);
+  return static_cast<size_t>(-1);
+}
+
 inline size_t LiteralString::parse_core(const char *s, size_t n,
                                         SemanticValues &vs, Context &c,
                                         std::any &dt) const {
@@ -3727,26 +5658,25 @@ inline size_t LiteralString::parse_core(const char *s, size_t n,
 inline size_t TokenBoundary::parse_core(const char *s, size_t n,
                                         SemanticValues &vs, Context &c,
                                         std::any &dt) const {
-  auto save_ignore_trace_state = c.ignore_trace_state;
-  c.ignore_trace_state = !c.verbose_trace;
-  auto se =
-      scope_exit([&]() { c.ignore_trace_state = save_ignore_trace_state; });
-
-  size_t len;
-  {
-    c.in_token_boundary_count++;
-    auto se = scope_exit([&]() { c.in_token_boundary_count--; });
-    len = ope_->parse(s, n, vs, c, dt);
-  }
+  return c.untraced([&]() {
+    size_t len;
+    {
+      c.in_token_boundary_count++;
+      auto se = scope_exit([&]() { c.in_token_boundary_count--; });
+      len = ope_->parse(s, n, vs, c, dt);
+    }
 
-  if (success(len)) {
-    if (!c.recognize_only) { vs.tokens.emplace_back(std::string_view(s, len)); }
+    if (success(len)) {
+      if (!c.recognize_only) {
+        vs.tokens.emplace_back(std::string_view(s, len));
+      }
 
-    auto wl = c.skip_whitespace(s + len, n - len, vs, dt);
-    if (fail(wl)) { return wl; }
-    len += wl;
-  }
-  return len;
+      auto wl = c.skip_whitespace(s + len, n - len, vs, dt);
+      if (fail(wl)) { return wl; }
+      len += wl;
+    }
+    return len;
+  });
 }
 
 // Resolve `%{name}` placeholders in a custom error message against the
@@ -3764,23 +5694,18 @@ inline std::string resolve_capture_placeholders(const std::string &msg,
     if (end == std::string::npos) { break; }
     r.append(msg, i, pos - i);
     auto name = std::string_view(msg).substr(pos + 2, end - (pos + 2));
-    for (auto it = c.capture_entries.rbegin(); it != c.capture_entries.rend();
-         ++it) {
-      if (it->first == name) {
-        // The captured span can include whitespace skipped after a token
-        // boundary; trim it for display.
-        auto v = std::string_view(it->second);
-        while (!v.empty() &&
-               std::isspace(static_cast<unsigned char>(v.back()))) {
-          v.remove_suffix(1);
-        }
-        while (!v.empty() &&
-               std::isspace(static_cast<unsigned char>(v.front()))) {
-          v.remove_prefix(1);
-        }
-        r += v;
-        break;
+    if (auto cap = c.find_capture(name)) {
+      // The captured span can include whitespace skipped after a token
+      // boundary; trim it for display.
+      auto v = cap->text;
+      while (!v.empty() && std::isspace(static_cast<unsigned char>(v.back()))) {
+        v.remove_suffix(1);
       }
+      while (!v.empty() &&
+             std::isspace(static_cast<unsigned char>(v.front()))) {
+        v.remove_prefix(1);
+      }
+      r += v;
     }
     i = end + 1;
     pos = msg.find("%{", i);
@@ -3828,6 +5753,14 @@ inline size_t Holder::parse_core(const char *s, size_t n, SemanticValues &vs,
     throw std::logic_error("Uninitialized definition ope was used...");
   }
 
+  // First-set guard: a rule that cannot start at the next byte fails before
+  // any scope, memo or re-entry bookkeeping. Nothing else would observe the
+  // failure without error positions, traces, a cut or enter/leave handlers.
+  if (guard_ && !c.reports_errors && !c.has_tracer && !c.has_cut &&
+      !c.has_enter_leave && !first_set_.admits(s, n)) {
+    return static_cast<size_t>(-1);
+  }
+
   // Macro reference. A left-recursive macro cannot take this path: it needs
   // the seed-growing below, which in turn needs its own semantic value scope
   // to memoise. Such a macro forms a scope like a plain rule does.
@@ -3844,30 +5777,34 @@ inline size_t Holder::parse_core(const char *s, size_t n, SemanticValues &vs,
   // Recognizer fast path: no semantic-value scope, no reduce, no value
   // emplace; the rule body parses straight into the caller's scope.
   // Left-recursive rules keep the full seed-growing machinery below.
-  if (c.recognize_only && !outer_->is_left_recursive) {
+  // A rule the bytecode VM runs takes this path too: nothing it reaches
+  // observes semantic values, so its own value is always empty.
+  const auto use_vm = c.vm && c.vm->runs(*outer_);
+  if ((c.recognize_only || use_vm) && !outer_->is_left_recursive) {
     auto do_recognize = [&](std::any &) {
-      len = parse_ope_body(s, n, vs, c, dt);
+      len = use_vm ? c.vm->run_rule(*outer_, s, n, dt)
+                   : parse_ope_body(s, n, vs, c, dt);
     };
 
     if (c.enablePackratParsing) {
       c.packrat(s, outer_->id, len, val, do_recognize);
     } else {
       // Same re-entry guard as the general no-packrat path below.
-      auto guard_key = Context::LRKey({outer_, c.top_macro_inst()}, s);
-      if (c.lr_memo.count(guard_key)) {
-        len = static_cast<size_t>(-1);
-      } else {
-        c.lr_memo[guard_key] = {static_cast<size_t>(-1), {}};
-        do_recognize(val);
-        c.lr_memo.erase(guard_key);
-      }
+      c.guard_reentry(s, outer_, outer_->id, len,
+                      [&]() { do_recognize(val); });
+    }
+    if (success(len) && !c.recognize_only && !outer_->ignoreSemanticValue) {
+      vs.emplace_back();
+      vs.tags.emplace_back(str2tag(outer_->name));
     }
     return len;
   }
 
   // Shared parse body: invokes enter/leave callbacks, parses the rule's
   // operator, handles actions/predicates/errors, and calls reduce.
-  // Writes into parse_len / parse_val (parse_val only on success).
+  // Writes into parse_len / parse_val (parse_val only on success), and the
+  // alternative that matched into parse_choice.
+  size_t parse_choice = 0;
   auto do_parse = [&](size_t &parse_len, std::any &parse_val) {
     if (outer_->enter) { outer_->enter(c, s, n, dt); }
     auto &chvs = c.push_semantic_values_scope();
@@ -3890,12 +5827,14 @@ inline size_t Holder::parse_core(const char *s, size_t n, SemanticValues &vs,
         chvs.choice_count_ = 0;
         chvs.choice_ = 0;
       }
+      parse_choice = chvs.choice_;
+      if (outer_ == c.binop_rule) { c.binop_token = chvs.token(); }
 
       if (outer_->predicate) {
         std::string msg;
         std::any predicate_data;
         if (!outer_->predicate(chvs, dt, msg, predicate_data)) {
-          if ((c.log || c.error_reporter) && !msg.empty() &&
+          if (c.reports_errors && !msg.empty() &&
               c.error_info.message_pos < s) {
             c.error_info.message_pos = s;
             c.error_info.message = msg;
@@ -3910,7 +5849,7 @@ inline size_t Holder::parse_core(const char *s, size_t n, SemanticValues &vs,
         parse_val = reduce(chvs, dt, predicate_data);
       }
     } else {
-      if ((c.log || c.error_reporter) && !outer_->error_message.empty() &&
+      if (c.reports_errors && !outer_->error_message.empty() &&
           c.error_info.message_pos < s) {
         c.error_info.message_pos = s;
         c.error_info.message =
@@ -3920,31 +5859,110 @@ inline size_t Holder::parse_core(const char *s, size_t n, SemanticValues &vs,
     }
   };
 
-  if (outer_->is_left_recursive) {
-    // A macro grows one seed per instantiation: Sum(D) and Sum(L) are
-    // different rules as far as the memo is concerned.
-    auto lr_rule = Context::LRRule(outer_, c.top_macro_inst());
-    auto lr_key = Context::LRKey(lr_rule, s);
+  // Direct left recursion folded into a loop (see fold_left_recursion). The
+  // seed is the body with its leading self-references failing; each step
+  // then applies the first tail that matches to the value so far, as seed
+  // growing would, without re-running the body or copying the value into
+  // the LR memo. Tracing, a cut and the rule's own callbacks would see the
+  // difference, so those keep seed growing.
+  auto do_fold = [&](size_t &fold_len, std::any &fold_val) {
+    do_parse(fold_len, fold_val);
+    if (fail(fold_len)) { return; }
+
+    // Alternatives after the seed's are never reached: it matches first.
+    const auto &tails = outer_->lr_tails;
+    const auto tried = parse_choice;
+    const auto keep_value = !c.recognize_only && !outer_->ignoreSemanticValue;
+    const auto push_rule = c.needs_rule_stack || outer_->has_macro_ref;
+    if (push_rule) { c.rule_stack.push_back(outer_); }
 
-    // Check LR memo first
-    auto it = c.lr_memo.find(lr_key);
-    if (it != c.lr_memo.end()) {
-      if (success(it->second.len)) {
-        len = it->second.len;
-        val = it->second.val;
+    while (true) {
+      auto &chvs = c.push_semantic_values_scope();
+      auto se = scope_exit([&]() { c.pop_semantic_values_scope(); });
+      if (keep_value) {
+        chvs.emplace_back(std::move(fold_val));
+        chvs.tags.emplace_back(str2tag(outer_->name));
+      }
+
+      auto tail_len = static_cast<size_t>(-1);
+      size_t id = 0;
+      for (; id < tried; id++) {
+        if (!tails[id]) { continue; }
+        auto snap = c.snapshot(chvs);
+        c.error_info.keep_previous_token = id > 0;
+        tail_len = tails[id]->parse(s + fold_len, n - fold_len, chvs, c, dt);
+        if (success(tail_len)) { break; }
+        c.rollback(chvs, snap);
+      }
+      c.error_info.keep_previous_token = false;
+
+      if (fail(tail_len) || tail_len == 0) {
+        if (keep_value) { fold_val = std::move(chvs[0]); }
+        break;
+      }
+
+      fold_len += tail_len;
+      chvs.sv_ = std::string_view(s, fold_len);
+      chvs.name_ = &outer_->name;
+      chvs.choice_count_ = tails.size();
+      chvs.choice_ = id;
+      if (!c.recovered) {
+        std::any predicate_data;
+        fold_val = reduce(chvs, dt, predicate_data);
       } else {
-        len = static_cast<size_t>(-1);
+        fold_val.reset();
       }
-      // Record that this rule's lr_memo was accessed.
-      // Any LR rule currently seeding will know we're in its cycle.
-      c.lr_refs_hit.insert(lr_rule);
-    } else {
-      // Seed with FAIL
-      c.lr_memo[lr_key] = {static_cast<size_t>(-1), {}};
+    }
 
-      // Mark as active seed (protects our lr_memo from inner growers)
-      c.lr_active_seeds.insert(lr_key);
-      auto seed_guard = scope_exit([&]() { c.lr_active_seeds.erase(lr_key); });
+    if (push_rule) { c.rule_stack.pop_back(); }
+  };
+
+  if (!outer_->lr_tails.empty() && !c.has_tracer && !c.has_cut &&
+      !outer_->enter && !outer_->leave && !outer_->predicate) {
+    if (c.enablePackratParsing) {
+      // The pre-registered failure is the seed's self-reference
+      c.packrat(s, outer_->id, len, val,
+                [&](std::any &a_val) { do_fold(len, a_val); });
+    } else {
+      // The LR memo answers the seed's self-reference with a failure, and
+      // later queries at this position with the result.
+      auto lr_rule = Context::LRRule(outer_, 0);
+      auto found = c.find_lr(s, lr_rule);
+      if (found >= 0) {
+        const auto &memo = c.lr_entries[static_cast<size_t>(found)].memo;
+        len = memo.len;
+        if (success(len)) { val = memo.val; }
+      } else {
+        auto entry = c.insert_lr(s, lr_rule, {});
+        do_fold(len, val);
+        c.lr_entries[entry].memo = {len, val};
+      }
+    }
+  } else if (outer_->is_left_recursive) {
+    // A macro grows one seed per instantiation: Sum(D) and Sum(L) are
+    // different rules as far as the memo is concerned.
+    auto lr_rule = Context::LRRule(outer_, c.top_macro_inst());
+
+    // Check LR memo first
+    auto found = c.find_lr(s, lr_rule);
+    if (found >= 0) {
+      const auto &memo = c.lr_entries[static_cast<size_t>(found)].memo;
+      if (success(memo.len)) {
+        len = memo.len;
+        val = memo.val;
+      } else {
+        len = static_cast<size_t>(-1);
+      }
+      // Record that this rule's LR memo was accessed.
+      // Any LR rule currently seeding will know we're in its cycle.
+      c.note_lr_hit(lr_rule);
+    } else {
+      // Seed with FAIL, marked as active seed (protects our LR memo from
+      // inner growers)
+      auto entry = c.insert_lr(s, lr_rule, {});
+      c.lr_entries[entry].seeding = true;
+      auto seed_guard =
+          scope_exit([&]() { c.lr_entries[entry].seeding = false; });
 
       // Track which LR rules are referenced during our parse
       // to identify cycle members
@@ -3956,25 +5974,31 @@ inline size_t Holder::parse_core(const char *s, size_t n, SemanticValues &vs,
       std::any initial_val;
       do_parse(initial_len, initial_val);
 
-      // Rules whose lr_memo was hit during our parse are in our cycle.
+      // Rules whose LR memo was hit during our parse are in our cycle.
       // If we detected cycle members, we ourselves are also part of
       // the cycle, so add self — this lets parent seeders see us as
       // a transitive cycle member.
-      auto cycle_rules = c.lr_refs_hit;
-      if (!cycle_rules.empty()) { cycle_rules.insert(lr_rule); }
+      auto cycle_rules = std::move(c.lr_refs_hit);
+      if (!cycle_rules.empty() &&
+          std::find(cycle_rules.begin(), cycle_rules.end(), lr_rule) ==
+              cycle_rules.end()) {
+        cycle_rules.push_back(lr_rule);
+      }
 
       // Restore parent's refs and propagate cycle info upward
       c.lr_refs_hit = std::move(saved_refs);
-      c.lr_refs_hit.insert(cycle_rules.begin(), cycle_rules.end());
+      for (const auto &rule : cycle_rules) {
+        c.note_lr_hit(rule);
+      }
 
       if (!success(initial_len)) {
-        // Keep FAIL in lr_memo so we don't re-seed
+        // Keep FAIL in LR memo so we don't re-seed
         len = static_cast<size_t>(-1);
       } else {
         // Got initial seed, now grow
         len = initial_len;
         val = std::move(initial_val);
-        c.lr_memo[lr_key] = {len, val};
+        c.lr_entries[entry].memo = {len, val};
 
         while (true) {
           // Clear this rule's packrat cache. A macro is never written there
@@ -3982,19 +6006,14 @@ inline size_t Holder::parse_core(const char *s, size_t n, SemanticValues &vs,
           // instantiations apart), so there is nothing to clear for one.
           if (!outer_->is_macro) { c.clear_packrat_cache(s, outer_->id); }
 
-          // Clear lr_memo for cycle-dependent rules at this position,
+          // Clear LR memo for cycle-dependent rules at this position,
           // but NOT for rules currently in their own seeding phase
-          // (lr_active_seeds) — those are outer growers we must not
-          // interfere with.
-          for (auto memo_it = c.lr_memo.begin(); memo_it != c.lr_memo.end();) {
-            if (memo_it->first.second == s && memo_it->first.first != lr_rule &&
-                cycle_rules.count(memo_it->first.first) &&
-                !c.lr_active_seeds.count(memo_it->first)) {
-              memo_it = c.lr_memo.erase(memo_it);
-            } else {
-              ++memo_it;
-            }
-          }
+          // — those are outer growers we must not interfere with.
+          c.erase_lr_if(s, [&](const Context::LREntry &e) {
+            return e.rule != lr_rule && !e.seeding &&
+                   std::find(cycle_rules.begin(), cycle_rules.end(),
+                             e.rule) != cycle_rules.end();
+          });
 
           size_t new_len;
           std::any new_val;
@@ -4006,33 +6025,29 @@ inline size_t Holder::parse_core(const char *s, size_t n, SemanticValues &vs,
 
           len = new_len;
           val = std::move(new_val);
-          c.lr_memo[lr_key] = {len, val};
+          c.lr_entries[entry].memo = {len, val};
         }
       }
 
-      // Write final result to packrat cache (lr_memo entry is kept as
+      // Write final result to packrat cache (LR memo entry is kept as
       // the primary lookup for LR rules at this position)
       if (success(len) && !outer_->is_macro) {
         c.write_packrat_cache(s, outer_->id, len, val);
       }
     }
   } else {
-    if (c.enablePackratParsing) {
+    // An operator a PrecedenceClimbing asks for is parsed afresh: a cached
+    // result would not report its token.
+    if (c.enablePackratParsing && outer_ != c.binop_rule) {
       // Packrat cache acts as re-entry guard (pre-registered as
       // failure before fn is called).
       c.packrat(s, outer_->id, len, val,
                 [&](std::any &a_val) { do_parse(len, a_val); });
     } else {
-      // Without packrat, use lr_memo as re-entry guard to prevent
-      // stack overflow from undetected left recursion.
-      auto guard_key = Context::LRKey({outer_, c.top_macro_inst()}, s);
-      if (c.lr_memo.count(guard_key)) {
-        len = static_cast<size_t>(-1);
-      } else {
-        c.lr_memo[guard_key] = {static_cast<size_t>(-1), {}};
-        do_parse(len, val);
-        c.lr_memo.erase(guard_key);
-      }
+      // Without packrat, a re-entry guard prevents stack overflow from
+      // undetected left recursion.
+      c.guard_reentry(s, outer_, outer_->id, len,
+                      [&]() { do_parse(len, val); });
     }
   }
 
@@ -4076,8 +6091,9 @@ macro_inst_key(const Definition *def,
   key.push_back(def);
   for (const auto &arg : args) {
     auto ref = dynamic_cast<Reference *>(arg.get());
-    key.push_back(ref && ref->rule_ ? static_cast<const void *>(ref->rule_)
-                                    : static_cast<const void *>(arg.get()));
+    key.push_back(ref && ref->rule_ && !ref->is_macro_
+                      ? static_cast<const void *>(ref->rule_)
+                      : static_cast<const void *>(arg.get()));
   }
   return key;
 }
@@ -4104,15 +6120,28 @@ inline size_t Reference::parse_dispatch(const char *s, size_t n,
   if (rule_) {
     // Reference rule
     if (rule_->is_macro) {
-      // Macro
-      FindReference vis(c.top_args(), c.rule_stack.back()->params);
+      // Macro instantiated at load time (see instantiate_macros). The
+      // macro's Holder is bypassed, so it is only traced on the dynamic
+      // path below.
+      if (inst_ && !c.has_tracer) {
+        if (!c.needs_rule_stack) { return parse_instance(s, n, vs, c, dt); }
+        c.rule_stack.push_back(rule_);
+        auto len = parse_instance(s, n, vs, c, dt);
+        c.rule_stack.pop_back();
+        return len;
+      }
 
       // Collect arguments (into the retained buffer of the frame the push
       // below will occupy, so no allocation happens on a warm path)
       auto args = c.take_args_buffer();
-      for (const auto &arg : args_) {
-        arg->accept(vis);
-        args.emplace_back(std::move(vis.found_ope));
+      if (args_closed_) {
+        args.assign(args_.begin(), args_.end());
+      } else {
+        FindReference vis(c.top_args(), c.rule_stack.back()->params);
+        for (const auto &arg : args_) {
+          arg->accept(vis);
+          args.emplace_back(std::move(vis.found_ope));
+        }
       }
 
       auto inst = rule_->is_left_recursive
@@ -4121,6 +6150,10 @@ inline size_t Reference::parse_dispatch(const char *s, size_t n,
       c.push_args(std::move(args), inst);
       auto se = scope_exit([&]() { c.pop_args(); });
       return rule_->holder_->parse(s, n, vs, c, dt);
+    } else if (rule_->is_inline_candidate && c.recognize_only && !c.vm) {
+      // Inlined rule: without semantic values, the call would only add
+      // bookkeeping around its body (see mark_inline_candidates).
+      return rule_->holder_->ope_->parse(s, n, vs, c, dt);
     } else {
       // Definition. The empty argument scope only exists to shadow the
       // caller's frame for readers inside the callee: a macro invocation in
@@ -4143,6 +6176,132 @@ inline size_t Reference::parse_dispatch(const char *s, size_t n,
   }
 }
 
+// Parses a macro instance into the caller's scope. An instance with a packrat
+// slot (see initialize_packrat_filter) is memoized under its own id. Unless
+// the parse only recognizes, the memo also keeps the values, tags and tokens
+// the instance added to the scope, and a hit appends them again.
+inline size_t Reference::parse_instance(const char *s, size_t n,
+                                        SemanticValues &vs, Context &c,
+                                        std::any &dt) const {
+  const auto &ope = *inst_->ope;
+  if (!c.memoizes(inst_->id)) { return ope.parse(s, n, vs, c, dt); }
+
+  size_t len;
+  std::any val;
+  if (c.recognize_only) {
+    c.packrat(s, inst_->id, len, val,
+              [&](std::any &) { len = ope.parse(s, n, vs, c, dt); });
+    return len;
+  }
+
+  auto values = vs.size();
+  auto tags = vs.tags.size();
+  auto tokens = vs.tokens.size();
+  auto hit = true;
+  c.packrat(s, inst_->id, len, val, [&](std::any &a_val) {
+    hit = false;
+    len = ope.parse(s, n, vs, c, dt);
+    if (success(len)) {
+      Context::MacroMemo memo;
+      memo.values.assign(vs.begin() + static_cast<ptrdiff_t>(values),
+                         vs.end());
+      if (tags < vs.tags.size()) {
+        memo.tags.assign(vs.tags.begin() + static_cast<ptrdiff_t>(tags),
+                         vs.tags.end());
+      }
+      if (tokens < vs.tokens.size()) {
+        memo.tokens.assign(vs.tokens.begin() + static_cast<ptrdiff_t>(tokens),
+                           vs.tokens.end());
+      }
+      a_val = std::move(memo);
+    }
+  });
+
+  if (hit && success(len)) {
+    if (auto memo = std::any_cast<Context::MacroMemo>(&val)) {
+      vs.insert(vs.end(), memo->values.begin(), memo->values.end());
+      vs.tags.insert(vs.tags.end(), memo->tags.begin(), memo->tags.end());
+      vs.tokens.insert(vs.tokens.end(), memo->tokens.begin(),
+                       memo->tokens.end());
+    }
+  }
+  return len;
+}
+
+inline void CollectRuleShape::visit(WeakHolder &ope) {
+  if (auto p = ope.weak_.lock()) { p->accept(*this); }
+}
+
+inline void CollectRuleShape::visit(Holder &ope) {
+  opes++;
+  rules.insert(ope.outer_);
+}
+
+inline void CollectRuleShape::visit(Reference &ope) {
+  opes++;
+  if (!ope.rule_ || ope.rule_->is_macro) {
+    calls_macro = true;
+  } else {
+    rules.insert(ope.rule_);
+  }
+  for (const auto &arg : ope.args_) {
+    arg->accept(*this);
+  }
+}
+
+// Marks the rules that references may parse in place (is_inline_candidate):
+// rules of at most kMaxInlinedOpes operators that are not recursive and not
+// macros, call no macro, and have no error_message or no_whitespace. These
+// are only candidates: callbacks are attached after loading, so a parse only
+// takes the inlined path when nothing in it observes semantic values
+// (Context::recognize_only). Then Holder adds no scope or value of its own,
+// and a rule that cannot reach itself needs no re-entry guard or memo. An
+// AST parse has actions on every rule, so its shape never changes.
+inline void mark_inline_candidates(Grammar &grammar) {
+  constexpr size_t kMaxInlinedOpes = 8;
+
+  std::unordered_map<const Definition *, CollectRuleShape> shapes;
+  std::unordered_set<const Definition *> referenced;
+  for (auto &[_, rule] : grammar) {
+    rule.is_inline_candidate = false;
+    if (auto ope = rule.get_core_operator()) {
+      auto &shape = shapes[&rule];
+      ope->accept(shape);
+      referenced.insert(shape.rules.begin(), shape.rules.end());
+    }
+  }
+
+  for (auto &[_, rule] : grammar) {
+    auto it = shapes.find(&rule);
+    if (it == shapes.end() || !referenced.count(&rule) ||
+        it->second.opes > kMaxInlinedOpes ||
+        it->second.calls_macro || rule.is_macro || rule.is_left_recursive ||
+        rule.no_whitespace || !rule.error_message.empty()) {
+      continue;
+    }
+
+    // Not recursive: the rule cannot reach itself
+    std::vector<const Definition *> stack(it->second.rules.begin(),
+                                          it->second.rules.end());
+    std::unordered_set<const Definition *> seen;
+    auto recursive = false;
+    while (!stack.empty() && !recursive) {
+      auto def = stack.back();
+      stack.pop_back();
+      if (def == &rule) {
+        recursive = true;
+      } else if (seen.insert(def).second) {
+        auto shape = shapes.find(def);
+        if (shape != shapes.end()) {
+          stack.insert(stack.end(), shape->second.rules.begin(),
+                       shape->second.rules.end());
+        }
+      }
+    }
+    rule.is_inline_candidate = !recursive;
+  }
+}
+
 inline std::shared_ptr<Ope> Reference::get_core_operator() const {
   return rule_->holder_;
 }
@@ -4150,21 +6309,27 @@ inline std::shared_ptr<Ope> Reference::get_core_operator() const {
 inline size_t BackReference::parse_core(const char *s, size_t n,
                                         SemanticValues &vs, Context &c,
                                         std::any &dt) const {
-  for (auto it = c.capture_entries.rbegin(); it != c.capture_entries.rend();
-       ++it) {
-    if (it->first == name_) {
-      const auto &lit = it->second;
-      std::once_flag init_is_word;
-      auto is_word = false;
-      static const std::string empty;
-      return parse_literal(s, n, vs, c, dt, lit, init_is_word, is_word, false,
-                           empty);
-    }
+  auto cap = id_ != static_cast<size_t>(-1) ? c.find_capture(id_)
+                                            : c.find_capture(name_);
+  if (!cap) {
+    c.error_info.message_pos = s;
+    c.error_info.message = "undefined back reference '$" + name_ + "'...";
+    return static_cast<size_t>(-1);
   }
 
-  c.error_info.message_pos = s;
-  c.error_info.message = "undefined back reference '$" + name_ + "'...";
-  return static_cast<size_t>(-1);
+  // Same checks as parse_literal, on the captured text in place
+  auto lit = cap->text;
+  auto len = lit.size();
+  if (n < len || (len && std::memcmp(s, lit.data(), len) != 0) ||
+      (c.wordOpe && match_word(lit.data(), len, c) &&
+       match_word(s + len, n - len, c))) {
+    if (c.reports_errors) { c.record_error_pos(s, c.keep_error_literal(lit)); }
+    return static_cast<size_t>(-1);
+  }
+
+  auto wl = c.skip_whitespace(s + len, n - len, vs, dt);
+  if (fail(wl)) { return wl; }
+  return len + wl;
 }
 
 inline Definition &
@@ -4180,6 +6345,22 @@ PrecedenceClimbing::get_reference_for_binop(Context &c) const {
   return *dynamic_cast<Reference &>(*binop_).rule_;
 }
 
+inline void PrecedenceClimbing::index_operators() {
+  opes_.clear();
+  first_.fill(0);
+  for (const auto &[key, info] : info_) {
+    first_[bucket(key) + 1]++;
+  }
+  for (size_t b = 1; b < first_.size(); b++) {
+    first_[b] += first_[b - 1];
+  }
+  opes_.resize(info_.size());
+  auto next = first_;
+  for (const auto &[key, info] : info_) {
+    opes_[next[bucket(key)]++] = {key, info.first, info.second};
+  }
+}
+
 inline size_t PrecedenceClimbing::parse_expression(const char *s, size_t n,
                                                    SemanticValues &vs,
                                                    Context &c, std::any &dt,
@@ -4187,59 +6368,44 @@ inline size_t PrecedenceClimbing::parse_expression(const char *s, size_t n,
   auto len = atom_->parse(s, n, vs, c, dt);
   if (fail(len)) { return len; }
 
-  std::string tok;
   auto &rule = get_reference_for_binop(c);
-  auto action = std::move(rule.action);
-
-  rule.action = [&](SemanticValues &vs2, std::any &dt2,
-                    const std::any &predicate_data2) {
-    tok = vs2.token();
-    if (action) {
-      return action(vs2, dt2, predicate_data2);
-    } else if (!vs2.empty()) {
-      return vs2[0];
-    }
-    return std::any();
-  };
-  auto action_se = scope_exit([&]() { rule.action = std::move(action); });
 
   auto i = len;
   while (i < n) {
-    std::vector<std::any> save_values(vs.begin(), vs.end());
-    auto save_tokens = vs.tokens;
+    auto snap = c.snapshot(vs);
 
-    auto chvs = c.push_semantic_values_scope();
+    // The operator rule reports its token through the context (see
+    // Holder::parse_core), so the grammar is left as it is.
+    auto save_binop_rule = c.binop_rule;
+    c.binop_rule = &rule;
+    c.binop_token = std::string_view();
+    auto &chvs = c.push_semantic_values_scope();
     auto chlen = binop_->parse(s + i, n - i, chvs, c, dt);
     c.pop_semantic_values_scope();
+    c.binop_rule = save_binop_rule;
 
     if (fail(chlen)) { break; }
 
-    auto it = info_.find(tok);
-    if (it == info_.end()) { break; }
-
-    auto level = std::get<0>(it->second);
-    auto assoc = std::get<1>(it->second);
-
-    if (level < min_prec) { break; }
+    auto ope = find_operator(c.binop_token);
+    if (!ope || ope->level < min_prec) { break; }
 
     vs.emplace_back(std::move(chvs[0]));
     i += chlen;
 
-    auto next_min_prec = level;
-    if (assoc == 'L') { next_min_prec = level + 1; }
+    auto next_min_prec = ope->level;
+    if (ope->assoc == 'L') { next_min_prec = ope->level + 1; }
 
-    chvs = c.push_semantic_values_scope();
-    chlen = parse_expression(s + i, n - i, chvs, c, dt, next_min_prec);
+    auto &rhs = c.push_semantic_values_scope();
+    chlen = parse_expression(s + i, n - i, rhs, c, dt, next_min_prec);
     c.pop_semantic_values_scope();
 
     if (fail(chlen)) {
-      vs.assign(save_values.begin(), save_values.end());
-      vs.tokens = save_tokens;
+      c.rollback(vs, snap);
       i = chlen;
       break;
     }
 
-    vs.emplace_back(std::move(chvs[0]));
+    vs.emplace_back(std::move(rhs[0]));
     i += chlen;
 
     std::any val;
@@ -4263,7 +6429,7 @@ inline size_t Recovery::parse_core(const char *s, size_t n,
   const auto &rule = dynamic_cast<Reference &>(*ope_);
 
   // Custom error message
-  if (c.log || c.error_reporter) {
+  if (c.reports_errors) {
     auto label = dynamic_cast<Reference *>(rule.args_[0].get());
     if (label && !label->rule_->error_message.empty()) {
       c.error_info.message_pos = s;
@@ -4278,11 +6444,14 @@ inline size_t Recovery::parse_core(const char *s, size_t n,
   {
     auto save_log = c.log;
     auto save_reporter = c.error_reporter;
+    auto save_reports_errors = c.reports_errors;
     c.log = nullptr;
     c.error_reporter = nullptr;
+    c.reports_errors = false;
     auto se = scope_exit([&]() {
       c.log = save_log;
       c.error_reporter = save_reporter;
+      c.reports_errors = save_reports_errors;
     });
 
     SemanticValues dummy_vs;
@@ -4294,7 +6463,7 @@ inline size_t Recovery::parse_core(const char *s, size_t n,
   if (success(len)) {
     c.recovered = true;
 
-    if (c.log || c.error_reporter) {
+    if (c.reports_errors) {
       c.error_info.output_log(c.log, c.error_reporter, c.s, c.l);
       c.error_info.clear();
     }
@@ -4351,13 +6520,35 @@ inline void AssignIDToDefinition::visit(Holder &ope) {
 
 inline void AssignIDToDefinition::visit(Reference &ope) {
   if (ope.rule_) {
-    if (ope.rule_->is_macro && current_def) {
+    if (ope.rule_->is_macro && !ope.args_closed_ && current_def) {
       current_def->has_macro_ref = true;
     }
     for (const auto &arg : ope.args_) {
       arg->accept(*this);
     }
     ope.rule_->accept(*this);
+    if (ope.inst_ && instance_set.insert(ope.inst_).second) {
+      instances.push_back(ope.inst_);
+      ope.inst_->ope->accept(*this);
+    }
+  }
+}
+
+inline void CollectReachableRules::visit(Holder &ope) {
+  if (!seen_.insert(ope.outer_).second) { return; }
+  rules.push_back(ope.outer_);
+  if (ope.outer_->is_left_recursive) { opaque = true; }
+  ope.ope_->accept(*this);
+}
+
+inline void CollectReachableRules::visit(Reference &ope) {
+  for (const auto &arg : ope.args_) {
+    arg->accept(*this);
+  }
+  if (!ope.rule_) { return; }
+  ope.rule_->accept(*this);
+  if (ope.inst_ && instances_.insert(ope.inst_).second) {
+    ope.inst_->ope->accept(*this);
   }
 }
 
@@ -4587,6 +6778,17 @@ inline void ComputeFirstSet::visit(Reference &ope) {
     return;
   }
 
+  if (ope.inst_) {
+    // Instantiated macro: its body holds no parameter any more
+    if (!insts_.insert(ope.inst_).second) {
+      cycle_count_++;
+      return;
+    }
+    ope.inst_->ope->accept(*this);
+    insts_.erase(ope.inst_);
+    return;
+  }
+
   auto it = cache_.find(ope.rule_);
   FirstSet computed;
   const FirstSet *rule_fs;
@@ -4626,9 +6828,38 @@ inline void ComputeFirstSet::visit(Reference &ope) {
   }
 }
 
+inline const FirstSet &ComputeFirstSet::rule(Definition &def) {
+  auto it = cache_.find(&def);
+  if (it != cache_.end()) { return it->second; }
+  result_ = FirstSet{};
+  refs_.insert(&def);
+  auto saved_cycle_count = cycle_count_;
+  def.accept(*this);
+  refs_.erase(&def);
+  if (cycle_count_ == saved_cycle_count) { cache_.emplace(&def, result_); }
+  return result_;
+}
+
+inline void ComputePrefixes::visit(Reference &ope) {
+  if (!ope.rule_) { return; } // macro parameter
+
+  auto it = cache_.find(ope.rule_);
+  if (it == cache_.end()) {
+    if (!refs_.insert(ope.rule_).second) { return; } // cycle
+    ope.rule_->accept(*this);
+    refs_.erase(ope.rule_);
+    it = cache_.emplace(ope.rule_, result_).first;
+  }
+  result_ = it->second;
+  zero_width_ = false;
+}
+
 inline void SetupFirstSets::visit(Reference &ope) {
   if (!ope.rule_) { return; }
   ope.rule_->accept(*this); // re-entry is guarded at the rule's Holder
+  if (ope.inst_ && visited_instances_.insert(ope.inst_).second) {
+    ope.inst_->ope->accept(*this);
+  }
 }
 
 // Guard rule setup by Definition so a SetupFirstSets shared across all rules
@@ -4637,6 +6868,10 @@ inline void SetupFirstSets::visit(Reference &ope) {
 // is O(N^2) for grammars with dense cross-references.
 inline void SetupFirstSets::visit(Holder &ope) {
   if (!visited_rules_.insert(ope.outer_).second) { return; }
+  ComputeFirstSet cfs(first_set_cache_);
+  ope.first_set_ = cfs.rule(*ope.outer_);
+  ope.guard_ = !ope.first_set_.any_char && !ope.first_set_.can_be_empty &&
+               !cfs.hit_cycle();
   ope.ope_->accept(*this);
 }
 
@@ -4648,6 +6883,396 @@ inline void SetupFirstSets::visit(Sequence &ope) {
   }
 }
 
+inline void SetupFirstSets::setup_literal_dictionary(PrioritizedChoice &ope) {
+  ope.dictionary_.reset();
+  ope.dictionary_prefix_free_ = false;
+  ope.use_dictionary_ = false;
+  if (ope.opes_.size() < 2) { return; }
+
+  std::vector<std::string> items;
+  std::vector<std::string> keys; // as the trie compares them
+  auto ignore_case = false;
+  for (const auto &op : ope.opes_) {
+    auto lit = dynamic_cast<LiteralString *>(op.get());
+    if (!lit || lit->lit_.empty()) { return; }
+    if (items.empty()) {
+      ignore_case = lit->ignore_case_;
+    } else if (lit->ignore_case_ != ignore_case) {
+      return;
+    }
+    items.push_back(lit->lit_);
+    keys.push_back(ignore_case ? lit->lower_lit_ : lit->lit_);
+  }
+
+  auto prefix_free = true;
+  for (size_t i = 0; i < keys.size(); i++) {
+    for (size_t j = 0; j < keys.size(); j++) {
+      if (i == j || keys[i].size() >= keys[j].size() ||
+          keys[j].compare(0, keys[i].size(), keys[i]) != 0) {
+        continue;
+      }
+      // keys[i] is a proper prefix of keys[j]: only the longer one may
+      // come first.
+      if (i < j) { return; }
+      prefix_free = false;
+    }
+  }
+
+  ope.dictionary_ = std::make_shared<Dictionary>(items, ignore_case);
+  ope.dictionary_prefix_free_ = prefix_free;
+  ope.use_dictionary_ = true;
+}
+
+inline void SetupFirstSets::setup_shared_prefixes(PrioritizedChoice &ope) {
+  ope.elements_.clear();
+  ope.shared_prefix_.clear();
+  ope.max_shared_prefix_ = 0;
+  ope.prefix_rules_.clear();
+  ope.many_prefix_rules_ = false;
+  if (ope.for_label_ || ope.opes_.size() < 2) { return; }
+
+  // A sequence with a keyword guard keeps its fused match as one element
+  std::vector<std::vector<std::shared_ptr<Ope>>> elements;
+  std::vector<std::vector<std::string>> signatures;
+  for (const auto &op : ope.opes_) {
+    auto seq = dynamic_cast<const Sequence *>(op.get());
+    elements.push_back(seq && !seq->kw_guard_
+                           ? seq->opes_
+                           : std::vector<std::shared_ptr<Ope>>{op});
+    signatures.emplace_back();
+    for (const auto &element : elements.back()) {
+      signatures.back().push_back(OpeSignature::get(*element));
+    }
+  }
+
+  std::vector<uint8_t> shared(ope.opes_.size(), 0);
+  std::vector<const Definition *> rules;
+  std::unordered_set<const Definition *> seen;
+  size_t max_shared = 0;
+  for (size_t id = 1; id < ope.opes_.size(); id++) {
+    const auto &prev = signatures[id - 1];
+    const auto &curr = signatures[id];
+    size_t k = 0;
+    while (k < PrioritizedChoice::kMaxSharedPrefix && k < prev.size() &&
+           k < curr.size() && prev[k] == curr[k]) {
+      // An element that runs a callback of its own or reaches a cut or a
+      // left-recursive rule is parsed by each alternative
+      CollectReachableRules vis;
+      elements[id][k]->accept(vis);
+      if (vis.opaque) { break; }
+      for (auto def : vis.rules) {
+        if (seen.insert(def).second) { rules.push_back(def); }
+      }
+      k++;
+    }
+    shared[id] = static_cast<uint8_t>(k);
+    max_shared = std::max(max_shared, k);
+  }
+  if (max_shared == 0) { return; }
+
+  ope.elements_ = std::move(elements);
+  ope.shared_prefix_ = std::move(shared);
+  ope.max_shared_prefix_ = max_shared;
+  if (rules.size() > PrioritizedChoice::kMaxPrefixRules) {
+    ope.many_prefix_rules_ = true;
+  } else {
+    ope.prefix_rules_ = std::move(rules);
+  }
+}
+
+inline void SetupFirstSets::setup_prefix_dispatch(PrioritizedChoice &ope) {
+  ope.prefix_length_ = 0;
+  ope.prefix_slots_.clear();
+  ope.prefix_candidates_.clear();
+  if (ope.candidates_.empty() || ope.use_dictionary_) { return; }
+
+  std::vector<ComputePrefixes::Prefixes> prefixes;
+  for (const auto &op : ope.opes_) {
+    ComputePrefixes cp(prefix_cache_);
+    cp.compute(*op);
+    prefixes.push_back(std::move(cp.result_));
+  }
+
+  // An alternative is keyed when all its prefixes have at least `length`
+  // bytes. The length keys the most alternatives, the longest on a tie.
+  auto keyed = [&](size_t id, size_t length) {
+    if (!prefixes[id]) { return false; }
+    for (const auto &prefix : *prefixes[id]) {
+      if (prefix.size() < length) { return false; }
+    }
+    return true;
+  };
+  size_t length = 0;
+  size_t most = 1;
+  for (size_t l = 2; l <= ComputePrefixes::kMaxLength; l++) {
+    size_t count = 0;
+    for (size_t id = 0; id < prefixes.size(); id++) {
+      if (keyed(id, l)) { count++; }
+    }
+    if (count >= most && count > 1) {
+      length = l;
+      most = count;
+    }
+  }
+  if (!length) { return; }
+
+  auto pack = [&](const std::string &prefix) {
+    uint32_t key = 0;
+    for (size_t i = 0; i < length; i++) {
+      key |= static_cast<uint32_t>(static_cast<unsigned char>(prefix[i]))
+             << (8 * i);
+    }
+    return key;
+  };
+  std::map<uint32_t, std::vector<uint32_t>> keys;
+  std::bitset<256> first_bytes;
+  for (size_t id = 0; id < prefixes.size(); id++) {
+    if (!keyed(id, length)) { continue; }
+    for (const auto &prefix : *prefixes[id]) {
+      auto &ids = keys[pack(prefix)];
+      if (ids.empty() || ids.back() != id) {
+        ids.push_back(static_cast<uint32_t>(id));
+      }
+      first_bytes.set(static_cast<unsigned char>(prefix[0]));
+    }
+  }
+  // Too many keys, or no first byte with two keys: the first-byte dispatch
+  // does as well.
+  if (keys.size() > PrioritizedChoice::kMaxPrefixKeys ||
+      keys.size() == first_bytes.count()) {
+    return;
+  }
+
+  // The alternatives that are not keyed, as the first-byte dispatch has
+  // them for `ch`.
+  auto unkeyed = [&](unsigned char ch) {
+    std::vector<uint32_t> ids;
+    for (auto id : ope.candidates_[ope.dispatch_[ch]]) {
+      if (!keyed(id, length)) { ids.push_back(id); }
+    }
+    return ids;
+  };
+  std::map<std::vector<uint32_t>, uint32_t> index;
+  auto list = [&](std::vector<uint32_t> ids) {
+    auto it = index.find(ids);
+    if (it == index.end()) {
+      it = index
+               .emplace(ids,
+                        static_cast<uint32_t>(ope.prefix_candidates_.size()))
+               .first;
+      ope.prefix_candidates_.push_back(std::move(ids));
+    }
+    return it->second;
+  };
+  for (size_t ch = 0; ch < 256; ch++) {
+    ope.prefix_fallback_[ch] = list(unkeyed(static_cast<unsigned char>(ch)));
+  }
+
+  size_t slots = 1;
+  while (slots < keys.size() * 2) {
+    slots *= 2;
+  }
+  ope.prefix_slots_.assign(slots, {0, 0});
+  for (const auto &[key, matched] : keys) {
+    // Unkeyed alternatives come in for any byte that folds to the key's.
+    std::vector<uint32_t> ids = matched;
+    for (size_t ch = 0; ch < 256; ch++) {
+      if (static_cast<uint32_t>(std::tolower(static_cast<int>(ch))) !=
+          (key & 0xFF)) {
+        continue;
+      }
+      for (auto id : unkeyed(static_cast<unsigned char>(ch))) {
+        ids.push_back(id);
+      }
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    auto i = PrioritizedChoice::prefix_slot(key, slots - 1);
+    while (ope.prefix_slots_[i].second) {
+      i = (i + 1) & (slots - 1);
+    }
+    ope.prefix_slots_[i] = {key, list(std::move(ids)) + 1};
+  }
+  ope.prefix_length_ = length;
+}
+
+// Builds the native scanner for a %whitespace body made of classes,
+// literals and comments (see WhitespaceScanner). Any other shape keeps the
+// operator tree.
+template <typename Resolve>
+inline std::shared_ptr<ScanUntil>
+SetupFirstSets::scan_until(const std::shared_ptr<Ope> &step, Resolve resolve,
+                           std::vector<const LiteralString *> &literals,
+                           std::shared_ptr<Ope> *stop_ope) {
+  auto seq = dynamic_cast<Sequence *>(resolve(step).get());
+  if (!seq || seq->opes_.size() != 2 ||
+      !dynamic_cast<AnyCharacter *>(resolve(seq->opes_[1]).get())) {
+    return nullptr;
+  }
+  auto pred = dynamic_cast<NotPredicate *>(resolve(seq->opes_[0]).get());
+  auto stop = pred ? resolve(pred->ope_) : nullptr;
+  if (!stop) { return nullptr; }
+  if (stop_ope) { *stop_ope = stop; }
+
+  if (auto cc = dynamic_cast<CharacterClass *>(stop.get())) {
+    if (!cc->is_ascii_only()) { return nullptr; }
+    return std::make_shared<ScanUntil>(cc->ascii_bitset());
+  }
+  std::vector<std::string> stops;
+  auto cho = dynamic_cast<PrioritizedChoice *>(stop.get());
+  for (size_t i = 0; i < (cho ? cho->opes_.size() : 1); i++) {
+    auto lit =
+        dynamic_cast<const LiteralString *>(resolve(cho ? cho->opes_[i] : stop)
+                                                .get());
+    if (!lit || lit->ignore_case_ || lit->lit_.empty() ||
+        static_cast<uint8_t>(lit->lit_[0]) >= 0x80) {
+      return nullptr;
+    }
+    literals.push_back(lit);
+    stops.push_back(lit->lit_);
+  }
+  return std::make_shared<ScanUntil>(std::move(stops));
+}
+
+inline void SetupFirstSets::setup_whitespace_scanner(Whitespace &ws) {
+  ws.scanner_.reset();
+  ws.scanner_rules_.clear();
+  ws.scanner_literals_.clear();
+
+  std::vector<const Definition *> rules;
+  std::vector<const LiteralString *> literals;
+
+  // Looks through rule references and the token boundaries that literal
+  // rules get; none of them changes what whitespace matches.
+  auto resolve = [&](std::shared_ptr<Ope> ope) -> std::shared_ptr<Ope> {
+    for (size_t depth = 0; ope && depth < 16; depth++) {
+      if (auto ign = dynamic_cast<Ignore *>(ope.get())) {
+        ope = ign->ope_;
+      } else if (auto tb = dynamic_cast<TokenBoundary *>(ope.get())) {
+        ope = tb->ope_;
+      } else if (auto ref = dynamic_cast<Reference *>(ope.get())) {
+        if (!ref->rule_ || ref->is_macro_ || ref->rule_->is_macro) {
+          return nullptr;
+        }
+        rules.push_back(ref->rule_);
+        ope = ref->rule_->get_core_operator();
+      } else {
+        return ope;
+      }
+    }
+    return nullptr;
+  };
+  auto literal = [&](const std::shared_ptr<Ope> &ope) -> const LiteralString * {
+    auto lit = dynamic_cast<const LiteralString *>(resolve(ope).get());
+    if (!lit || lit->ignore_case_ || lit->lit_.empty()) { return nullptr; }
+    literals.push_back(lit);
+    return lit;
+  };
+  // `'open' (!Close .)* (Close / Close?)?`, Close being literals
+  auto comment = [&](const Sequence &seq)
+      -> std::optional<WhitespaceScanner::Item> {
+    if (seq.opes_.size() != 2 && seq.opes_.size() != 3) { return std::nullopt; }
+    auto open = literal(seq.opes_[0]);
+    auto body = dynamic_cast<Repetition *>(resolve(seq.opes_[1]).get());
+    if (!open || !body || !body->is_zom()) { return std::nullopt; }
+    std::shared_ptr<Ope> close;
+    auto until = scan_until(body->ope_, resolve, literals, &close);
+    if (!until || until->stops().empty()) { return std::nullopt; }
+    const auto &closes = until->stops();
+    auto mode = WhitespaceScanner::Close::None;
+    if (seq.opes_.size() == 3) {
+      auto tail = resolve(seq.opes_[2]);
+      auto opt = dynamic_cast<Repetition *>(tail.get());
+      if (opt && opt->min_ == 0 && opt->max_ == 1) {
+        mode = WhitespaceScanner::Close::Optional;
+        tail = resolve(opt->ope_);
+      } else {
+        mode = WhitespaceScanner::Close::Required;
+      }
+      // The same closer (or one literal spelled the same), so the tail
+      // matches whichever closer stopped the body.
+      if (tail != close) {
+        auto lit = literal(tail);
+        if (!lit || closes.size() != 1 || lit->lit_ != closes[0]) {
+          return std::nullopt;
+        }
+      }
+    }
+    return WhitespaceScanner::Item::comment(open->lit_, std::move(until),
+                                            mode);
+  };
+
+  auto top = dynamic_cast<Repetition *>(resolve(ws.ope_).get());
+  if (!top || !top->is_zom()) { return; }
+
+  // Flatten nested choices: `A / (B / C)` tries the same alternatives in
+  // the same order as `A / B / C`.
+  std::vector<std::shared_ptr<Ope>> alts;
+  std::function<bool(const std::shared_ptr<Ope> &)> flatten =
+      [&](const std::shared_ptr<Ope> &ope) {
+        auto alt = resolve(ope);
+        if (!alt) { return false; }
+        if (auto cho = dynamic_cast<PrioritizedChoice *>(alt.get())) {
+          for (const auto &op : cho->opes_) {
+            if (!flatten(op)) { return false; }
+          }
+        } else {
+          alts.push_back(alt);
+        }
+        return true;
+      };
+  if (!flatten(top->ope_) || alts.size() > WhitespaceScanner::kMaxItems) {
+    return;
+  }
+
+  using Item = WhitespaceScanner::Item;
+  std::vector<Item> items;
+  std::bitset<256> earlier; // bytes an earlier alternative can start with
+  for (const auto &alt : alts) {
+    std::bitset<256> bits;
+    auto run = false;
+    auto cc = dynamic_cast<CharacterClass *>(alt.get());
+    auto rep = dynamic_cast<Repetition *>(alt.get());
+    if (rep && rep->min_ == 1 &&
+        rep->max_ == std::numeric_limits<size_t>::max()) {
+      cc = dynamic_cast<CharacterClass *>(resolve(rep->ope_).get());
+      run = true;
+    } else if (rep) {
+      return;
+    }
+    if (cc) {
+      if (!cc->is_ascii_only()) { return; }
+      bits = cc->ascii_bitset();
+    } else if (dynamic_cast<LiteralString *>(alt.get())) {
+      auto lit = literal(alt);
+      if (!lit) { return; }
+      if (lit->lit_.size() > 1) {
+        items.push_back(Item::literal(lit->lit_));
+        earlier.set(static_cast<uint8_t>(lit->lit_[0]));
+        continue;
+      }
+      bits.set(static_cast<uint8_t>(lit->lit_[0]));
+    } else if (auto seq = dynamic_cast<Sequence *>(alt.get())) {
+      auto item = comment(*seq);
+      if (!item) { return; }
+      earlier.set(static_cast<uint8_t>(item->open[0]));
+      items.push_back(std::move(*item));
+      continue;
+    } else {
+      return;
+    }
+    // A class can take its whole run when no earlier alternative would get
+    // a chance at any byte of it.
+    items.push_back(Item::byte_class(bits, run || (bits & earlier).none()));
+    earlier |= bits;
+  }
+
+  ws.scanner_ = std::make_unique<WhitespaceScanner>(std::move(items));
+  ws.scanner_rules_ = std::move(rules);
+  ws.scanner_literals_ = std::move(literals);
+}
+
 inline void SetupFirstSets::setup_keyword_guarded_identifier(Sequence &seq) {
   // Detect pattern: NotPredicate(Reference→PrioritizedChoice<literals>)
   //                 TokenBoundary(Sequence[CharacterClass,
@@ -4721,233 +7346,1873 @@ inline void SetupFirstSets::setup_keyword_guarded_identifier(Sequence &seq) {
     if (rep) { rest_cc = dynamic_cast<CharacterClass *>(rep->ope_.get()); }
   }
 
-  if (!first_cc || !rest_cc) { return; }
-  if (!first_cc->is_ascii_only() || !rest_cc->is_ascii_only()) { return; }
+  if (!first_cc || !rest_cc) { return; }
+  if (!first_cc->is_ascii_only() || !rest_cc->is_ascii_only()) { return; }
+
+  // All conditions met — set up the fast path
+  auto kw = std::make_unique<KeywordGuardData>();
+  kw->identifier_first = first_cc->ascii_bitset();
+  kw->identifier_rest = rest_cc->ascii_span();
+
+  // Compute keyword length range for early-out in hot path
+  size_t min_len = SIZE_MAX, max_len = 0;
+  for (const auto &k : exact_keywords) {
+    min_len = std::min(min_len, k.size());
+    max_len = std::max(max_len, k.size());
+  }
+  for (const auto &k : prefix_keywords) {
+    min_len = std::min(min_len, k.size());
+    max_len = std::max(max_len, k.size());
+  }
+  kw->min_keyword_len = min_len;
+  kw->max_keyword_len = max_len;
+
+  kw->exact_keywords = std::move(exact_keywords);
+  kw->prefix_keywords = std::move(prefix_keywords);
+  seq.kw_guard_ = std::move(kw);
+}
+
+// The bytes a class-shaped %word starts with: an ASCII class, once or
+// repeated, then optionally repeated ASCII classes, behind token
+// boundaries or plain rules. Such a %word matches exactly where its first
+// class does.
+inline std::optional<std::bitset<256>>
+Definition::word_first_set(const Ope &ope) {
+  auto ascii = [](const Ope *op) -> const CharacterClass * {
+    auto cc = dynamic_cast<const CharacterClass *>(op);
+    return cc && cc->is_ascii_only() ? cc : nullptr;
+  };
+  auto op = &ope;
+  for (auto depth = 0; depth < 8; depth++) {
+    if (auto tb = dynamic_cast<const TokenBoundary *>(op)) {
+      op = tb->ope_.get();
+    } else if (auto ref = dynamic_cast<const Reference *>(op)) {
+      auto rule = ref->rule_;
+      if (!rule || rule->is_macro || rule->action || rule->enter ||
+          rule->leave || rule->predicate) {
+        return std::nullopt;
+      }
+      op = rule->get_core_operator().get();
+    } else {
+      break;
+    }
+  }
+
+  auto first = op;
+  const std::vector<std::shared_ptr<Ope>> *rest = nullptr;
+  if (auto seq = dynamic_cast<const Sequence *>(op)) {
+    if (seq->opes_.empty()) { return std::nullopt; }
+    first = seq->opes_.front().get();
+    rest = &seq->opes_;
+  }
+  if (auto rep = dynamic_cast<const Repetition *>(first)) {
+    if (rep->min_ != 1) { return std::nullopt; }
+    first = rep->ope_.get();
+  }
+  auto cc = ascii(first);
+  if (!cc) { return std::nullopt; }
+  if (rest) {
+    for (size_t i = 1; i < rest->size(); i++) {
+      auto rep = dynamic_cast<const Repetition *>((*rest)[i].get());
+      if (!rep || rep->min_ != 0 || !ascii(rep->ope_.get())) {
+        return std::nullopt;
+      }
+    }
+  }
+  return cc->ascii_bitset();
+}
+
+// Compute which rules benefit from packrat memoization.
+// A rule benefits if it's reachable from 2+ alternatives of the same
+// PrioritizedChoice (backtracking will re-visit it at the same position).
+inline void Definition::initialize_packrat_filter() const {
+  std::call_once(packrat_filter_init_, [&]() {
+    auto def_count = definition_ids_.size();
+    if (def_count == 0) { return; }
+    // Macro instances take the memo ids after the definitions
+    auto memo_count = def_count + macro_instances_.size();
+
+    // Collect rule IDs that can be invoked at the *same start position* as
+    // the given Ope subtree (leftmost reachability). A packrat cache hit
+    // requires the same rule to be queried twice at the same position, and
+    // in a PEG that only happens when alternatives of a choice share a
+    // leftmost prefix — rules reachable only past a consuming element can
+    // never be re-queried by a sibling alternative.
+    struct CollectLeftmostRules : public TraversalVisitor {
+      using TraversalVisitor::visit;
+      std::vector<bool> reachable; // indexed by def_id or instance id
+      std::vector<bool>
+          visited_rules; // indexed by def_id; guards Holder cycles
+
+      CollectLeftmostRules(size_t n)
+          : reachable(n, false), visited_rules(n, false) {}
+
+      // Collect from the position element `from` starts at: element `from`
+      // itself, plus what follows for as long as elements can match empty —
+      // only up to (and including) the first one that must consume input.
+      void collect(const std::vector<std::shared_ptr<Ope>> &opes, size_t from) {
+        for (auto i = from; i < opes.size(); i++) {
+          opes[i]->accept(*this);
+          ComputeCanBeEmpty empty_vis;
+          opes[i]->accept(empty_vis);
+          if (!empty_vis.result) { break; }
+        }
+      }
+
+      void visit(Sequence &ope) override { collect(ope.opes_, 0); }
+      void visit(Holder &ope) override {
+        auto id = ope.outer_->id;
+        if (id < reachable.size()) {
+          reachable[id] = true;
+
+          // Grammars built directly via the combinator API embed rules through
+          // WeakHolder rather than Reference, so a recursive rule forms a
+          // Holder cycle with no Reference to break it. Guard re-entry to avoid
+          // infinite recursion (reachability is monotone, so revisiting a rule
+          // we have already traversed adds nothing).
+          if (visited_rules[id]) { return; }
+          visited_rules[id] = true;
+        }
+        ope.ope_->accept(*this);
+      }
+      void visit(Reference &ope) override {
+        if (ope.inst_) {
+          // An instance is queried at the position of its call, like a rule
+          auto id = ope.inst_->id;
+          if (id < reachable.size() && !reachable[id]) {
+            reachable[id] = true;
+            ope.inst_->ope->accept(*this);
+          }
+        } else if (ope.rule_ && ope.rule_->id < reachable.size() &&
+                   !reachable[ope.rule_->id]) {
+          reachable[ope.rule_->id] = true;
+          ope.rule_->accept(*this);
+        }
+      }
+    };
+
+    // Find rules (and macro instances) that benefit: queried by 2+
+    // alternatives of the same choice at the same position
+    std::vector<bool> benefits(memo_count, false);
+
+    struct FindBacktrackRules : public TraversalVisitor {
+      using TraversalVisitor::visit;
+      std::vector<bool> &benefits;
+      size_t memo_count;
+      std::vector<bool> visited_rules; // indexed by def_id or instance id
+
+      FindBacktrackRules(std::vector<bool> &b, size_t n)
+          : benefits(b), memo_count(n), visited_rules(n, false) {}
+
+      using Elements = std::vector<std::shared_ptr<Ope>>;
+
+      // An alternative's top-level elements, so a shared prefix can be walked
+      // element by element. By value: this runs once per grammar.
+      static Elements elements_of(const std::shared_ptr<Ope> &alt) {
+        if (auto *seq = dynamic_cast<Sequence *>(alt.get())) {
+          return seq->opes_;
+        }
+        return {alt};
+      }
+
+      // `group` holds alternatives that agree on their first `k` elements, so
+      // every one of them reaches element k at the same input position — that
+      // is exactly when a packrat cache entry can hit. k == 0 is the plain
+      // "alternatives of one choice" case; deeper k is what a shared prefix
+      // like `'(' _ PATTERN _ ',' _` hides.
+      void mark_aligned(const std::vector<Elements> &group, size_t k) {
+        if (group.size() < 2) { return; }
+
+        std::vector<std::vector<bool>> reachable;
+        reachable.reserve(group.size());
+        for (const auto &seq : group) {
+          CollectLeftmostRules clr(memo_count);
+          clr.collect(seq, k);
+          reachable.push_back(std::move(clr.reachable));
+        }
+        for (size_t id = 0; id < memo_count; id++) {
+          size_t count = 0;
+          for (const auto &alt : reachable) {
+            if (alt[id]) { count++; }
+          }
+          if (count >= 2) { benefits[id] = true; }
+        }
+
+        // Only alternatives that also agree on element k stay aligned past it.
+        std::map<std::string, std::vector<Elements>> aligned;
+        for (const auto &seq : group) {
+          if (k < seq.size()) {
+            aligned[OpeSignature::get(*seq[k])].push_back(seq);
+          }
+        }
+        for (const auto &[sig, sub] : aligned) {
+          mark_aligned(sub, k + 1);
+        }
+      }
+
+      void visit(PrioritizedChoice &ope) override {
+        std::vector<Elements> group;
+        group.reserve(ope.opes_.size());
+        for (const auto &op : ope.opes_) {
+          group.push_back(elements_of(op));
+        }
+        mark_aligned(group, 0);
+
+        // Recurse into alternatives
+        for (auto &op : ope.opes_) {
+          op->accept(*this);
+        }
+      }
+      void visit(Holder &ope) override {
+        auto id = ope.outer_->id;
+        if (id < visited_rules.size() && !visited_rules[id]) {
+          visited_rules[id] = true;
+          ope.ope_->accept(*this);
+        }
+      }
+      void visit(Reference &ope) override {
+        if (ope.rule_) { ope.rule_->accept(*this); }
+        if (ope.inst_) {
+          auto id = ope.inst_->id;
+          if (id < visited_rules.size() && !visited_rules[id]) {
+            visited_rules[id] = true;
+            ope.inst_->ope->accept(*this);
+          }
+        }
+      }
+    };
+
+    FindBacktrackRules finder(benefits, memo_count);
+    holder_->accept(finder);
+    if (whitespaceOpe) { whitespaceOpe->accept(finder); }
+    if (wordOpe) { wordOpe->accept(finder); }
+
+    // Left-recursive rules read and write the packrat cache directly during
+    // seed-growing, so they must stay in the cached set. Macros are the
+    // exception: they use the LR memo only, keyed by instantiation.
+    for (const auto &[ptr, id] : definition_ids_) {
+      auto *def = static_cast<Definition *>(ptr);
+      if (def->is_left_recursive && !def->is_macro && id < def_count) {
+        benefits[id] = true;
+      }
+    }
+
+    // A macro instance is not a rule the seed-growing can see: one that
+    // reaches a left-recursive rule at its own position may be on that
+    // rule's cycle, where a memoized match goes stale as the seed grows.
+    for (auto inst : macro_instances_) {
+      if (inst->id >= memo_count || !benefits[inst->id]) { continue; }
+      CollectLeftmostRules clr(memo_count);
+      inst->ope->accept(clr);
+      for (const auto &[ptr, id] : definition_ids_) {
+        if (id < def_count && clr.reachable[id] &&
+            static_cast<Definition *>(ptr)->is_left_recursive) {
+          benefits[inst->id] = false;
+          break;
+        }
+      }
+    }
+
+    // Compact index: def_id -> slot in the cache tables (-1 = guard only)
+    packrat_index_.assign(memo_count, -1);
+    int32_t k = 0;
+    for (size_t id = 0; id < memo_count; id++) {
+      if (benefits[id]) { packrat_index_[id] = k++; }
+    }
+    packrat_cached_count_ = static_cast<size_t>(k);
+  });
+}
+
+inline void LinkReferences::visit(Reference &ope) {
+  // Check if the reference is a macro parameter
+  auto found_param = false;
+  for (size_t i = 0; i < params_.size(); i++) {
+    const auto &param = params_[i];
+    if (param == ope.name_) {
+      ope.iarg_ = i;
+      found_param = true;
+      break;
+    }
+  }
+
+  // Check if the reference is a definition rule
+  if (!found_param && grammar_.count(ope.name_)) {
+    auto &rule = grammar_.at(ope.name_);
+    ope.rule_ = &rule;
+  }
+
+  for (const auto &arg : ope.args_) {
+    arg->accept(*this);
+  }
+}
+
+inline void FindReference::visit(Reference &ope) {
+  for (size_t i = 0; i < args_.size(); i++) {
+    const auto &name = params_[i];
+    if (name == ope.name_) {
+      found_ope = args_[i];
+      return;
+    }
+  }
+  found_ope = ope.shared_from_this();
+}
+
+inline void SubstituteMacroParams::visit(Reference &ope) {
+  if (!ope.rule_) {
+    result_ = args_[ope.iarg_];
+  } else if (ope.is_macro_) {
+    auto args = apply_all(ope.args_);
+    if (!args.empty()) {
+      auto call = std::make_shared<Reference>(ope.grammar_, ope.name_, ope.s_,
+                                              true, args);
+      call->rule_ = ope.rule_;
+      calls.push_back(call.get());
+      result_ = call;
+    }
+  }
+}
+
+// Finds a macro parameter in an operator, without entering other rules.
+struct FindMacroParam : public TraversalVisitor {
+  using TraversalVisitor::visit;
+  void visit(WeakHolder &) override {}
+  void visit(Holder &) override {}
+  void visit(Reference &ope) override {
+    if (!ope.rule_) { found = true; }
+    for (const auto &arg : ope.args_) {
+      arg->accept(*this);
+    }
+  }
+  bool found = false;
+};
+
+// Collects the macro invocations of a rule body, arguments included.
+struct CollectMacroCalls : public TraversalVisitor {
+  using TraversalVisitor::visit;
+  void visit(WeakHolder &) override {}
+  void visit(Holder &) override {}
+  void visit(Reference &ope) override {
+    if (ope.rule_ && ope.is_macro_) { calls.push_back(&ope); }
+    for (const auto &arg : ope.args_) {
+      arg->accept(*this);
+    }
+  }
+  std::vector<Reference *> calls;
+};
+
+// Monomorphizes macros: each distinct (macro, arguments) invocation gets its
+// own copy of the macro body with the arguments substituted, and the
+// invocation parses that copy (Reference::inst_). No FindReference walk, no
+// argument frame and no parameter lookup is left at parse time.
+//
+// Invocations inside an instance are instantiated in turn. An instance that
+// reaches its own key again (`L(X) <- X (',' L(X))?`) links back to itself;
+// one that would expand its macro again with other arguments
+// (`M(s) <- s M(s / 'x')`) keeps the dynamic path, as do left-recursive
+// macros, which grow seeds per instantiation (Context::intern_macro_inst).
+class MacroInstantiator {
+public:
+  void run(Grammar &grammar) {
+    std::vector<Reference *> calls;
+    for (auto &[_, rule] : grammar) {
+      rule.macro_instances.clear();
+      if (auto ope = rule.get_core_operator()) {
+        CollectMacroCalls vis;
+        ope->accept(vis);
+        calls.insert(calls.end(), vis.calls.begin(), vis.calls.end());
+      }
+    }
+
+    for (auto call : calls) {
+      FindMacroParam vis;
+      for (const auto &arg : call->args_) {
+        arg->accept(vis);
+      }
+      call->args_closed_ = !vis.found;
+      call->inst_ = nullptr;
+    }
+    for (auto call : calls) {
+      if (call->args_closed_) { call->inst_ = instantiate(*call); }
+    }
+  }
+
+private:
+  MacroInstance *instantiate(const Reference &call) {
+    auto def = call.rule_;
+    if (def->is_left_recursive || !def->get_core_operator()) { return nullptr; }
+
+    auto key = macro_inst_key(def, call.args_);
+    auto it = instances_.find(key);
+    if (it != instances_.end()) { return it->second; }
+    if (std::find(expanding_.begin(), expanding_.end(), def) !=
+        expanding_.end()) {
+      return nullptr;
+    }
+
+    SubstituteMacroParams vis(call.args_);
+    auto body = vis.apply(def->get_core_operator());
+    if (vis.failed) {
+      instances_.emplace(std::move(key), nullptr);
+      return nullptr;
+    }
+    def->macro_instances.push_back(std::make_unique<MacroInstance>());
+    auto inst = def->macro_instances.back().get();
+    inst->ope = std::move(body);
+    instances_.emplace(std::move(key), inst);
+
+    expanding_.push_back(def);
+    for (auto inner : vis.calls) {
+      inner->args_closed_ = true;
+      inner->inst_ = instantiate(*inner);
+    }
+    expanding_.pop_back();
+    return inst;
+  }
+
+  std::map<std::vector<const void *>, MacroInstance *> instances_;
+  std::vector<const Definition *> expanding_;
+};
+
+inline void instantiate_macros(Grammar &grammar) {
+  MacroInstantiator().run(grammar);
+}
+
+// Direct left recursion in its common shape, `E <- E '+' T / E '-' T / T`,
+// parses as `T ('+' T / '-' T)*` with the values folded to the left (see
+// Holder::parse_core); this records the tails (`'+' T`, `'-' T`) for it. A
+// rule qualifies when its body is a choice whose alternatives either start
+// with a plain reference to the rule itself, or cannot reach the rule at
+// their own position nor match empty, and there is one of each. Indirect
+// and mutual left recursion keep seed growing.
+inline void fold_left_recursion(Grammar &grammar) {
+  for (auto &[name, rule] : grammar) {
+    rule.lr_tails.clear();
+    if (!rule.is_left_recursive || rule.is_macro || rule.no_whitespace) {
+      continue;
+    }
+    auto choice =
+        dynamic_cast<PrioritizedChoice *>(rule.get_core_operator().get());
+    if (!choice) { continue; }
+
+    std::vector<std::shared_ptr<Ope>> tails;
+    auto recursive = false;
+    auto base = false;
+    auto ok = true;
+    for (const auto &alt : choice->opes_) {
+      auto seq = dynamic_cast<Sequence *>(alt.get());
+      auto ref = seq && seq->opes_.size() >= 2
+                     ? dynamic_cast<Reference *>(seq->opes_[0].get())
+                     : nullptr;
+      if (ref && ref->rule_ == &rule && !ref->is_macro_) {
+        const auto &opes = seq->opes_;
+        tails.push_back(opes.size() == 2
+                            ? opes[1]
+                            : std::make_shared<Sequence>(
+                                  std::vector<std::shared_ptr<Ope>>(
+                                      opes.begin() + 1, opes.end())));
+        recursive = true;
+        continue;
+      }
+
+      DetectLeftRecursion lr(name);
+      alt->accept(lr);
+      ComputeCanBeEmpty empty;
+      alt->accept(empty);
+      if (lr.error_s || empty.result) {
+        ok = false;
+        break;
+      }
+      tails.push_back(nullptr);
+      base = true;
+    }
+    if (ok && recursive && base) { rule.lr_tails = std::move(tails); }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ *  Bytecode VM
+ *
+ *  parser::compile() lowers the grammar into a flat instruction array (see
+ *  Bytecode) run by one dispatch loop: sequences become straight-line code,
+ *  choices and repetitions become backtrack entries on an explicit stack,
+ *  and rule invocations become calls, so a match no longer walks the
+ *  shared_ptr graph through a virtual parse_core per node. Operators the VM
+ *  has no instruction for run on the operator tree from a Tree instruction.
+ *---------------------------------------------------------------------------*/
+
+// Collects the rules a rule body references and whether it contains
+// something that keeps the rule on the operator tree.
+struct CollectBytecodeDeps : public TraversalVisitor {
+  using TraversalVisitor::visit;
+
+  CollectBytecodeDeps(const Bytecode &bc) : bc_(bc) {}
+
+  void visit(Holder &ope) override { add(ope.outer_); }
+  void visit(Reference &ope) override {
+    if (ope.rule_) { add(ope.rule_); }
+    for (auto &arg : ope.args_) {
+      arg->accept(*this);
+    }
+  }
+  void visit(CaptureScope &) override { opaque = true; }
+  void visit(Capture &) override { opaque = true; }
+  void visit(User &) override { opaque = true; }
+  void visit(BackReference &) override { opaque = true; }
+  void visit(PrecedenceClimbing &ope) override {
+    opaque = true;
+    // The operator rule reports its token from the tree-walking Holder.
+    auto ref = dynamic_cast<Reference *>(ope.binop_.get());
+    if (ref && ref->rule_) { binops.push_back(ref->rule_); }
+  }
+  void visit(Recovery &) override { opaque = true; }
+  void visit(Cut &) override { opaque = true; }
+
+  std::vector<uint32_t> callees;
+  std::vector<const Definition *> binops;
+  bool opaque = false;
+
+private:
+  void add(const Definition *def) {
+    auto i = def->bytecode_rule;
+    if (i < bc_.rules.size() && bc_.rules[i].def == def) {
+      callees.push_back(static_cast<uint32_t>(i));
+    } else {
+      opaque = true; // not part of this grammar
+    }
+  }
+
+  const Bytecode &bc_;
+};
+
+struct LowerToBytecode : public Ope::Visitor {
+  using Ope::Visitor::visit;
+
+  LowerToBytecode(Bytecode &bc, const std::vector<bool> &lowered)
+      : bc_(bc), lowered_(lowered) {}
+
+  void visit(Sequence &ope) override {
+    // The keyword guard is a fused scan of its own; keep it.
+    if (ope.kw_guard_) {
+      tree(ope);
+      return;
+    }
+    for (auto &op : ope.opes_) {
+      op->accept(*this);
+    }
+  }
+
+  void visit(PrioritizedChoice &ope) override {
+    std::vector<uint32_t> exits;
+    for (size_t id = 0; id < ope.opes_.size(); id++) {
+      // Same first-set filter as PrioritizedChoice::parse_core
+      auto test = kNone;
+      if (id < ope.first_sets_.size()) {
+        const auto &fs = ope.first_sets_[id];
+        if (!fs.any_char && !fs.can_be_empty) {
+          test = emit(OpCode::TestSet, add_set(fs.chars));
+        }
+      }
+
+      if (id + 1 == ope.opes_.size()) {
+        ope.opes_[id]->accept(*this);
+        if (test != kNone) {
+          exits.push_back(emit(OpCode::Jump));
+          patch(test);
+          emit(OpCode::Fail);
+        }
+      } else {
+        auto choice = emit(OpCode::Choice);
+        ope.opes_[id]->accept(*this);
+        exits.push_back(emit(OpCode::Commit));
+        patch(choice);
+        if (test != kNone) { patch(test); }
+      }
+    }
+    for (auto at : exits) {
+      patch(at);
+    }
+  }
+
+  void visit(Repetition &ope) override {
+    const auto unbounded = ope.max_ == std::numeric_limits<size_t>::max();
+
+    if (ope.span_) {
+      bc_.spans.push_back({*ope.span_, ope.min_, ope.max_});
+      emit(OpCode::Span, static_cast<uint32_t>(bc_.spans.size() - 1));
+      return;
+    }
+
+    // The operator's scan-until path beats stepping through `!Stop .`, and
+    // its decode loop beats stepping through a non-ASCII class.
+    if (ope.until_ || ope.class_) {
+      tree(ope);
+      return;
+    }
+
+    // Bounded counts are unrolled; large ones stay on the tree.
+    if (ope.min_ > kMaxUnroll ||
+        (!unbounded && ope.max_ - ope.min_ > kMaxUnroll)) {
+      tree(ope);
+      return;
+    }
+
+    for (size_t i = 0; i < ope.min_; i++) {
+      ope.ope_->accept(*this);
+    }
+
+    if (unbounded) {
+      auto choice = emit(OpCode::Choice);
+      auto body = here();
+      ope.ope_->accept(*this);
+      emit(OpCode::PartialCommit, 0, body);
+      patch(choice);
+    } else {
+      std::vector<uint32_t> exits;
+      for (size_t i = ope.min_; i < ope.max_; i++) {
+        exits.push_back(emit(OpCode::Choice));
+        ope.ope_->accept(*this);
+        patch(emit(OpCode::Commit));
+      }
+      for (auto at : exits) {
+        patch(at);
+      }
+    }
+  }
+
+  void visit(AndPredicate &ope) override {
+    auto choice = emit(OpCode::Choice);
+    ope.ope_->accept(*this);
+    auto back_commit = emit(OpCode::BackCommit);
+    patch(choice);
+    emit(OpCode::Fail);
+    patch(back_commit);
+  }
+
+  void visit(NotPredicate &ope) override {
+    auto choice = emit(OpCode::Choice);
+    ope.ope_->accept(*this);
+    emit(OpCode::FailTwice);
+    patch(choice);
+  }
+
+  void visit(Dictionary &ope) override { tree(ope); }
+
+  void visit(LiteralString &ope) override {
+    bc_.literals.push_back(&ope);
+    emit(OpCode::Literal, static_cast<uint32_t>(bc_.literals.size() - 1));
+  }
+
+  void visit(CharacterClass &ope) override {
+    if (ope.is_ascii_only()) {
+      emit(OpCode::Set, add_set(ope.ascii_bitset()));
+    } else {
+      tree(ope);
+    }
+  }
+
+  void visit(Character &ope) override {
+    if (ope.ch_ < 0x80) {
+      emit(OpCode::Char, static_cast<uint32_t>(ope.ch_));
+    } else {
+      tree(ope);
+    }
+  }
+
+  void visit(AnyCharacter &) override { emit(OpCode::Any); }
+
+  void visit(TokenBoundary &ope) override {
+    emit(OpCode::TokenBegin);
+    ope.ope_->accept(*this);
+    emit(OpCode::TokenEnd);
+  }
+
+  // An ignored value is no different from any other here: none is kept.
+  void visit(Ignore &ope) override { ope.ope_->accept(*this); }
+
+  void visit(WeakHolder &ope) override { ope.weak_.lock()->accept(*this); }
+  void visit(Holder &ope) override { call(ope.outer_, ope); }
+
+  // A macro invocation is expanded in place, as the interpreter parses it
+  // in the caller's scope anyway; a parameter lowers the argument it was
+  // given, resolved where the invocation was written.
+  void visit(Reference &ope) override {
+    if (!ope.rule_) {
+      if (!args_) {
+        failed = true;
+        return;
+      }
+      auto args = args_;
+      args_ = args->outer;
+      args->ref->args_[ope.iarg_]->accept(*this);
+      args_ = args;
+    } else if (ope.rule_->is_macro) {
+      // Recursive macros would expand forever; they stay on the tree.
+      auto def = ope.rule_;
+      if (def->is_left_recursive || !def->get_core_operator() ||
+          std::find(expanding_.begin(), expanding_.end(), def) !=
+              expanding_.end()) {
+        failed = true;
+        return;
+      }
+      Args args{&ope, args_};
+      auto outer = args_;
+      args_ = &args;
+      expanding_.push_back(def);
+      def->get_core_operator()->accept(*this);
+      expanding_.pop_back();
+      args_ = outer;
+    } else {
+      call(ope.rule_, ope);
+    }
+  }
+
+  void visit(Whitespace &ope) override { tree(ope); }
+
+  // Set when the rule cannot be lowered: a macro it invokes does not expand
+  // in place, or would have to run on the tree.
+  bool failed = false;
+
+private:
+  struct Args {
+    const Reference *ref;
+    const Args *outer;
+  };
+
+  // Finds macro invocations and parameters, which only resolve against the
+  // rule stack and argument frames the VM does not keep.
+  struct FindMacroReference : public TraversalVisitor {
+    using TraversalVisitor::visit;
+    void visit(Reference &ope) override {
+      if (!ope.rule_ || ope.rule_->is_macro) { found = true; }
+    }
+    bool found = false;
+  };
+
+  static constexpr uint32_t kNone = UINT32_MAX;
+  static constexpr size_t kMaxUnroll = 4;
+
+  uint32_t here() const { return static_cast<uint32_t>(bc_.code.size()); }
+
+  uint32_t emit(OpCode op, uint32_t arg = 0, uint32_t target = 0) {
+    bc_.code.push_back({op, arg, target});
+    return here() - 1;
+  }
+
+  void patch(uint32_t at) { bc_.code[at].target = here(); }
+
+  uint32_t add_set(const std::bitset<256> &set) {
+    bc_.sets.push_back(set);
+    return static_cast<uint32_t>(bc_.sets.size() - 1);
+  }
+
+  void tree(Ope &ope) {
+    FindMacroReference vis;
+    ope.accept(vis);
+    if (vis.found) { failed = true; }
+    bc_.opes.push_back(&ope);
+    emit(OpCode::Tree, static_cast<uint32_t>(bc_.opes.size() - 1));
+  }
+
+  void call(const Definition *def, Ope &ope) {
+    auto i = def->bytecode_rule;
+    if (i < lowered_.size() && bc_.rules[i].def == def && lowered_[i]) {
+      emit(OpCode::Call, static_cast<uint32_t>(i));
+    } else {
+      tree(ope);
+    }
+  }
+
+  Bytecode &bc_;
+  const std::vector<bool> &lowered_;
+  const Args *args_ = nullptr;
+  std::vector<const Definition *> expanding_;
+};
+
+inline std::shared_ptr<const Bytecode>
+Bytecode::compile(Grammar &grammar, const std::string &start,
+                  const NativeRules *natives) {
+  auto bc = std::make_shared<Bytecode>();
+  bc->code.push_back({OpCode::End}); // return address of a run's bottom frame
+
+  std::vector<Definition *> defs;
+  for (auto &[_, rule] : grammar) {
+    defs.push_back(&rule);
+  }
+  std::sort(defs.begin(), defs.end(),
+            [](const Definition *a, const Definition *b) {
+              return a->name < b->name;
+            });
+  for (auto def : defs) {
+    def->bytecode_rule = bc->rules.size();
+    bc->rules.emplace_back();
+    bc->rules.back().def = def;
+  }
+
+  std::vector<Ope *> bodies;
+  for (const auto &r : bc->rules) {
+    bodies.push_back(r.def->get_core_operator().get());
+  }
+
+  // The whitespace skipped after tokens is Whitespace(Ignore(body)) (see
+  // wsp()); the VM does the Whitespace part itself and runs the body.
+  auto &start_rule = grammar[start];
+  if (auto ws = dynamic_cast<Whitespace *>(start_rule.whitespaceOpe.get())) {
+    if (auto ign = dynamic_cast<Ignore *>(ws->ope_.get())) {
+      bc->whitespaceOpe = ws;
+      bc->whitespace_rule = bc->rules.size();
+      bc->rules.emplace_back();
+      bodies.push_back(ign->ope_.get());
+    }
+  }
+
+  std::vector<uint32_t> opaque;
+  std::vector<const Definition *> binops;
+  for (size_t i = 0; i < bc->rules.size(); i++) {
+    CollectBytecodeDeps vis(*bc);
+    if (bodies[i]) { bodies[i]->accept(vis); }
+    auto &r = bc->rules[i];
+    r.opaque = !bodies[i] || vis.opaque;
+    if (r.opaque) { opaque.push_back(static_cast<uint32_t>(i)); }
+    for (auto callee : vis.callees) {
+      bc->rules[callee].callers.push_back(static_cast<uint32_t>(i));
+    }
+    binops.insert(binops.end(), vis.binops.begin(), vis.binops.end());
+  }
+  for (auto def : binops) {
+    auto i = def->bytecode_rule;
+    if (i < bc->rules.size() && bc->rules[i].def == def &&
+        !bc->rules[i].opaque) {
+      bc->rules[i].opaque = true;
+      opaque.push_back(static_cast<uint32_t>(i));
+    }
+  }
+
+  // Whatever reaches an opaque rule is opaque too.
+  while (!opaque.empty()) {
+    auto i = opaque.back();
+    opaque.pop_back();
+    for (auto caller : bc->rules[i].callers) {
+      if (!bc->rules[caller].opaque) {
+        bc->rules[caller].opaque = true;
+        opaque.push_back(caller);
+      }
+    }
+  }
+
+  // Macros are only ever expanded into their callers.
+  std::vector<bool> lowered(bc->rules.size());
+  for (size_t i = 0; i < bc->rules.size(); i++) {
+    const auto &r = bc->rules[i];
+    lowered[i] = !r.opaque && !(r.def && (r.def->is_left_recursive ||
+                                          r.def->is_macro));
+  }
+
+  // The first pass finds the rules that fail to lower; the second emits the
+  // code, calling those through the tree.
+  for (auto pass = 0; pass < 2; pass++) {
+    bc->code.resize(1);
+    bc->sets.clear();
+    bc->spans.clear();
+    bc->literals.clear();
+    bc->opes.clear();
+
+    LowerToBytecode vis(*bc, lowered);
+    for (size_t i = 0; i < bc->rules.size(); i++) {
+      bc->rules[i].entry = 0;
+      if (!lowered[i]) { continue; }
+      auto no_whitespace = bc->rules[i].def && bc->rules[i].def->no_whitespace;
+      auto entry = static_cast<uint32_t>(bc->code.size());
+      vis.failed = false;
+      if (no_whitespace) { bc->code.push_back({OpCode::TokenBegin}); }
+      bodies[i]->accept(vis);
+      if (no_whitespace) { bc->code.push_back({OpCode::TokenEnd}); }
+      bc->code.push_back({OpCode::Return});
+      if (vis.failed) {
+        lowered[i] = false;
+      } else {
+        bc->rules[i].entry = entry;
+      }
+    }
+  }
+
+  if (natives && natives->fingerprint == bc->fingerprint() &&
+      natives->rules.size() == bc->rules.size()) {
+    for (size_t i = 0; i < bc->rules.size(); i++) {
+      if (bc->rules[i].entry) { bc->rules[i].native = natives->rules[i]; }
+    }
+  }
+
+  start_rule.initialize_definition_ids();
+  bc->finalize();
+  start_rule.bytecode = bc;
+  return bc;
+}
+
+inline void Bytecode::finalize() {
+  chars.clear();
+  texts.clear();
+  for (auto lit : literals) {
+    const auto &s = lit->ignore_case_ ? lit->lower_lit_ : lit->lit_;
+    texts.push_back({static_cast<uint32_t>(chars.size()),
+                     static_cast<uint32_t>(s.size()), lit->ignore_case_});
+    chars += s;
+  }
+
+  callees.clear();
+  for (const auto &r : rules) {
+    callees.push_back(
+        {r.entry, r.def ? static_cast<uint32_t>(r.def->id) : 0, r.native});
+  }
+}
+
+inline uint64_t Bytecode::fingerprint() const {
+  uint64_t h = 14695981039346656037ull; // FNV-1a
+  auto mix = [&](uint64_t v) {
+    for (auto i = 0; i < 8; i++) {
+      h = (h ^ ((v >> (8 * i)) & 0xff)) * 1099511628211ull;
+    }
+  };
+  auto mix_str = [&](const std::string &str) {
+    mix(str.size());
+    for (auto ch : str) {
+      mix(static_cast<unsigned char>(ch));
+    }
+  };
+  auto mix_set = [&](const std::bitset<256> &set) {
+    for (size_t i = 0; i < 256; i++) {
+      if (set.test(i)) { mix(i); }
+    }
+  };
+
+  for (const auto &in : code) {
+    mix(static_cast<uint64_t>(in.op));
+    mix(in.arg);
+    mix(in.target);
+  }
+  for (const auto &set : sets) {
+    mix_set(set);
+  }
+  for (const auto &span : spans) {
+    mix_set(span.set.bits());
+    mix(span.min);
+    mix(span.max);
+  }
+  for (auto lit : literals) {
+    mix_str(lit->lit_);
+    mix(lit->ignore_case_);
+  }
+  mix(opes.size());
+  for (const auto &r : rules) {
+    mix_str(r.def ? r.def->name : std::string());
+    mix(r.entry);
+  }
+  return h;
+}
+
+// Emits the C++ source of `peglint --emit-cpp`: one function per lowered rule
+// whose body is that rule's bytecode compiled, with sets and literals inlined
+// and Call turned into a direct call. The backtrack entries of a rule are
+// known statically (its code comes from an operator tree), so every failure
+// is a jump to the alternative of the innermost entry and no stack is kept.
+struct BytecodeToCpp {
+  BytecodeToCpp(const Bytecode &bc) : bc_(bc) {}
+
+  std::string emit(const std::string &ns, std::string_view grammar) {
+    std::string body;
+    std::string decls;
+    for (size_t i = 0; i < bc_.rules.size(); i++) {
+      if (!bc_.rules[i].entry) { continue; }
+      decls += "inline size_t " + name(i) +
+               "(peg::BytecodeVM &vm, const char *s, const char *e);\n";
+      body += "\n" + rule(i);
+    }
+
+    std::string out;
+    out += "// Generated by peglint --emit-cpp. Do not edit.\n"
+           "//\n"
+           "// Usage:\n"
+           "//   peg::parser pg(" +
+           ns +
+           "::grammar);\n"
+           "//   " +
+           ns +
+           "::compile(pg); // false if peglib lowers the grammar differently\n"
+           "\n"
+           "#pragma once\n"
+           "\n"
+           "#include <peglib.h>\n"
+           "\n"
+           "namespace " +
+           ns + " {\n\n";
+    if (!grammar.empty()) {
+      out += "inline constexpr char grammar[] =";
+      size_t pos = 0;
+      while (pos < grammar.size()) {
+        auto eol = grammar.find('\n', pos);
+        auto end = eol == std::string_view::npos ? grammar.size() : eol + 1;
+        out += "\n    " + quote(grammar.substr(pos, end - pos));
+        pos = end;
+      }
+      out += ";\n\n";
+    }
+    out += "inline bool in_set(const uint64_t *set, unsigned char ch) {\n"
+           "  return (set[ch >> 6] >> (ch & 63)) & 1;\n"
+           "}\n\n";
+    out += tables_;
+    out += "\n" + decls + body;
+
+    out += "\ninline const peg::NativeRules &native_rules() {\n"
+           "  static const peg::NativeRules rules{\n      " +
+           hex(bc_.fingerprint()) + ",\n      {";
+    for (size_t i = 0; i < bc_.rules.size(); i++) {
+      out += (i ? ", " : "") +
+             (bc_.rules[i].entry ? name(i) : std::string("nullptr"));
+    }
+    out += "}};\n"
+           "  return rules;\n"
+           "}\n\n"
+           "inline bool compile(peg::parser &pg) {\n"
+           "  return pg.compile(native_rules());\n"
+           "}\n\n"
+           "} // namespace " +
+           ns + "\n";
+    return out;
+  }
+
+private:
+  struct State {
+    std::vector<uint32_t> choices; // pcs of the open Choice instructions
+    size_t tb = 0;                 // token boundaries opened by the rule
+    bool operator==(const State &rhs) const {
+      return choices == rhs.choices && tb == rhs.tb;
+    }
+  };
+
+  std::string rule(size_t i) {
+    states_.clear();
+    choice_tb_.clear();
+    reached_.clear();
+    uses_c_ = uses_e_ = has_tb_ = goto_fail_ = false;
+
+    // Settle the backtrack entries open at each instruction.
+    std::vector<uint32_t> work{bc_.rules[i].entry};
+    states_[bc_.rules[i].entry] = State();
+    auto reach = [&](uint32_t pc, const State &st) {
+      auto it = states_.find(pc);
+      if (it == states_.end()) {
+        states_[pc] = st;
+        work.push_back(pc);
+      } else if (!(it->second == st)) {
+        throw std::logic_error("bytecode_to_cpp: unstructured bytecode");
+      }
+    };
+    while (!work.empty()) {
+      auto pc = work.back();
+      work.pop_back();
+      auto st = states_[pc];
+      const auto &in = bc_.code[pc];
+      switch (in.op) {
+      case OpCode::Choice: {
+        choice_tb_[pc] = st.tb;
+        reach(in.target, st);
+        st.choices.push_back(pc);
+        reach(pc + 1, st);
+        break;
+      }
+      case OpCode::Commit:
+      case OpCode::BackCommit:
+        st.choices.pop_back();
+        reach(in.target, st);
+        break;
+      case OpCode::PartialCommit:
+      case OpCode::Jump:
+        reach(in.target, st);
+        break;
+      case OpCode::TestSet:
+        reach(in.target, st);
+        reach(pc + 1, st);
+        break;
+      case OpCode::TokenBegin:
+        has_tb_ = true;
+        st.tb++;
+        reach(pc + 1, st);
+        break;
+      case OpCode::TokenEnd:
+        st.tb--;
+        reach(pc + 1, st);
+        break;
+      case OpCode::FailTwice:
+      case OpCode::Fail:
+      case OpCode::Return: break;
+      case OpCode::End:
+        throw std::logic_error("bytecode_to_cpp: End inside a rule");
+      default: reach(pc + 1, st); break;
+      }
+    }
+
+    // The first round finds the backtrack entries a failure can reach and
+    // the labels that are jumped to; the second emits only those.
+    std::string code;
+    for (auto round = 0; round < 2; round++) {
+      used_ = std::move(reached_);
+      reached_.clear();
+      jumps_.clear();
+      goto_fail_ = false;
+      code.clear();
+      for (const auto &[pc, st] : states_) {
+        code += instruction(pc, st);
+      }
+      scan(code);
+      for (const auto &[pc, tb] : choice_tb_) {
+        if (!reached_.count(pc)) { continue; }
+        code += "B" + std::to_string(pc) + ":\n  p = b" +
+                std::to_string(pc) + ";\n";
+        if (has_tb_) { code += restore_tb(tb); }
+        code += "  " + jump(bc_.code[pc].target) + "\n";
+        jumps_.insert(bc_.code[pc].target);
+      }
+    }
+
+    std::string out;
+    const auto &r = bc_.rules[i];
+    out += "// " + (r.def ? r.def->name : std::string("%whitespace body")) +
+           "\n";
+    out += "inline size_t " + name(i) +
+           "(peg::BytecodeVM &vm, const char *s, const char *e) {\n";
+    if (uses_c_ || has_tb_) { out += "  auto &c = vm.context();\n"; }
+    if (has_tb_) { out += "  const auto tb = c.in_token_boundary_count;\n"; }
+    if (!uses_c_ && !has_tb_ && code.find("vm.") == std::string::npos) {
+      out += "  static_cast<void>(vm);\n";
+    }
+    if (!uses_e_) { out += "  static_cast<void>(e);\n"; }
+    out += "  auto p = s;\n";
+    for (auto pc : used_) {
+      out += "  const char *b" + std::to_string(pc) + " = nullptr;\n";
+    }
+
+    // Labels go in front of the instructions jumped to.
+    std::string labelled;
+    size_t pos = 0;
+    while (pos < code.size()) {
+      auto eol = code.find('\n', pos) + 1;
+      auto line = std::string_view(code).substr(pos, eol - pos);
+      if (line.rfind("@", 0) == 0) {
+        auto pc = std::stoul(std::string(line.substr(1)));
+        if (jumps_.count(static_cast<uint32_t>(pc))) {
+          labelled += "L" + std::to_string(pc) + ":\n";
+        }
+      } else {
+        labelled += line;
+      }
+      pos = eol;
+    }
+    out += "\n" + labelled;
+
+    if (goto_fail_) {
+      out += "fail:\n";
+      if (has_tb_) { out += "  c.in_token_boundary_count = tb;\n"; }
+      out += "  return static_cast<size_t>(-1);\n";
+    }
+    out += "}\n";
+    return out;
+  }
+
+  std::string instruction(uint32_t pc, const State &st) {
+    const auto &in = bc_.code[pc];
+    auto F = fail_to(st.choices);
+    auto P = std::string("static_cast<unsigned char>(*p)");
+    auto out = "@" + std::to_string(pc) + "\n"; // label placeholder
+    switch (in.op) {
+    case OpCode::End: break;
+
+    case OpCode::Char:
+      uses_e_ = true;
+      out += "  if (p == e || " + P + " != " + byte(in.arg) + ") { " + F +
+             " }\n  p++;\n";
+      break;
+
+    case OpCode::Any:
+      uses_e_ = true;
+      out += "  {\n"
+             "    auto len = peg::codepoint_length(p, "
+             "static_cast<size_t>(e - p));\n"
+             "    if (len < 1) { " +
+             F +
+             " }\n"
+             "    p += len;\n"
+             "  }\n";
+      break;
+
+    case OpCode::Set:
+      uses_e_ = true;
+      out += "  if (p == e || !(" + test(bc_.sets[in.arg], P, "set", in.arg) +
+             ")) { " + F + " }\n  p++;\n";
+      break;
+
+    case OpCode::Span: {
+      uses_e_ = true;
+      const auto &span = bc_.spans[in.arg];
+      auto limit = std::string("static_cast<size_t>(e - p)");
+      if (span.max != static_cast<size_t>(-1)) {
+        limit = "std::min<size_t>(" + limit + ", " +
+                std::to_string(span.max) + ")";
+      }
+      out += "  {\n"
+             "    auto limit = " +
+             limit +
+             ";\n"
+             "    size_t i = 0;\n"
+             "    while (i < limit && " +
+             test(span.set.bits(), "static_cast<unsigned char>(p[i])", "span",
+                  in.arg) +
+             ") {\n"
+             "      i++;\n"
+             "    }\n";
+      if (span.min) {
+        out += "    if (i < " + std::to_string(span.min) + ") { " + F + " }\n";
+      }
+      out += "    p += i;\n"
+             "  }\n";
+      break;
+    }
+
+    case OpCode::Literal: {
+      uses_e_ = true;
+      const auto &ope = *bc_.literals[in.arg];
+      auto len = ope.lit_.size();
+      auto L = std::to_string(len);
+      if (ope.ignore_case_) {
+        uses_c_ = true;
+        out += "  if (static_cast<size_t>(e - p) < " + L;
+        for (size_t i = 0; i < len; i++) {
+          out += " ||\n      c.tolower_table[static_cast<unsigned char>(p[" +
+                 std::to_string(i) + "])] != " +
+                 byte(static_cast<unsigned char>(ope.lower_lit_[i]));
+        }
+        out += ") {\n    " + F + "\n  }\n";
+      } else if (len == 1) {
+        out += "  if (p == e || " + P + " != " +
+               byte(static_cast<unsigned char>(ope.lit_[0])) + ") { " + F +
+               " }\n";
+      } else if (len) {
+        out += "  if (static_cast<size_t>(e - p) < " + L +
+               " ||\n      std::memcmp(p, " + quote(ope.lit_) + ", " + L +
+               ") != 0) {\n    " + F + "\n  }\n";
+      }
+      out += "  {\n"
+             "    auto len = vm.after_literal(" +
+             std::to_string(in.arg) + ", p + " + L +
+             ", e);\n"
+             "    if (peg::fail(len)) { " +
+             F +
+             " }\n"
+             "    p += " +
+             L +
+             " + len;\n"
+             "  }\n";
+      break;
+    }
+
+    case OpCode::Tree:
+      uses_e_ = true;
+      out += "  {\n"
+             "    auto len = vm.tree(" +
+             std::to_string(in.arg) +
+             ", p, e);\n"
+             "    if (peg::fail(len)) { " +
+             F +
+             " }\n"
+             "    p += len;\n"
+             "  }\n";
+      break;
+
+    case OpCode::TestSet: {
+      uses_e_ = true;
+      const auto &set = bc_.sets[in.arg];
+      auto L = jump(in.target);
+      if (set.count() <= kMaxSwitchCases) {
+        out += "  if (p != e) {\n"
+               "    switch (" +
+               P + ") {\n";
+        for (size_t ch = 0; ch < 256; ch++) {
+          if (set.test(ch)) { out += "    case " + byte(ch) + ":\n"; }
+        }
+        out += "      break;\n"
+               "    default: " +
+               L +
+               "\n"
+               "    }\n"
+               "  }\n";
+      } else {
+        out += "  if (p != e && !(" + test(set, P, "set", in.arg) + ")) { " +
+               L + " }\n";
+      }
+      break;
+    }
+
+    case OpCode::Choice:
+      if (used_.count(pc)) { out += "  b" + std::to_string(pc) + " = p;\n"; }
+      break;
+
+    case OpCode::Commit:
+      if (in.target != next(pc)) { out += "  " + jump(in.target) + "\n"; }
+      break;
+
+    case OpCode::PartialCommit:
+      if (used_.count(st.choices.back())) {
+        out += "  b" + std::to_string(st.choices.back()) + " = p;\n";
+      }
+      out += "  " + jump(in.target) + "\n";
+      break;
+
+    case OpCode::BackCommit: {
+      auto k = st.choices.back();
+      reached_.insert(k);
+      out += "  p = b" + std::to_string(k) + ";\n";
+      if (has_tb_) { out += restore_tb(choice_tb_[k]); }
+      out += "  " + jump(in.target) + "\n";
+      break;
+    }
+
+    case OpCode::FailTwice: {
+      auto rest = st.choices;
+      rest.pop_back();
+      out += "  " + fail_to(rest) + "\n";
+      break;
+    }
+
+    case OpCode::Fail: out += "  " + F + "\n"; break;
+
+    case OpCode::Jump:
+      if (in.target != next(pc)) { out += "  " + jump(in.target) + "\n"; }
+      break;
+
+    case OpCode::Call:
+      uses_e_ = true;
+      out += "  {\n"
+             "    auto len = vm.call<" +
+             name(in.arg) + ">(" + std::to_string(in.arg) +
+             ", p, e);\n"
+             "    if (peg::fail(len)) { " +
+             F +
+             " }\n"
+             "    p += len;\n"
+             "  }\n";
+      break;
+
+    case OpCode::Return: out += "  return static_cast<size_t>(p - s);\n"; break;
+
+    case OpCode::TokenBegin: out += "  c.in_token_boundary_count++;\n"; break;
+
+    case OpCode::TokenEnd:
+      uses_e_ = true;
+      out += "  c.in_token_boundary_count--;\n"
+             "  {\n"
+             "    auto len = vm.skip_whitespace(p, e);\n"
+             "    if (peg::fail(len)) { " +
+             F +
+             " }\n"
+             "    p += len;\n"
+             "  }\n";
+      break;
+    }
+    return out;
+  }
+
+  static std::string fail_to(const std::vector<uint32_t> &choices) {
+    if (choices.empty()) { return "goto fail;"; }
+    return "goto B" + std::to_string(choices.back()) + ";";
+  }
+
+  static std::string jump(uint32_t target) {
+    return "goto L" + std::to_string(target) + ";";
+  }
+
+  // Collect the labels and backtrack entries the emitted code jumps to.
+  void scan(const std::string &code) {
+    for (auto pos = code.find("goto "); pos != std::string::npos;
+         pos = code.find("goto ", pos + 1)) {
+      auto label = code.substr(pos + 5, code.find(';', pos) - pos - 5);
+      if (label == "fail") {
+        goto_fail_ = true;
+      } else if (label[0] == 'B') {
+        reached_.insert(static_cast<uint32_t>(std::stoul(label.substr(1))));
+      } else {
+        jumps_.insert(static_cast<uint32_t>(std::stoul(label.substr(1))));
+      }
+    }
+  }
+
+  // The instruction emitted after `pc`, which control falls through to.
+  uint32_t next(uint32_t pc) const {
+    auto it = states_.upper_bound(pc);
+    return it == states_.end() ? 0 : it->first;
+  }
+
+  static std::string restore_tb(size_t tb) {
+    return "  c.in_token_boundary_count = tb" +
+           (tb ? " + " + std::to_string(tb) : std::string()) + ";\n";
+  }
+
+  // Membership test of `ch` (an unsigned char expression): a few range
+  // comparisons, or a bit table emitted once per set.
+  std::string test(const std::bitset<256> &set, const std::string &ch,
+                   const std::string &kind, uint32_t index) {
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (size_t i = 0; i < 256; i++) {
+      if (!set.test(i)) { continue; }
+      if (!ranges.empty() && ranges.back().second + 1 == i) {
+        ranges.back().second = i;
+      } else {
+        ranges.emplace_back(i, i);
+      }
+    }
+    if (ranges.size() <= kMaxRanges) {
+      std::string out;
+      for (const auto &[lo, hi] : ranges) {
+        if (!out.empty()) { out += " || "; }
+        if (lo == hi) {
+          out += ch + " == " + byte(lo);
+        } else {
+          out += "(" + ch + " >= " + byte(lo) + " && " + ch +
+                 " <= " + byte(hi) + ")";
+        }
+      }
+      if (ranges.size() > 1) { out = "(" + out + ")"; }
+      return out.empty() ? "false" : out;
+    }
+
+    auto table = kind + std::to_string(index);
+    if (emitted_.insert(table).second) {
+      tables_ += "inline constexpr uint64_t " + table + "[4] = {";
+      for (size_t w = 0; w < 4; w++) {
+        uint64_t bits = 0;
+        for (size_t b = 0; b < 64; b++) {
+          if (set.test(w * 64 + b)) { bits |= uint64_t(1) << b; }
+        }
+        tables_ += (w ? ", " : "") + hex(bits);
+      }
+      tables_ += "};\n";
+    }
+    return "in_set(" + table + ", " + ch + ")";
+  }
+
+  std::string name(size_t i) const {
+    const auto &r = bc_.rules[i];
+    if (!r.def) { return "whitespace_body"; }
+    std::string out;
+    for (auto ch : r.def->name) {
+      auto plain = std::isalnum(static_cast<unsigned char>(ch)) || ch == '_';
+      out += plain ? ch : '_';
+    }
+    // Names that are not identifiers (%whitespace, UTF-8) get the index
+    if (out != r.def->name) { return "r" + std::to_string(i) + "_" + out; }
+    return "r_" + out;
+  }
+
+  static std::string byte(size_t ch) {
+    if (ch >= 0x20 && ch < 0x7f && ch != '\\' && ch != '\'') {
+      return std::string("'") + static_cast<char>(ch) + "'";
+    }
+    return std::to_string(ch);
+  }
+
+  static std::string hex(uint64_t v) {
+    std::string out = "0x";
+    for (auto shift = 60; shift >= 0; shift -= 4) {
+      out += "0123456789abcdef"[(v >> shift) & 0xf];
+    }
+    return out + "ull";
+  }
+
+  static std::string quote(std::string_view str) {
+    std::string out = "\"";
+    for (auto ch : str) {
+      auto uc = static_cast<unsigned char>(ch);
+      switch (ch) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      case '\r': out += "\\r"; break;
+      case '?': out += "\\?"; break; // no trigraphs
+      default:
+        if (uc < 0x20 || uc >= 0x7f) {
+          out += '\\';
+          out += static_cast<char>('0' + (uc >> 6));
+          out += static_cast<char>('0' + ((uc >> 3) & 7));
+          out += static_cast<char>('0' + (uc & 7));
+        } else {
+          out += ch;
+        }
+        break;
+      }
+    }
+    return out + "\"";
+  }
+
+  static constexpr size_t kMaxRanges = 3;
+  static constexpr size_t kMaxSwitchCases = 64;
 
-  // All conditions met — set up the fast path
-  auto kw = std::make_unique<KeywordGuardData>();
-  kw->identifier_first = first_cc->ascii_bitset();
-  kw->identifier_rest = rest_cc->ascii_bitset();
+  const Bytecode &bc_;
+  std::map<uint32_t, State> states_; // reachable pcs of the current rule
+  std::map<uint32_t, size_t> choice_tb_; // Choice pc -> open token boundaries
+  std::set<uint32_t> used_;    // Choice pcs whose entry is restored
+  std::set<uint32_t> reached_; // the same, collected by the current round
+  std::set<uint32_t> jumps_;
+  std::set<std::string> emitted_;
+  std::string tables_;
+  bool uses_c_ = false;
+  bool uses_e_ = false;
+  bool has_tb_ = false;
+  bool goto_fail_ = false;
+};
 
-  // Compute keyword length range for early-out in hot path
-  size_t min_len = SIZE_MAX, max_len = 0;
-  for (const auto &k : exact_keywords) {
-    min_len = std::min(min_len, k.size());
-    max_len = std::max(max_len, k.size());
+// C++ source for the rules of `bc` in namespace `ns`, embedding `grammar` as
+// `ns::grammar` when given. See BytecodeToCpp.
+inline std::string bytecode_to_cpp(const Bytecode &bc, const std::string &ns,
+                                   std::string_view grammar = {}) {
+  return BytecodeToCpp(bc).emit(ns, grammar);
+}
+
+inline BytecodeVM::BytecodeVM(const Bytecode &bc, Context &c)
+    : bc_(bc), c_(c), pure_(bc.rules.size(), true), scratch_(&c) {
+  std::vector<uint32_t> impure;
+  for (size_t i = 0; i < bc.rules.size(); i++) {
+    const auto &r = bc.rules[i];
+    if (r.opaque || (r.def && (r.def->action || r.def->enter ||
+                               r.def->leave || r.def->predicate))) {
+      pure_[i] = false;
+      impure.push_back(static_cast<uint32_t>(i));
+    }
   }
-  for (const auto &k : prefix_keywords) {
-    min_len = std::min(min_len, k.size());
-    max_len = std::max(max_len, k.size());
+  while (!impure.empty()) {
+    auto i = impure.back();
+    impure.pop_back();
+    for (auto caller : bc.rules[i].callers) {
+      if (pure_[caller]) {
+        pure_[caller] = false;
+        impure.push_back(caller);
+      }
+    }
   }
-  kw->min_keyword_len = min_len;
-  kw->max_keyword_len = max_len;
 
-  kw->exact_keywords = std::move(exact_keywords);
-  kw->prefix_keywords = std::move(prefix_keywords);
-  seq.kw_guard_ = std::move(kw);
+  auto ws = bc.whitespace_rule;
+  if (ws < bc.rules.size() && pure_[ws] &&
+      c.whitespaceOpe.get() == bc.whitespaceOpe) {
+    whitespace_entry_ = bc.rules[ws].entry;
+    whitespace_native_ = bc.rules[ws].native;
+  }
 }
 
-// Compute which rules benefit from packrat memoization.
-// A rule benefits if it's reachable from 2+ alternatives of the same
-// PrioritizedChoice (backtracking will re-visit it at the same position).
-inline void Definition::initialize_packrat_filter() const {
-  std::call_once(packrat_filter_init_, [&]() {
-    auto def_count = definition_ids_.size();
-    if (def_count == 0) { return; }
+inline size_t BytecodeVM::run(uint32_t pc, const char *s, const char *e) {
+  const auto *code = bc_.code.data();
+  const auto base_tb = c_.in_token_boundary_count;
+  auto p = s;
 
-    // Collect rule IDs that can be invoked at the *same start position* as
-    // the given Ope subtree (leftmost reachability). A packrat cache hit
-    // requires the same rule to be queried twice at the same position, and
-    // in a PEG that only happens when alternatives of a choice share a
-    // leftmost prefix — rules reachable only past a consuming element can
-    // never be re-queried by a sibling alternative.
-    struct CollectLeftmostRules : public TraversalVisitor {
-      using TraversalVisitor::visit;
-      std::vector<bool> reachable; // indexed by def_id
-      std::vector<bool>
-          visited_rules; // indexed by def_id; guards Holder cycles
+  stack_.push_back({s, nullptr, 0, kBottom, 0});
 
-      CollectLeftmostRules(size_t n)
-          : reachable(n, false), visited_rules(n, false) {}
+  // Each instruction either continues the loop or breaks out of the switch,
+  // which means the match failed.
+  for (;;) {
+    const auto &in = code[pc];
+    switch (in.op) {
+    case OpCode::End: return static_cast<size_t>(p - s);
 
-      // Collect from the position element `from` starts at: element `from`
-      // itself, plus what follows for as long as elements can match empty —
-      // only up to (and including) the first one that must consume input.
-      void collect(const std::vector<std::shared_ptr<Ope>> &opes, size_t from) {
-        for (auto i = from; i < opes.size(); i++) {
-          opes[i]->accept(*this);
-          ComputeCanBeEmpty empty_vis;
-          opes[i]->accept(empty_vis);
-          if (!empty_vis.result) { break; }
-        }
+    case OpCode::Char:
+      if (p == e || static_cast<unsigned char>(*p) != in.arg) { break; }
+      p++;
+      pc++;
+      continue;
+
+    case OpCode::Any: {
+      auto len = codepoint_length(p, static_cast<size_t>(e - p));
+      if (len < 1) { break; }
+      p += len;
+      pc++;
+      continue;
+    }
+
+    case OpCode::Set:
+      if (p == e || !bc_.sets[in.arg].test(static_cast<unsigned char>(*p))) {
+        break;
       }
+      p++;
+      pc++;
+      continue;
 
-      void visit(Sequence &ope) override { collect(ope.opes_, 0); }
-      void visit(Holder &ope) override {
-        auto id = ope.outer_->id;
-        if (id < reachable.size()) {
-          reachable[id] = true;
+    case OpCode::Span: {
+      const auto &span = bc_.spans[in.arg];
+      auto i = span.set.span(p, std::min(static_cast<size_t>(e - p), span.max));
+      if (i < span.min) { break; }
+      p += i;
+      pc++;
+      continue;
+    }
 
-          // Grammars built directly via the combinator API embed rules through
-          // WeakHolder rather than Reference, so a recursive rule forms a
-          // Holder cycle with no Reference to break it. Guard re-entry to avoid
-          // infinite recursion (reachability is monotone, so revisiting a rule
-          // we have already traversed adds nothing).
-          if (visited_rules[id]) { return; }
-          visited_rules[id] = true;
+    case OpCode::Literal: {
+      const auto &text = bc_.texts[in.arg];
+      const auto lit = bc_.chars.data() + text.offset;
+      size_t len = text.size;
+      if (static_cast<size_t>(e - p) < len) { break; }
+      if (text.ignore_case) {
+        size_t i = 0;
+        while (i < len && static_cast<char>(c_.tolower_table[static_cast<
+                              unsigned char>(p[i])]) == lit[i]) {
+          i++;
         }
-        ope.ope_->accept(*this);
+        if (i < len) { break; }
+      } else if (len && std::memcmp(p, lit, len) != 0) {
+        break;
       }
-      void visit(Reference &ope) override {
-        if (ope.rule_ && ope.rule_->id < reachable.size() &&
-            !reachable[ope.rule_->id]) {
-          reachable[ope.rule_->id] = true;
-          ope.rule_->accept(*this);
+      if (c_.wordOpe) {
+        const auto &ope = *bc_.literals[in.arg];
+        if (!match_word_boundary(p + len, static_cast<size_t>(e - p) - len,
+                                 c_, ope.lit_, ope.init_is_word_,
+                                 ope.is_word_)) {
+          break;
         }
       }
-    };
+      auto wl = skip_whitespace(p + len, e);
+      if (fail(wl)) { break; }
+      p += len + wl;
+      pc++;
+      continue;
+    }
 
-    // Find rules that benefit: queried by 2+ alternatives of the same choice
-    // at the same position
-    std::vector<bool> benefits(def_count, false);
+    case OpCode::Tree: {
+      auto len = tree(in.arg, p, e);
+      if (fail(len)) { break; }
+      p += len;
+      pc++;
+      continue;
+    }
 
-    struct FindBacktrackRules : public TraversalVisitor {
-      using TraversalVisitor::visit;
-      std::vector<bool> &benefits;
-      size_t def_count;
-      std::vector<bool> visited_rules; // indexed by def_id
+    case OpCode::TestSet:
+      if (p != e && !bc_.sets[in.arg].test(static_cast<unsigned char>(*p))) {
+        pc = in.target;
+      } else {
+        pc++;
+      }
+      continue;
 
-      FindBacktrackRules(std::vector<bool> &b, size_t n)
-          : benefits(b), def_count(n), visited_rules(n, false) {}
+    case OpCode::Choice:
+      stack_.push_back({p, nullptr, in.target, kChoice,
+                        c_.in_token_boundary_count});
+      pc++;
+      continue;
 
-      using Elements = std::vector<std::shared_ptr<Ope>>;
+    case OpCode::Commit:
+      stack_.pop_back();
+      pc = in.target;
+      continue;
 
-      // An alternative's top-level elements, so a shared prefix can be walked
-      // element by element. By value: this runs once per grammar.
-      static Elements elements_of(const std::shared_ptr<Ope> &alt) {
-        if (auto *seq = dynamic_cast<Sequence *>(alt.get())) {
-          return seq->opes_;
-        }
-        return {alt};
-      }
+    case OpCode::PartialCommit:
+      stack_.back().p = p;
+      pc = in.target;
+      continue;
 
-      // `group` holds alternatives that agree on their first `k` elements, so
-      // every one of them reaches element k at the same input position — that
-      // is exactly when a packrat cache entry can hit. k == 0 is the plain
-      // "alternatives of one choice" case; deeper k is what a shared prefix
-      // like `'(' _ PATTERN _ ',' _` hides.
-      void mark_aligned(const std::vector<Elements> &group, size_t k) {
-        if (group.size() < 2) { return; }
+    case OpCode::BackCommit:
+      p = stack_.back().p;
+      c_.in_token_boundary_count = stack_.back().tb;
+      stack_.pop_back();
+      pc = in.target;
+      continue;
 
-        std::vector<std::vector<bool>> reachable;
-        reachable.reserve(group.size());
-        for (const auto &seq : group) {
-          CollectLeftmostRules clr(def_count);
-          clr.collect(seq, k);
-          reachable.push_back(std::move(clr.reachable));
-        }
-        for (size_t id = 0; id < def_count; id++) {
-          size_t count = 0;
-          for (const auto &alt : reachable) {
-            if (alt[id]) { count++; }
+    case OpCode::FailTwice: stack_.pop_back(); break;
+
+    case OpCode::Fail: break;
+
+    case OpCode::Jump: pc = in.target; continue;
+
+    case OpCode::Call: {
+      const auto &callee = bc_.callees[in.arg];
+      if (auto fn = callee.native) {
+        auto len = c_.enablePackratParsing ? call_memo(in.arg, fn, p, e)
+                                           : fn(*this, p, e);
+        if (fail(len)) { break; }
+        p += len;
+        pc++;
+        continue;
+      }
+
+      // Same memo and re-entry guard as Context::packrat
+      Frame f{p, nullptr, pc + 1, in.arg, 0};
+      if (c_.enablePackratParsing) {
+        auto def_id = callee.def_id;
+        auto stats = c_.packrat_stats && def_id < c_.packrat_stats->size()
+                         ? &(*c_.packrat_stats)[def_id]
+                         : nullptr;
+        auto slot = c_.cache_slot(def_id);
+        if (slot < 0) {
+          if (c_.active_pos[def_id] == p) {
+            if (stats) { stats->hits++; }
+            break;
           }
-          if (count >= 2) { benefits[id] = true; }
-        }
-
-        // Only alternatives that also agree on element k stay aligned past it.
-        std::map<std::string, std::vector<Elements>> aligned;
-        for (const auto &seq : group) {
-          if (k < seq.size()) {
-            aligned[OpeSignature::get(*seq[k])].push_back(seq);
+          f.save = c_.active_pos[def_id];
+          c_.active_pos[def_id] = p;
+        } else {
+          auto idx = c_.packrat_cached_count * static_cast<size_t>(p - c_.s) +
+                     static_cast<size_t>(slot);
+          if (c_.cache_registered[idx]) {
+            if (stats) { stats->hits++; }
+            if (!c_.cache_success[idx]) { break; }
+            p += c_.cache_len[idx];
+            pc++;
+            continue;
           }
+          c_.cache_registered[idx] = true;
+          c_.cache_success[idx] = false;
         }
-        for (const auto &[sig, sub] : aligned) {
-          mark_aligned(sub, k + 1);
-        }
+        if (stats) { stats->misses++; }
       }
+      stack_.push_back(f);
+      pc = callee.entry;
+      continue;
+    }
 
-      void visit(PrioritizedChoice &ope) override {
-        std::vector<Elements> group;
-        group.reserve(ope.opes_.size());
-        for (const auto &op : ope.opes_) {
-          group.push_back(elements_of(op));
-        }
-        mark_aligned(group, 0);
+    case OpCode::Return: {
+      auto f = stack_.back();
+      stack_.pop_back();
+      if (f.rule != kBottom) { leave_rule(f, static_cast<size_t>(p - f.p)); }
+      pc = f.pc;
+      continue;
+    }
 
-        // Recurse into alternatives
-        for (auto &op : ope.opes_) {
-          op->accept(*this);
-        }
-      }
-      void visit(Holder &ope) override {
-        auto id = ope.outer_->id;
-        if (id < visited_rules.size() && !visited_rules[id]) {
-          visited_rules[id] = true;
-          ope.ope_->accept(*this);
-        }
-      }
-      void visit(Reference &ope) override {
-        if (ope.rule_) { ope.rule_->accept(*this); }
-      }
-    };
+    case OpCode::TokenBegin:
+      c_.in_token_boundary_count++;
+      pc++;
+      continue;
 
-    FindBacktrackRules finder(benefits, def_count);
-    holder_->accept(finder);
-    if (whitespaceOpe) { whitespaceOpe->accept(finder); }
-    if (wordOpe) { wordOpe->accept(finder); }
+    case OpCode::TokenEnd: {
+      c_.in_token_boundary_count--;
+      auto wl = skip_whitespace(p, e);
+      if (fail(wl)) { break; }
+      p += wl;
+      pc++;
+      continue;
+    }
+    }
 
-    // Left-recursive rules read and write the packrat cache directly during
-    // seed-growing, so they must stay in the cached set. Macros are the
-    // exception: they use lr_memo only, keyed by instantiation.
-    for (const auto &[ptr, id] : definition_ids_) {
-      auto *def = static_cast<Definition *>(ptr);
-      if (def->is_left_recursive && !def->is_macro && id < def_count) {
-        benefits[id] = true;
+    // Failure: unwind to the newest backtrack entry. Rule frames passed on
+    // the way failed at their start position.
+    for (;;) {
+      auto f = stack_.back();
+      stack_.pop_back();
+      if (f.rule == kChoice) {
+        p = f.p;
+        c_.in_token_boundary_count = f.tb;
+        pc = f.pc;
+        break;
+      }
+      if (f.rule == kBottom) {
+        c_.in_token_boundary_count = base_tb;
+        return static_cast<size_t>(-1);
       }
+      leave_rule(f, static_cast<size_t>(-1));
     }
+  }
+}
 
-    // Compact index: def_id -> slot in the cache tables (-1 = guard only)
-    packrat_index_.assign(def_count, -1);
-    int32_t k = 0;
-    for (size_t id = 0; id < def_count; id++) {
-      if (benefits[id]) { packrat_index_[id] = k++; }
-    }
-    packrat_cached_count_ = static_cast<size_t>(k);
-  });
+inline size_t BytecodeVM::skip_whitespace(const char *p, const char *e) {
+  if (c_.in_token_boundary_count || !c_.whitespaceOpe) { return 0; }
+  if (c_.whitespace_scanner) {
+    return c_.whitespace_scanner->scan(p, static_cast<size_t>(e - p));
+  }
+  if (!whitespace_entry_) {
+    auto len = c_.skip_whitespace(p, static_cast<size_t>(e - p), scratch_,
+                                  *dt_);
+    reset_scratch();
+    return len;
+  }
+  if (c_.in_whitespace) { return 0; }
+  c_.in_whitespace = true;
+  auto len = whitespace_native_ ? whitespace_native_(*this, p, e)
+                                : run(whitespace_entry_, p, e);
+  c_.in_whitespace = false;
+  return len;
 }
 
-inline void LinkReferences::visit(Reference &ope) {
-  // Check if the reference is a macro parameter
-  auto found_param = false;
-  for (size_t i = 0; i < params_.size(); i++) {
-    const auto &param = params_[i];
-    if (param == ope.name_) {
-      ope.iarg_ = i;
-      found_param = true;
-      break;
+inline size_t BytecodeVM::after_literal(uint32_t lit, const char *p,
+                                        const char *e) {
+  if (c_.wordOpe) {
+    const auto &ope = *bc_.literals[lit];
+    if (!match_word_boundary(p, static_cast<size_t>(e - p), c_, ope.lit_,
+                             ope.init_is_word_, ope.is_word_)) {
+      return static_cast<size_t>(-1);
     }
   }
+  return skip_whitespace(p, e);
+}
 
-  // Check if the reference is a definition rule
-  if (!found_param && grammar_.count(ope.name_)) {
-    auto &rule = grammar_.at(ope.name_);
-    ope.rule_ = &rule;
+inline size_t BytecodeVM::tree(uint32_t ope, const char *p, const char *e) {
+  auto len =
+      bc_.opes[ope]->parse(p, static_cast<size_t>(e - p), scratch_, c_, *dt_);
+  reset_scratch();
+  return len;
+}
+
+// Call instruction of generated code with packrat on: the memo and
+// re-entry guard of the Call case in run().
+inline size_t BytecodeVM::call_memo(uint32_t rule, NativeRule fn,
+                                    const char *p, const char *e) {
+  auto def_id = bc_.callees[rule].def_id;
+  auto stats = c_.packrat_stats && def_id < c_.packrat_stats->size()
+                   ? &(*c_.packrat_stats)[def_id]
+                   : nullptr;
+  auto slot = c_.cache_slot(def_id);
+  if (slot < 0) {
+    if (c_.active_pos[def_id] == p) {
+      if (stats) { stats->hits++; }
+      return static_cast<size_t>(-1);
+    }
+    if (stats) { stats->misses++; }
+    auto save = c_.active_pos[def_id];
+    c_.active_pos[def_id] = p;
+    auto len = fn(*this, p, e);
+    c_.active_pos[def_id] = save;
+    return len;
   }
 
-  for (const auto &arg : ope.args_) {
-    arg->accept(*this);
+  auto idx = c_.packrat_cached_count * static_cast<size_t>(p - c_.s) +
+             static_cast<size_t>(slot);
+  if (c_.cache_registered[idx]) {
+    if (stats) { stats->hits++; }
+    return c_.cache_success[idx] ? c_.cache_len[idx]
+                                 : static_cast<size_t>(-1);
   }
+  c_.cache_registered[idx] = true;
+  c_.cache_success[idx] = false;
+  if (stats) { stats->misses++; }
+  auto len = fn(*this, p, e);
+  if (success(len)) { c_.write_packrat_cache(p, def_id, len, std::any()); }
+  return len;
 }
 
-inline void FindReference::visit(Reference &ope) {
-  for (size_t i = 0; i < args_.size(); i++) {
-    const auto &name = params_[i];
-    if (name == ope.name_) {
-      found_ope = args_[i];
-      return;
-    }
+inline void BytecodeVM::leave_rule(const Frame &f, size_t len) {
+  if (!c_.enablePackratParsing) { return; }
+  auto def_id = bc_.callees[f.rule].def_id;
+  if (c_.cache_slot(def_id) < 0) {
+    c_.active_pos[def_id] = f.save;
+  } else if (success(len)) {
+    c_.write_packrat_cache(f.p, def_id, len, std::any());
   }
-  found_ope = ope.shared_from_this();
+}
+
+inline void BytecodeVM::reset_scratch() {
+  if (!scratch_.empty()) { scratch_.clear(); }
+  if (!scratch_.tags.empty()) { scratch_.tags.clear(); }
+  if (!scratch_.tokens.empty()) { scratch_.tokens.clear(); }
+}
+
+inline Definition::Result Definition::parse_compiled(const char *s, size_t n,
+                                                     SemanticValues &vs,
+                                                     Context &c,
+                                                     std::any &dt) const {
+  BytecodeVM vm(*bytecode, c);
+  c.vm = &vm;
+  auto se = scope_exit([&]() { c.vm = nullptr; });
+  return parse_input(s, n, vs, c, dt);
 }
 
 /*-----------------------------------------------------------------------------
@@ -5037,15 +9302,9 @@ struct GrammarBlob {
     } else if (auto x = dynamic_cast<Dictionary *>(p)) {
       w.u8(T_Dictionary);
       w.u8(x->trie_.ignore_case_ ? 1 : 0);
-      // Recover words in their original choice-index order. The Trie stores
-      // each full word's id (its index in the constructor vector), which
-      // parse_core reports as vs.choice(). Iterating dic_ directly yields
-      // sorted key order and would renumber the choices, so place each word at
-      // its id.
-      std::vector<std::string> words(x->trie_.items_count());
-      for (auto &kv : x->trie_.dic_)
-        if (kv.second.match && kv.second.id < words.size())
-          words[kv.second.id] = kv.first;
+      // The words in their original choice-index order (the id parse_core
+      // reports as vs.choice()), so the choices are not renumbered.
+      const auto &words = x->trie_.items();
       w.u32((uint32_t)words.size());
       for (auto &s : words)
         w.str(s);
@@ -5229,20 +9488,16 @@ struct GrammarBlob {
       auto atom = read_ope(r, g, owner);
       auto binop = read_ope(r, g, owner);
       uint32_t n = r.u32();
-      auto pc = std::make_shared<PrecedenceClimbing>(
-          atom, binop, PrecedenceClimbing::BinOpeInfo{}, *owner);
-      // info_ keys are string_views; back them with owned strings whose
-      // addresses stay stable (reserve avoids reallocation, and the node is
-      // never moved once held by shared_ptr).
-      pc->info_keys_.reserve(n);
+      // The node copies the keys, so they only need to outlive the call.
+      std::vector<std::string> keys(n);
+      PrecedenceClimbing::BinOpeInfo info;
       for (uint32_t i = 0; i < n; i++) {
-        std::string key = r.str();
+        keys[i] = r.str();
         auto level = (size_t)r.u64();
         auto assoc = (char)r.u8();
-        pc->info_keys_.push_back(std::move(key));
-        pc->info_[pc->info_keys_.back()] = std::pair(level, assoc);
+        info[keys[i]] = std::pair(level, assoc);
       }
-      return pc;
+      return std::make_shared<PrecedenceClimbing>(atom, binop, info, *owner);
     }
     default: throw std::runtime_error("GrammarBlob: bad operator tag");
     }
@@ -5343,15 +9598,10 @@ struct GrammarBlob {
         pc->binop_->accept(vis);
       }
     }
-    {
-      SetupFirstSets vis; // shared across rules -> O(N)
-      for (auto &x : *g)
-        x.second.accept(vis);
-    }
     // Re-derive automatic whitespace/word skipping on the start rule from the
     // %whitespace / %word definitions, exactly as ParserGenerator does. Sharing
-    // the (already linked and first-set) definition operators avoids leaving
-    // references inside the skipping ope unlinked, and keeps the blob smaller.
+    // the (already linked) definition operators avoids leaving references
+    // inside the skipping ope unlinked, and keeps the blob smaller.
     if (g->count(WHITESPACE_DEFINITION_NAME)) {
       (*g)[start_out].whitespaceOpe =
           wsp((*g)[WHITESPACE_DEFINITION_NAME].get_core_operator());
@@ -5359,6 +9609,15 @@ struct GrammarBlob {
     if (g->count(WORD_DEFINITION_NAME)) {
       (*g)[start_out].wordOpe = (*g)[WORD_DEFINITION_NAME].get_core_operator();
     }
+    instantiate_macros(*g);
+    fold_left_recursion(*g);
+    {
+      SetupFirstSets vis; // shared across rules -> O(N)
+      for (auto &x : *g)
+        x.second.accept(vis);
+      if (auto &ws = (*g)[start_out].whitespaceOpe) { ws->accept(vis); }
+    }
+    mark_inline_candidates(*g);
     return g;
   }
 };
@@ -5442,6 +9701,17 @@ private:
     std::vector<std::set<std::string_view>> captures_stack{{}};
 
     std::set<std::string_view> captures_in_current_definition;
+
+    // Capture names interned to the ids captures and back-references share
+    std::map<std::string, size_t, std::less<>> capture_ids;
+    size_t capture_id(std::string_view name) {
+      auto it = capture_ids.find(name);
+      if (it == capture_ids.end()) {
+        it = capture_ids.emplace(name, capture_ids.size()).first;
+      }
+      return it->second;
+    }
+
     bool enablePackratParsing = true;
 
     Data() : grammar(std::make_shared<Grammar>()) {}
@@ -5864,8 +10134,10 @@ private:
         data.captures_stack.back().insert(name);
         data.captures_in_current_definition.insert(name);
 
-        return cap(ope, [name](const char *a_s, size_t a_n, Context &c) {
-          c.capture_entries.emplace_back(name, std::string(a_s, a_n));
+        auto id = data.capture_id(name);
+        return cap(ope, [id, name = std::string(name)](
+                            const char *a_s, size_t a_n, Context &c) {
+          c.push_capture(id, name, std::string_view(a_s, a_n));
         });
       }
       default: {
@@ -6062,7 +10334,7 @@ private:
         data.enablePackratParsing = false;
       }
 
-      return bkr(vs.token_to_string());
+      return bkr(vs.token_to_string(), data.capture_id(vs.token()));
     };
 
     g["Ignore"] = [](const SemanticValues &vs) { return vs.size() > 0; };
@@ -6439,6 +10711,9 @@ private:
       }
     }
 
+    instantiate_macros(grammar);
+    fold_left_recursion(grammar);
+
     // Setup First-Set and ISpan optimizations. A single visitor is shared
     // across all rules so its first-set cache and visited-rule set persist:
     // each rule's first-sets are computed once (O(N)) instead of re-walking
@@ -6448,8 +10723,11 @@ private:
       for (auto &x : grammar) {
         x.second.accept(vis);
       }
+      if (start_rule.whitespaceOpe) { start_rule.whitespaceOpe->accept(vis); }
     }
 
+    mark_inline_candidates(grammar);
+
     return {data.grammar, start, data.enablePackratParsing};
   }
 
@@ -7001,6 +11279,47 @@ public:
     }
   }
 
+  // Lower the grammar into bytecode for the VM (see Bytecode). Parses then
+  // run every rule whose result nobody observes on one dispatch loop instead
+  // of the operator tree; rules with actions keep the tree, so values and
+  // callbacks are unaffected. Parses with a logger, error reporter, or
+  // tracer stay entirely on the tree. Call after the grammar is loaded;
+  // callbacks may still be attached or changed afterwards.
+  parser &compile() {
+    if (grammar_ != nullptr) { Bytecode::compile(*grammar_, start_); }
+    return *this;
+  }
+
+  // Same as compile(), attaching the rules `peglint --emit-cpp` generated for
+  // this grammar so the VM runs them as native code. Returns false, leaving
+  // plain bytecode, if they were generated from a different grammar or by a
+  // peglib that lowers it differently.
+  bool compile(const NativeRules &natives) {
+    if (grammar_ == nullptr) { return false; }
+    auto bc = Bytecode::compile(*grammar_, start_, &natives);
+    return natives.fingerprint == bc->fingerprint() &&
+           natives.rules.size() == bc->rules.size();
+  }
+
+  // Bytecode of the last compile(), or null.
+  const Bytecode *get_bytecode() const {
+    return grammar_ != nullptr ? (*grammar_)[start_].bytecode.get() : nullptr;
+  }
+
+  // Rules whose references may parse the body in place, sorted by name. These
+  // are candidates: a parse only inlines them when nothing in it observes
+  // semantic values (see mark_inline_candidates), so a parser with actions,
+  // an AST, a tracer or a logger still calls every rule.
+  std::vector<std::string> get_inline_candidates() const {
+    std::vector<std::string> rules;
+    if (grammar_ == nullptr) { return rules; }
+    for (const auto &[name, rule] : *grammar_) {
+      if (rule.is_inline_candidate) { rules.push_back(name); }
+    }
+    std::sort(rules.begin(), rules.end());
+    return rules;
+  }
+
   template <typename T = Ast> parser &enable_ast() {
     for (auto &[_, rule] : *grammar_) {
       if (!rule.action) { add_ast_action<T>(rule); }
@@ -0,0 +1,406 @@
+#include <gtest/gtest.h>
+#include <peglib.h>
+
+// Generated at build time by peglint --emit-cpp (see CMakeLists.txt)
+#include "calc_peg.h"
+#include "json_peg.h"
+
+using namespace peg;
+
+// =============================================================================
+// Bytecode VM Tests (parser::compile)
+// =============================================================================
+
+namespace {
+
+// Parse every input from rule S with the tree interpreter and with the
+// compiled grammar and require the same outcome and match length.
+void expect_same_results(const char *grammar,
+                         const std::vector<std::string> &inputs,
+                         bool packrat = false) {
+  parser tree(grammar);
+  parser vm(grammar);
+  ASSERT_TRUE(tree);
+  ASSERT_TRUE(vm);
+  if (packrat) {
+    tree.enable_packrat_parsing();
+    vm.enable_packrat_parsing();
+  }
+  vm.compile();
+
+  const auto &r1 = tree.get_grammar().at("S");
+  const auto &r2 = vm.get_grammar().at("S");
+  for (const auto &input : inputs) {
+    auto res1 = r1.parse(input.data(), input.size());
+    auto res2 = r2.parse(input.data(), input.size());
+    EXPECT_EQ(res1.ret, res2.ret) << input;
+    EXPECT_EQ(res1.len, res2.len) << input;
+  }
+}
+
+} // namespace
+
+TEST(BytecodeTest, Recognition_matches_tree) {
+  expect_same_results(R"(
+    S      <- Item (',' Item)* !.
+    Item   <- Number / Word / '(' S ')' / 'x'? 'y'{2,3}
+    Number <- [0-9]+ ('.' [0-9]+)?
+    Word   <- [a-zA-Z_] [a-zA-Z_0-9]*
+  )",
+                      {"1", "1.5,abc", "(a,(b,2))", "yy", "xyyy", "xyyyy",
+                       "1.", "", ",", "a,,b", "(a"});
+}
+
+TEST(BytecodeTest, Predicates_and_any_character) {
+  expect_same_results(R"(
+    S       <- Comment* &'end' 'end' !.
+    Comment <- '/*' (!'*/' .)* '*/'
+  )",
+                      {"end", "/* x */end", "/* é */ end", "/* x end",
+                       "/**//**/end", "/* x */endx"});
+}
+
+TEST(BytecodeTest, Whitespace_word_and_case_insensitive) {
+  expect_same_results(R"(
+    S           <- (Kw / Ident / '=')+
+    Kw          <- 'select'i / 'from'i
+    Ident       <- < [a-z]+ >
+    %whitespace <- [ \t]*
+    %word       <- [a-z]+
+  )",
+                      {"SELECT a FROM b", "select  from", "selectx = y",
+                       "Select", " x", "from=from", "a b c"});
+}
+
+TEST(BytecodeTest, Packrat_and_no_whitespace) {
+  expect_same_results(R"(
+    S           <- (Pair / Name)+
+    Pair        <- Name ':' Name
+    Name        <- [a-z]+ ('-' [a-z]+)* { no_whitespace }
+    %whitespace <- [ ]*
+  )",
+                      {"a:b c", "ab-cd : ef", "a - b", "a:", "x y z"},
+                      true);
+}
+
+TEST(BytecodeTest, Left_recursive_rule_stays_on_tree) {
+  expect_same_results(R"(
+    S    <- Expr !.
+    Expr <- Expr '+' Term / Term
+    Term <- [0-9]+
+  )",
+                      {"1", "1+2+3", "1+", "+1"});
+}
+
+TEST(BytecodeTest, Actions_see_the_same_values) {
+  auto grammar = R"(
+    Additive    <- Multitive '+' Additive / Multitive
+    Multitive   <- Primary '*' Multitive / Primary
+    Primary     <- '(' Additive ')' / Number
+    Number      <- < [0-9]+ > Digits?
+    Digits      <- [a-z]*
+    %whitespace <- [ \t]*
+  )";
+
+  auto setup = [](parser &pg, std::vector<std::string> &log) {
+    pg["Additive"] = [&log](const SemanticValues &vs) {
+      log.push_back("A" + std::to_string(vs.size()) + ":" +
+                    std::to_string(vs.choice()));
+      return vs.choice() == 0 ? std::any_cast<long>(vs[0]) +
+                                    std::any_cast<long>(vs[1])
+                              : std::any_cast<long>(vs[0]);
+    };
+    pg["Multitive"] = [](const SemanticValues &vs) {
+      return vs.choice() == 0 ? std::any_cast<long>(vs[0]) *
+                                    std::any_cast<long>(vs[1])
+                              : std::any_cast<long>(vs[0]);
+    };
+    pg["Number"] = [&log](const SemanticValues &vs) {
+      // Digits has no action: it reaches the action as an empty value.
+      log.push_back("N" + std::to_string(vs.size()) + ":" +
+                    std::string(vs.token()) +
+                    (vs.size() && !vs[0].has_value() ? ":empty" : ""));
+      return vs.token_to_number<long>();
+    };
+  };
+
+  parser tree(grammar);
+  parser vm(grammar);
+  ASSERT_TRUE(tree);
+  ASSERT_TRUE(vm);
+  vm.compile();
+
+  std::vector<std::string> log1, log2;
+  setup(tree, log1);
+  setup(vm, log2);
+
+  long v1 = 0, v2 = 0;
+  EXPECT_TRUE(tree.parse(" (1 + 2abc) * 3 + 4 ", v1));
+  EXPECT_TRUE(vm.parse(" (1 + 2abc) * 3 + 4 ", v2));
+  EXPECT_EQ(13, v1);
+  EXPECT_EQ(v1, v2);
+  EXPECT_EQ(log1, log2);
+}
+
+TEST(BytecodeTest, Precedence_operator_rule_stays_on_tree) {
+  parser pg(R"(
+    Expression <- Atom (Operator Atom)* { precedence L + - L * / }
+    Atom       <- _? Number _?
+    Number     <- [0-9]+
+    Operator   <- '+' / '-' / '*' / '/'
+    _          <- ' '+
+  )");
+  ASSERT_TRUE(pg);
+  pg.enable_packrat_parsing();
+  pg.compile();
+
+  EXPECT_TRUE(pg.parse(" 1 + 2 * 3 "));
+  EXPECT_FALSE(pg.parse(" 1 + "));
+}
+
+TEST(BytecodeTest, Ast_and_errors_are_unchanged) {
+  auto grammar = R"(
+    S    <- 'a' Tail
+    Tail <- 'b' / 'c'
+  )";
+
+  parser pg(grammar);
+  ASSERT_TRUE(pg);
+  pg.compile();
+
+  std::string msg;
+  pg.set_logger([&](size_t ln, size_t col, const std::string &m) {
+    msg = std::to_string(ln) + ":" + std::to_string(col) + ": " + m;
+  });
+  EXPECT_FALSE(pg.parse("ad"));
+  EXPECT_EQ("1:2: syntax error, unexpected 'd', expecting 'b', 'c'.", msg);
+
+  pg.enable_ast();
+  std::shared_ptr<Ast> ast;
+  ASSERT_TRUE(pg.parse("ac", ast));
+  EXPECT_EQ("+ S\n  - Tail/1 (c)\n", ast_to_s(ast));
+}
+
+TEST(BytecodeTest, Only_rules_free_of_opaque_operators_are_lowered) {
+  parser pg(R"(
+    S     <- Plain Cap Macro(Plain)
+    Plain <- 'p'
+    Cap   <- $c<'x'> $c
+    Macro(X) <- X
+  )");
+  ASSERT_TRUE(pg);
+  pg.compile();
+
+  const auto &g = pg.get_grammar();
+  ASSERT_TRUE(g.at("S").bytecode);
+  const auto &bc = *g.at("S").bytecode;
+  EXPECT_NE(0u, bc.rules[g.at("Plain").bytecode_rule].entry);
+  EXPECT_EQ(0u, bc.rules[g.at("Cap").bytecode_rule].entry);
+  EXPECT_EQ(0u, bc.rules[g.at("S").bytecode_rule].entry);
+
+  EXPECT_TRUE(pg.parse("pxxp"));
+  EXPECT_FALSE(pg.parse("pxyp"));
+}
+
+TEST(BytecodeTest, Emitted_cpp_is_deterministic) {
+  auto grammar = R"(
+    S           <- Item (',' Item)*
+    Item        <- < [a-z]+ > / 'x'i Number
+    Number      <- [0-9]+
+    %whitespace <- [ \t]*
+  )";
+
+  parser pg1(grammar);
+  parser pg2(grammar);
+  ASSERT_TRUE(pg1);
+  ASSERT_TRUE(pg2);
+  pg1.compile();
+  pg2.compile();
+  ASSERT_TRUE(pg1.get_bytecode());
+
+  auto code = bytecode_to_cpp(*pg1.get_bytecode(), "g", grammar);
+  EXPECT_EQ(code, bytecode_to_cpp(*pg2.get_bytecode(), "g", grammar));
+  EXPECT_EQ(pg1.get_bytecode()->fingerprint(),
+            pg2.get_bytecode()->fingerprint());
+
+  EXPECT_NE(std::string::npos, code.find("namespace g {"));
+  EXPECT_NE(std::string::npos, code.find("inline size_t r_Item("));
+  EXPECT_NE(std::string::npos, code.find("vm.call<r_Number>("));
+  EXPECT_NE(std::string::npos, code.find("inline bool compile("));
+}
+
+TEST(BytecodeTest, Stale_native_rules_are_not_attached) {
+  parser pg(R"(
+    S <- 'a' T
+    T <- 'b'
+  )");
+  ASSERT_TRUE(pg);
+
+  NativeRules natives;
+  natives.fingerprint = 1;
+  EXPECT_FALSE(pg.compile(natives));
+  ASSERT_TRUE(pg.get_bytecode());
+  for (const auto &r : pg.get_bytecode()->rules) {
+    EXPECT_EQ(nullptr, r.native);
+  }
+  EXPECT_TRUE(pg.parse("ab"));
+  EXPECT_FALSE(pg.parse("ac"));
+}
+
+TEST(BytecodeTest, Finalized_arrays_mirror_rules_and_literals) {
+  parser pg(R"(
+    S <- 'ab' T
+    T <- 'CD'i / 'e'
+  )");
+  ASSERT_TRUE(pg);
+  pg.compile();
+  ASSERT_TRUE(pg.get_bytecode());
+  const auto &bc = *pg.get_bytecode();
+
+  ASSERT_EQ(bc.literals.size(), bc.texts.size());
+  EXPECT_EQ(3u, bc.texts.size());
+  for (size_t i = 0; i < bc.texts.size(); i++) {
+    const auto &lit = *bc.literals[i];
+    const auto &text = bc.texts[i];
+    EXPECT_EQ(lit.ignore_case_ ? lit.lower_lit_ : lit.lit_,
+              bc.chars.substr(text.offset, text.size));
+    EXPECT_EQ(lit.ignore_case_, text.ignore_case);
+  }
+
+  ASSERT_EQ(bc.rules.size(), bc.callees.size());
+  for (size_t i = 0; i < bc.rules.size(); i++) {
+    EXPECT_EQ(bc.rules[i].entry, bc.callees[i].entry);
+    EXPECT_EQ(bc.rules[i].def->id, bc.callees[i].def_id);
+  }
+
+  EXPECT_TRUE(pg.parse("abcD"));
+  EXPECT_TRUE(pg.parse("abe"));
+  EXPECT_FALSE(pg.parse("abC"));
+}
+
+// Literals read from the finalized tables: case-insensitive ones compare
+// against their lowered bytes, and with %word each one checks the word
+// boundary after it through its LiteralString.
+TEST(BytecodeTest, Finalized_literals_fold_case_and_check_words) {
+  auto grammar = R"(
+    S    <- Stmt (';' Stmt)* !.
+    Stmt <- 'SeLeCt'i Name / 'if' Name / 'end'
+    Name <- < [a-z]+ >
+    %whitespace <- [ \t]*
+    %word       <- [a-zA-Z]+
+  )";
+  std::vector<std::string> inputs = {
+      "select a",       "SELECT a; Select b", "sElEcT  x;if y;end",
+      "selecta",        "select",             "if x",
+      "ifx",            "IF x",               "endx",
+      "end ; end",      "select a;",          "",
+  };
+  expect_same_results(grammar, inputs);
+  expect_same_results(grammar, inputs, true);
+
+  parser pg(grammar);
+  ASSERT_TRUE(pg);
+  pg.compile();
+  ASSERT_TRUE(pg.get_bytecode());
+  const auto &bc = *pg.get_bytecode();
+  auto folded = std::find_if(bc.texts.begin(), bc.texts.end(),
+                             [](const auto &text) { return text.ignore_case; });
+  ASSERT_NE(bc.texts.end(), folded);
+  EXPECT_EQ("select", bc.chars.substr(folded->offset, folded->size));
+
+  EXPECT_TRUE(pg.parse("SELECT a; Select b"));
+  EXPECT_TRUE(pg.parse("if x;end"));
+  EXPECT_FALSE(pg.parse("selecta"));
+  EXPECT_FALSE(pg.parse("ifx"));
+  EXPECT_FALSE(pg.parse("endx"));
+  EXPECT_FALSE(pg.parse("IF x"));
+}
+
+// =============================================================================
+// Ahead-of-time Parser Tests (peglint --emit-cpp)
+// =============================================================================
+
+namespace {
+
+// Parse every input with the tree interpreter and with a parser that runs the
+// generated C++: both accept `accepted` and reject `rejected`, and the rule
+// matches the same length either way.
+void expect_aot_matches_tree(const char *grammar, const char *start,
+                             bool (*compile)(parser &pg),
+                             const std::vector<std::string> &accepted,
+                             const std::vector<std::string> &rejected) {
+  parser tree(grammar);
+  parser aot(grammar);
+  ASSERT_TRUE(tree);
+  ASSERT_TRUE(aot);
+  ASSERT_TRUE(compile(aot));
+
+  const auto &r1 = tree.get_grammar().at(start);
+  const auto &r2 = aot.get_grammar().at(start);
+
+  // Every lowered rule runs the generated code, the start rule included
+  ASSERT_TRUE(aot.get_bytecode());
+  const auto &bc = *aot.get_bytecode();
+  for (const auto &r : bc.rules) {
+    if (r.entry) {
+      EXPECT_NE(nullptr, r.native) << (r.def ? r.def->name : "%whitespace");
+    }
+  }
+  EXPECT_NE(nullptr, bc.rules[r2.bytecode_rule].native);
+  auto check = [&](const std::string &input, bool ok) {
+    EXPECT_EQ(ok, tree.parse(input)) << input;
+    EXPECT_EQ(ok, aot.parse(input)) << input;
+    auto res1 = r1.parse(input.data(), input.size());
+    auto res2 = r2.parse(input.data(), input.size());
+    EXPECT_EQ(res1.ret, res2.ret) << input;
+    EXPECT_EQ(res1.len, res2.len) << input;
+  };
+  for (const auto &input : accepted) {
+    check(input, true);
+  }
+  for (const auto &input : rejected) {
+    check(input, false);
+  }
+}
+
+} // namespace
+
+TEST(AotTest, Generated_calc_parser_matches_tree) {
+  expect_aot_matches_tree(calc_peg::grammar, "Program", calc_peg::compile,
+                          {
+                              "",
+                              "let x = 1 + 2*3;",
+                              "LET letter = (x - -2.5) / \"s\";\n"
+                              "Print x, letter;",
+                              "print 1; print (2);",
+                          },
+                          {
+                              "let let = 1;",
+                              "letx = 1;",
+                              "print 1 +;",
+                              "print \"open;",
+                              "let x = 1",
+                              "print 1;?",
+                          });
+}
+
+TEST(AotTest, Generated_json_parser_matches_tree) {
+  expect_aot_matches_tree(
+      json_peg::grammar, "json", json_peg::compile,
+      {
+          "{}",
+          "[ ]",
+          "{\"a\": [1, -2.5e3, true, false, null, \"x\\n\\u00e9\"]}",
+          "[[[{\"k\": {}}]], 0.5E-2]",
+      },
+      {
+          "[01]",
+          "[1,]",
+          "{\"a\" 1}",
+          "\"s\"",
+          "[tru]",
+          "[\"\\x\"]",
+          "[-]",
+          "[1 2]",
+      });
+}
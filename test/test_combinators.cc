@@ -184,6 +184,17 @@ TEST(CombinatorTest, Bkr_back_reference) {
   EXPECT_FALSE(parser.parse("hello world goodbye"));
 }
 
+TEST(CombinatorTest, Bkr_back_reference_by_name) {
+  Definition ROOT;
+  ROOT <= seq(cap(oom(cls("a-z")),
+                  [](const char *s, size_t n, Context &c) {
+                    c.push_capture("tag", std::string_view(s, n));
+                  }),
+              chr('='), bkr("tag"));
+  EXPECT_TRUE(def_parse(ROOT, "abc=abc"));
+  EXPECT_FALSE(def_parse(ROOT, "abc=abd"));
+}
+
 // --- pre() (Precedence Climbing) ---
 
 TEST(CombinatorTest, Pre_precedence_climbing) {
@@ -274,3 +285,94 @@ TEST(CombinatorTest, Packrat_on_recursive_combinator_grammar) {
   EXPECT_TRUE(def_parse(EXPR, "x"));
   EXPECT_FALSE(def_parse(EXPR, "x+"));
 }
+
+// --- compile-time combinators (peg::ct) ---
+
+namespace {
+
+constexpr char kDigit[] = "0-9";
+constexpr char kAlpha[] = "a-zA-Z_";
+constexpr char kAlnum[] = "a-zA-Z_0-9";
+constexpr char kQuote[] = "\"";
+constexpr char kTrue[] = "true";
+constexpr char kNull[] = "null";
+
+struct CtNumber : ct::oom<ct::cls<kDigit>> {};
+struct CtList;
+struct CtValue
+    : ct::cho<CtNumber, ct::lit<kTrue>, ct::liti<kNull>, CtList> {};
+struct CtList : ct::seq<ct::chr<'('>, ct::opt<CtValue>,
+                        ct::zom<ct::seq<ct::chr<','>, CtValue>>,
+                        ct::chr<')'>> {};
+
+size_t ct_match_str(size_t (*match)(const char *, size_t, SemanticValues *),
+                    const char *s) {
+  return match(s, strlen(s), nullptr);
+}
+
+} // namespace
+
+TEST(CombinatorTest, Ct_sequence_choice_and_recursion) {
+  EXPECT_EQ(3u, ct_match_str(CtValue::match, "123"));
+  EXPECT_EQ(4u, ct_match_str(CtValue::match, "true"));
+  EXPECT_EQ(4u, ct_match_str(CtValue::match, "NuLL"));
+  EXPECT_EQ(15u, ct_match_str(CtValue::match, "(1,(true,()),2)"));
+  EXPECT_TRUE(fail(ct_match_str(CtValue::match, "(1,")));
+  EXPECT_TRUE(fail(ct_match_str(CtValue::match, "x")));
+}
+
+TEST(CombinatorTest, Ct_repetition_and_predicates) {
+  using TwoToThree = ct::rep<ct::chr<'a'>, 2, 3>;
+  EXPECT_TRUE(fail(ct_match_str(TwoToThree::match, "a")));
+  EXPECT_EQ(3u, ct_match_str(TwoToThree::match, "aaaa"));
+
+  // Identifier that is not the keyword 'true'
+  using Keyword = ct::seq<ct::lit<kTrue>, ct::npd<ct::cls<kAlpha>>>;
+  using Ident = ct::seq<ct::npd<Keyword>, ct::oom<ct::cls<kAlpha>>>;
+  EXPECT_EQ(5u, ct_match_str(Ident::match, "truex"));
+  EXPECT_TRUE(fail(ct_match_str(Ident::match, "true")));
+  EXPECT_EQ(0u, ct_match_str(ct::apd<ct::lit<kTrue>>::match, "true"));
+}
+
+TEST(CombinatorTest, Ct_classes_and_utf8) {
+  using String = ct::seq<ct::chr<'"'>, ct::zom<ct::ncls<kQuote>>, ct::chr<'"'>>;
+  EXPECT_EQ(7u, ct_match_str(String::match, "\"a\xC3\xA9 b\""));
+  EXPECT_EQ(3u, ct_match_str(ct::chr<U'あ'>::match, "\xE3\x81\x82"));
+  EXPECT_EQ(2u, ct_match_str(ct::dot::match, "\xC3\xA9"));
+  EXPECT_TRUE(fail(ct_match_str(ct::dot::match, "")));
+
+  // An invalid UTF-8 byte is not a character, so a negated class fails on
+  // it like `[^"]` does, instead of matching nothing
+  EXPECT_TRUE(fail(ct_match_str(ct::ncls<kQuote>::match, "\xFF")));
+  EXPECT_TRUE(fail(ct_match_str(String::match, "\"ab\xFF\"")));
+  using Body = ct::zom<ct::ncls<kQuote>>;
+  EXPECT_EQ(2u, ct_match_str(Body::match, "ab\xFF\""));
+
+  // A repetition stops at an iteration that consumes nothing
+  EXPECT_EQ(2u, ct_match_str(ct::zom<ct::opt<ct::chr<'a'>>>::match, "aab"));
+}
+
+TEST(CombinatorTest, Ct_grammar_as_rule_in_dynamic_grammar) {
+  using Pair = ct::seq<ct::tok<ct::oom<ct::cls<kAlpha>>>, ct::chr<'='>,
+                       ct::cho<ct::seq<ct::tok<ct::lit<kTrue>>, ct::chr<'!'>>,
+                               ct::tok<ct::oom<ct::cls<kAlnum>>>>>;
+
+  Definition PAIRS, PAIR;
+  PAIRS <= seq(PAIR, zom(seq(chr(';'), PAIR)));
+  PAIR <= ct::ope<Pair>();
+  PAIR = [](const SemanticValues &vs) {
+    return std::string(vs.token(0)) + ":" + std::string(vs.token(1));
+  };
+  PAIRS = [](const SemanticValues &vs) {
+    std::string out;
+    for (const auto &v : vs) {
+      out += std::any_cast<std::string>(v) + " ";
+    }
+    return out;
+  };
+
+  // The token pushed by the failed 'true!' alternative is dropped again.
+  std::string out;
+  EXPECT_TRUE(PAIRS.parse_and_get_value("a=1;bc=true!;d=truex", out).ret);
+  EXPECT_EQ("a:1 bc:true d:truex ", out);
+}
@@ -1443,3 +1443,36 @@ TEST(GeneralTest, InvalidRange) {
   bool ret = parser;
   EXPECT_FALSE(ret);
 }
+
+// A class-shaped %word is checked with a byte lookup; any other %word runs
+// as a rule (here forced by an action on it). Both reject the same input.
+TEST(WordCheckTest, Class_and_rule_shapes_agree) {
+  std::vector<std::string> words = {
+      "[a-z_]+",
+      "[a-z_] [a-z0-9_]*",
+      "< [a-z_]+ >",
+      "Ident\n Ident <- [a-z_]+",
+      "[a-z_]i [a-z0-9_]i*",
+      "!'0' [a-z_]+",
+  };
+  std::vector<std::string> inputs = {
+      "if x", "ifx", "if_",  "if",         "if(x)",      "if9",
+      "ifX",  "do",  "dox",  "in x",       "int x",      "inx",
+      "(x",   "",    "if\xC1\xA1", "if\xC3\xA9", "if\x80",
+  };
+  for (const auto &word : words) {
+    auto grammar = R"(
+      S           <- ('if' / 'do') .* / ('int' / 'in' / '(') .*
+      %whitespace <- [ ]*
+    )";
+    parser pg(std::string(grammar) + "%word <- " + word);
+    parser rule(std::string(grammar) + "%word <- Word\nWord <- " + word);
+    ASSERT_TRUE(!!pg && !!rule) << word;
+    rule["Word"] = [](const SemanticValues &) {};
+    for (const auto &input : inputs) {
+      EXPECT_EQ(rule.parse(input), pg.parse(input)) << word << " / " << input;
+    }
+    EXPECT_FALSE(pg.parse("ifx")) << word;
+    EXPECT_TRUE(pg.parse("if x")) << word;
+  }
+}
@@ -112,6 +112,25 @@ TEST(DefinitionApiTest, Disable_action_skips_semantic_action) {
   EXPECT_FALSE(action_called);
 }
 
+// --- Definition::parse on a rule other than the start rule ---
+
+TEST(DefinitionApiTest, Parse_from_a_nested_rule) {
+  parser parser(R"(
+    ROOT <- ITEM
+    ITEM <- WORD '!'
+    WORD <- [a-z]+
+  )");
+  ASSERT_TRUE(parser);
+
+  EXPECT_TRUE(parser.parse("abc!"));
+
+  // ITEM numbers its own rules from 0, so ROOT and ITEM now share an id.
+  // Both run at the same position below, which the re-entry guard of a
+  // parse without packrat must not mistake for recursion.
+  EXPECT_TRUE(parser["ITEM"].parse("abc!").ret);
+  EXPECT_TRUE(parser.parse("abc!"));
+}
+
 // --- set_logger (lambda version without rule parameter) ---
 
 TEST(DefinitionApiTest, Set_logger_simple_lambda) {
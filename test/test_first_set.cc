@@ -299,3 +299,192 @@ TEST(FirstSetTest, Left_recursive_rule_referenced_from_multiple_rules) {
   EXPECT_TRUE(pg.parse("q9"));
   EXPECT_FALSE(pg.parse("p+1")); // Expr cannot start with '+'
 }
+
+// The first-byte dispatch table lists, per byte, the alternatives that can
+// start with it in their original order
+TEST(FirstSetTest, Dispatch_table_keeps_alternative_order) {
+  parser pg(R"(
+    S <- 'ab' / [a-c] 'x' / .? 'z' / 'b'
+  )");
+  ASSERT_TRUE(!!pg);
+
+  auto choice =
+      dynamic_cast<PrioritizedChoice *>(pg["S"].get_core_operator().get());
+  ASSERT_TRUE(choice);
+  ASSERT_FALSE(choice->candidates_.empty());
+  auto ids = [&](char ch) {
+    return choice->candidates_[choice->dispatch_[static_cast<uint8_t>(ch)]];
+  };
+  EXPECT_EQ((std::vector<uint32_t>{0, 1, 2}), ids('a'));
+  EXPECT_EQ((std::vector<uint32_t>{1, 2, 3}), ids('b'));
+  EXPECT_EQ((std::vector<uint32_t>{2}), ids('q'));
+
+  pg["S"] = [](const SemanticValues &vs) { return vs.choice(); };
+  size_t choice_id = 0;
+  EXPECT_TRUE(pg.parse("bx", choice_id));
+  EXPECT_EQ(1u, choice_id);
+  EXPECT_TRUE(pg.parse("b", choice_id));
+  EXPECT_EQ(3u, choice_id);
+  EXPECT_TRUE(pg.parse("qz", choice_id));
+  EXPECT_EQ(2u, choice_id);
+  EXPECT_FALSE(pg.parse("q"));
+}
+
+// Non-ASCII and negated classes filter by the UTF-8 lead bytes they can
+// start with instead of admitting every byte
+TEST(FirstSetTest, Unicode_classes_filter_by_lead_byte) {
+  parser pg(R"(
+    S <- [ぁ-ん]+ / [α-ω]+ / [^"\n] 'x' / '"'
+  )");
+  ASSERT_TRUE(!!pg);
+
+  auto choice =
+      dynamic_cast<PrioritizedChoice *>(pg["S"].get_core_operator().get());
+  ASSERT_TRUE(choice);
+  ASSERT_FALSE(choice->candidates_.empty());
+  auto ids = [&](uint8_t ch) {
+    return choice->candidates_[choice->dispatch_[ch]];
+  };
+  EXPECT_EQ((std::vector<uint32_t>{0, 2}), ids(0xE3)); // ぁ-ん
+  EXPECT_EQ((std::vector<uint32_t>{1, 2}), ids(0xCE)); // α-ο
+  EXPECT_EQ((std::vector<uint32_t>{1, 2}), ids(0xCF)); // π-ω
+  EXPECT_EQ((std::vector<uint32_t>{2}), ids(0xC3));
+  EXPECT_EQ((std::vector<uint32_t>{2}), ids('a'));
+  EXPECT_EQ((std::vector<uint32_t>{3}), ids('"'));
+  EXPECT_TRUE(ids('\n').empty());
+
+  EXPECT_TRUE(pg.parse(u8"ひらがな"));
+  EXPECT_TRUE(pg.parse(u8"αβγ"));
+  EXPECT_TRUE(pg.parse(u8"éx"));
+  EXPECT_TRUE(pg.parse("ax"));
+  EXPECT_TRUE(pg.parse("\""));
+  EXPECT_FALSE(pg.parse(u8"é"));
+  EXPECT_FALSE(pg.parse("\n"));
+}
+
+// Rules and repetition bodies that cannot start with the next byte fail
+// before any bookkeeping, and only where nothing can tell: a logger, which
+// needs the exact error positions, runs them in full
+TEST(FirstSetTest, Rule_and_repetition_guards) {
+  parser pg(R"(
+    S     <- Item (',' Item)* Tail?
+    Item  <- Num / Name / '(' S ')'
+    Num   <- < [0-9]+ >
+    Name  <- < [a-z]+ >
+    Tail  <- ';' Name*
+    %whitespace <- [ ]*
+  )");
+  ASSERT_TRUE(!!pg);
+
+  auto seq = dynamic_cast<Sequence *>(pg["S"].get_core_operator().get());
+  ASSERT_TRUE(seq);
+  auto rep = dynamic_cast<Repetition *>(seq->opes_[1].get());
+  ASSERT_TRUE(rep && rep->guard_);
+  EXPECT_TRUE(rep->first_set_.chars.test(','));
+  EXPECT_FALSE(rep->first_set_.chars.test(';'));
+
+  std::vector<std::string> inputs = {
+      "1, a, (2, b)", "1, a;", "1; a b", "1,", "(1", "1 a", "", "1;;",
+  };
+  for (const auto &input : inputs) {
+    auto fast = pg.parse(input);
+    std::string message;
+    pg.set_logger([&](size_t, size_t col, const std::string &msg) {
+      message = std::to_string(col) + ": " + msg;
+    });
+    EXPECT_EQ(fast, pg.parse(input)) << input;
+    pg.set_logger(Log{});
+    if (!fast) { EXPECT_FALSE(message.empty()) << input; }
+  }
+
+  // A nullable rule on a left-recursive cycle keeps its rules unguarded:
+  // their first sets would miss the bytes the cycle starts with
+  parser lr(R"(
+    R <- C 'r'
+    C <- D / ''
+    D <- C 'd'
+  )");
+  ASSERT_TRUE(!!lr);
+  EXPECT_TRUE(lr.parse("dr"));
+  EXPECT_TRUE(lr.parse("ddr"));
+  EXPECT_TRUE(lr.parse("r"));
+}
+
+// enter/leave handlers see a rule call even when it fails at its first byte,
+// so neither guard skips a call that reaches a rule with a handler
+TEST(FirstSetTest, Guards_keep_enter_and_leave_calls) {
+  parser pg(R"(
+    S    <- 'x' Item* !Wrap 'b'
+    Item <- 'a'
+    Wrap <- Item
+  )");
+  ASSERT_TRUE(!!pg);
+
+  size_t enter = 0;
+  size_t leave = 0;
+  pg["Item"].enter = [&](const Context &, const char *, size_t, std::any &) {
+    enter++;
+  };
+  pg["Item"].leave = [&](const Context &, const char *, size_t, size_t,
+                         std::any &, std::any &) { leave++; };
+
+  // Item* tries Item once at 'b', and !Wrap tries it through Wrap
+  EXPECT_TRUE(pg.parse("xb"));
+  EXPECT_EQ(2u, enter);
+  EXPECT_EQ(2u, leave);
+
+  enter = leave = 0;
+  EXPECT_TRUE(pg.parse("xaab"));
+  EXPECT_EQ(4u, enter);
+  EXPECT_EQ(4u, leave);
+}
+
+// Alternatives whose keywords share a first byte are told apart by a prefix
+// of the next bytes, case-folded, without changing which alternative wins
+TEST(FirstSetTest, Prefix_dispatch_agrees_with_first_byte) {
+  parser pg(R"(
+    S      <- Stmt !.
+    Stmt   <- Select / Set / Show / 'Save' Name / Call / Name
+    Select <- 'SELECT'i Name
+    Set    <- 'SET'i Name
+    Show   <- ('SHOW'i / 'SHO'i 'WS'i) Name
+    Call   <- Name '(' ')'
+    Name   <- < [a-zA-Z]+ >
+    %whitespace <- [ ]*
+  )");
+  ASSERT_TRUE(!!pg);
+
+  auto choice =
+      dynamic_cast<PrioritizedChoice *>(pg["Stmt"].get_core_operator().get());
+  ASSERT_TRUE(choice);
+  EXPECT_EQ(3u, choice->prefix_length_);
+
+  size_t alternative = 0;
+  pg["Stmt"] = [&](const SemanticValues &vs) { alternative = vs.choice(); };
+
+  std::vector<std::string> inputs = {
+      "select a", "SeT a",  "show a",   "SHOWS a", "Save a", "SAVE a",
+      "sel()",    "set()",  "sets",     "se",      "s",      "save",
+      "selectx",  "shows",  "Sho Ws a", "x",       "",       "SELECT",
+  };
+  for (const auto &input : inputs) {
+    alternative = 0;
+    auto fast = pg.parse(input);
+    auto fast_alternative = alternative;
+
+    auto length = std::exchange(choice->prefix_length_, 0);
+    alternative = 0;
+    EXPECT_EQ(pg.parse(input), fast) << input;
+    EXPECT_EQ(alternative, fast_alternative) << input;
+    choice->prefix_length_ = length;
+  }
+
+  // One keyword per first byte: the first-byte dispatch is enough
+  parser single(R"(
+    S <- 'SELECT'i / 'UPDATE'i / 'DELETE'i / [a-z]+
+  )");
+  auto single_choice = dynamic_cast<PrioritizedChoice *>(
+      single["S"].get_core_operator().get());
+  ASSERT_TRUE(single_choice);
+  EXPECT_EQ(0u, single_choice->prefix_length_);
+}
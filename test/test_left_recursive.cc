@@ -372,6 +372,27 @@ TEST(LeftRecursionTest, LeftAssociativity) {
   EXPECT_EQ(1, val);
 }
 
+TEST(LeftRecursionTest, LeftAssociativity_long_chain) {
+  parser p(PEG_ArithmeticExpressions_Left_Recursion);
+  EXPECT_TRUE(p);
+
+  setup_arithmetic_actions(p);
+
+  // One left-associative step per operator, all at the start position.
+  std::string input = "2000";
+  for (auto i = 0; i < 2000; i++) {
+    input += i % 2 ? "-1" : "-2*1";
+  }
+
+  long val;
+  EXPECT_TRUE(p.parse(input, val));
+  EXPECT_EQ(-1000, val);
+
+  p.enable_packrat_parsing();
+  EXPECT_TRUE(p.parse(input, val));
+  EXPECT_EQ(-1000, val);
+}
+
 TEST(LeftRecursionTest, ArithmeticExpressions_with_AST) {
   parser p(PEG_ArithmeticExpressions_Left_Recursion);
 
@@ -402,6 +423,111 @@ TEST(LeftRecursionTest, ArithmeticExpressions_with_AST) {
             s);
 }
 
+TEST(LeftRecursionTest, Direct_left_recursion_is_folded) {
+  parser p(PEG_ArithmeticExpressions_Left_Recursion);
+  EXPECT_TRUE(p);
+  EXPECT_EQ(3u, p["expr"].lr_tails.size());
+  EXPECT_EQ(3u, p["term"].lr_tails.size());
+  EXPECT_TRUE(p["factor"].lr_tails.empty());
+
+  // Mutual recursion keeps growing seeds.
+  parser mutual(R"(
+    A <- B 'a' / 'a'
+    B <- A 'b' / 'b'
+  )");
+  EXPECT_TRUE(mutual);
+  EXPECT_TRUE(mutual["A"].lr_tails.empty());
+  EXPECT_TRUE(mutual["B"].lr_tails.empty());
+
+  // So does a base alternative that reaches the rule through another one.
+  parser indirect(R"(
+    E <- E '+' 'x' / F
+    F <- E '*' 'x' / 'x'
+  )");
+  EXPECT_TRUE(indirect);
+  EXPECT_TRUE(indirect["E"].lr_tails.empty());
+}
+
+TEST(LeftRecursionTest, Folded_parse_matches_seed_growing) {
+  struct Case {
+    const char *grammar;
+    const char *input;
+  };
+
+  std::vector<Case> cases = {
+      {PEG_ArithmeticExpressions_Left_Recursion, "1+2*3-4/2*5"},
+      // The base alternative comes first and always wins.
+      {R"(
+        E <- T / E '+' T
+        T <- [0-9]
+      )",
+       "1+2+3"},
+      {R"(
+        P <- P '(' ')' / P '[' N ']' / < [a-z]+ >
+        N <- < [0-9]+ >
+        %whitespace <- [ ]*
+      )",
+       "f ( ) [ 1 ] ( )"},
+      {R"(
+        S <- S '+' N / S '+' '+' / N
+        N <- < [0-9]+ >
+      )",
+       "1+2++3+"},
+  };
+
+  for (const auto &c : cases) {
+    for (auto packrat : {false, true}) {
+      parser folded(c.grammar);
+      parser grown(c.grammar);
+      ASSERT_TRUE(folded);
+      ASSERT_TRUE(grown);
+
+      folded.enable_ast();
+      grown.enable_ast();
+      if (packrat) {
+        folded.enable_packrat_parsing();
+        grown.enable_packrat_parsing();
+      }
+
+      // A tracer keeps the seed-growing path.
+      grown.enable_trace([](auto &&...) {}, [](auto &&...) {});
+
+      std::shared_ptr<Ast> folded_ast;
+      std::shared_ptr<Ast> grown_ast;
+      auto folded_ret = folded.parse(c.input, folded_ast);
+      auto grown_ret = grown.parse(c.input, grown_ast);
+      EXPECT_EQ(grown_ret, folded_ret) << c.input;
+      if (grown_ret && folded_ret) {
+        EXPECT_EQ(ast_to_s(grown_ast), ast_to_s(folded_ast)) << c.input;
+      }
+    }
+  }
+}
+
+TEST(LeftRecursionTest, Folded_step_reports_choice) {
+  parser p(R"(
+    E <- E '+' N / E '-' N / N
+    N <- < [0-9]+ >
+  )");
+  EXPECT_TRUE(p);
+  EXPECT_FALSE(p["E"].lr_tails.empty());
+
+  p["E"] = [](const SemanticValues &vs) {
+    switch (vs.choice()) {
+    case 0: return "(" + std::any_cast<std::string>(vs[0]) + "+" +
+                   std::any_cast<std::string>(vs[1]) + ")";
+    case 1: return "(" + std::any_cast<std::string>(vs[0]) + "-" +
+                   std::any_cast<std::string>(vs[1]) + ")";
+    default: return std::any_cast<std::string>(vs[0]);
+    }
+  };
+  p["N"] = [](const SemanticValues &vs) { return vs.token_to_string(); };
+
+  std::string val;
+  EXPECT_TRUE(p.parse("1+2-3+4", val));
+  EXPECT_EQ("(((1+2)-3)+4)", val);
+}
+
 // ---------------------------------------------------------------------------
 // Monkey language (cascading LR)
 // ---------------------------------------------------------------------------
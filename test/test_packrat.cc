@@ -171,5 +171,72 @@ TEST(PackratTest, Packrat_shared_consuming_prefix_is_not_exponential) {
   EXPECT_TRUE(pg.parse(input));
 }
 
+TEST(PackratTest, Packrat_memoizes_macro_instance) {
+  parser pg(R"(
+    S       <- Wrap('x')
+    Wrap(X) <- '(' (Wrap(X) ',' / &. Wrap(X)) ')' / X
+  )");
+  pg.enable_packrat_parsing();
+  EXPECT_TRUE(pg);
+
+  // No rule sits between the nested Wrap('x') calls, so only a memo entry
+  // for the instance itself keeps the second alternative from re-parsing it
+  // at every level. Completing at all is the assertion.
+  std::string input;
+  for (auto i = 0; i < 100; i++) {
+    input += '(';
+  }
+  input += 'x';
+  for (auto i = 0; i < 100; i++) {
+    input += ')';
+  }
+  EXPECT_TRUE(pg.parse(input));
+}
+
+TEST(PackratTest, Packrat_macro_instance_replays_values) {
+  auto grammar = R"(
+    S           <- Pair(NUM) 'x' / &. Pair(NUM) 'y'
+    Pair(X)     <- '(' X ',' < X > ')'
+    NUM         <- < [0-9]+ >
+    %whitespace <- [ ]*
+  )";
+
+  auto setup = [](parser &pg) {
+    pg["NUM"] = [](const SemanticValues &vs) {
+      return vs.token_to_number<int>();
+    };
+    pg["S"] = [](const SemanticValues &vs) {
+      std::string out = std::to_string(vs.choice()) + ":";
+      for (const auto &v : vs) {
+        out += std::to_string(std::any_cast<int>(v)) + ",";
+      }
+      for (const auto &t : vs.tokens) {
+        out += std::string(t) + ";";
+      }
+      return out;
+    };
+  };
+
+  parser pg1(grammar);
+  EXPECT_TRUE(pg1);
+  setup(pg1);
+
+  parser pg2(grammar);
+  EXPECT_TRUE(pg2);
+  pg2.enable_packrat_parsing();
+  setup(pg2);
+
+  for (auto input : {"(1, 2) x", "(12, 3) y"}) {
+    std::string val1, val2;
+    EXPECT_TRUE(pg1.parse(input, val1));
+    EXPECT_TRUE(pg2.parse(input, val2));
+    EXPECT_EQ(val1, val2) << "Mismatch for input: '" << input << "'";
+  }
+
+  std::string val;
+  EXPECT_TRUE(pg2.parse("(12, 3) y", val));
+  EXPECT_EQ("1:12,3,3;", val);
+}
+
 // =============================================================================
 // Lookahead Predicate Tests
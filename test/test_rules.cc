@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include <peglib.h>
+#include <atomic>
+#include <thread>
 
 using namespace peg;
 
@@ -283,6 +285,74 @@ TEST(MacroEdgeTest, Macro_with_whitespace) {
   EXPECT_EQ("c", items[2]);
 }
 
+TEST(MacroEdgeTest, Macro_instantiated_once_per_argument_tuple) {
+  parser pg(R"(
+    S       <- LIST(A) ';' LIST(B) ';' LIST(A) ';' PAIR(A)
+    PAIR(X) <- LIST(X) '=' LIST(X)
+    LIST(X) <- X (',' X)*
+    A       <- 'a'
+    B       <- 'b'
+  )");
+  EXPECT_TRUE(pg);
+
+  // LIST(A) is written three times but instantiated once
+  EXPECT_EQ(2, pg["LIST"].macro_instances.size());
+  EXPECT_EQ(1, pg["PAIR"].macro_instances.size());
+
+  EXPECT_TRUE(pg.parse("a,a;b;a;a=a,a"));
+  EXPECT_FALSE(pg.parse("a,b;b;a;a=a"));
+  EXPECT_FALSE(pg.parse("a;b;a;a=b"));
+}
+
+TEST(MacroEdgeTest, Recursive_macro_instantiation) {
+  // The same arguments again: the instance refers to itself
+  parser pg1(R"(
+    S       <- LIST('a')
+    LIST(X) <- X (',' LIST(X))?
+  )");
+  EXPECT_TRUE(pg1);
+  EXPECT_EQ(1, pg1["LIST"].macro_instances.size());
+  EXPECT_TRUE(pg1.parse("a,a,a"));
+  EXPECT_FALSE(pg1.parse("a,a,"));
+
+  // New arguments on every expansion: the inner call expands at parse time
+  parser pg2(R"(
+    S    <- M('abc')
+    M(s) <- !s / s ' ' M(s / '123') / s
+  )");
+  EXPECT_TRUE(pg2);
+  EXPECT_EQ(1, pg2["M"].macro_instances.size());
+  EXPECT_TRUE(pg2.parse("abc 123 abc"));
+  EXPECT_FALSE(pg2.parse("abc 12"));
+}
+
+TEST(MacroEdgeTest, Instantiated_macro_matches_dynamic_expansion) {
+  // A tracer keeps the macro on its dynamic path
+  auto grammar = R"(
+    S            <- LIST(PARENS(ITEM), ',')
+    LIST(I, D)   <- I (D I)*
+    PARENS(X)    <- '(' X ')' / X
+    ITEM         <- < [a-z]+ >
+    %whitespace  <- [ \t]*
+  )";
+
+  auto parse = [&](bool trace) {
+    parser pg(grammar);
+    pg.enable_ast();
+    if (trace) {
+      pg.enable_trace([](auto &, auto, auto, auto &, auto &, auto &, auto &) {},
+                      [](auto &, auto, auto, auto &, auto &, auto &, auto,
+                         auto &) {});
+    }
+    std::shared_ptr<Ast> ast;
+    EXPECT_TRUE(pg.parse("a, (b), c", ast));
+    return ast ? ast_to_s(ast) : std::string();
+  };
+
+  EXPECT_FALSE(parse(false).empty());
+  EXPECT_EQ(parse(true), parse(false));
+}
+
 // =============================================================================
 // Context/State Tests
 
@@ -477,6 +547,136 @@ TEST(PrecedenceTest, Precedence_climbing_with_macro) {
   }
 }
 
+TEST(PrecedenceTest, Precedence_climbing_with_memoized_operator) {
+  // OPERATOR is memoized for S's alternatives; the climber must still see
+  // the token of each operator it parses.
+  parser parser(R"(
+        S                <-  OPERATOR 'q' / &. OPERATOR 'r' / EXPRESSION
+        EXPRESSION       <-  ATOM (OPERATOR ATOM)* {
+                               precedence
+                                 L + -
+                                 L * /
+                             }
+        ATOM             <-  < [0-9]+ >
+        OPERATOR         <-  < [-+*/] >
+	)");
+
+  EXPECT_TRUE(!!parser);
+
+  parser["EXPRESSION"] = [](const SemanticValues &vs) {
+    auto result = std::any_cast<std::string>(vs[0]);
+    if (vs.size() > 1) {
+      result = "(" + result + std::any_cast<std::string>(vs[1]) +
+               std::any_cast<std::string>(vs[2]) + ")";
+    }
+    return result;
+  };
+  parser["ATOM"] = [](const SemanticValues &vs) {
+    return vs.token_to_string();
+  };
+  parser["OPERATOR"] = [](const SemanticValues &vs) {
+    return vs.token_to_string();
+  };
+
+  std::string val;
+  EXPECT_TRUE(parser.parse("1+2*3-4/2", val));
+  EXPECT_EQ("((1+(2*3))-(4/2))", val);
+
+  parser.enable_packrat_parsing();
+  EXPECT_TRUE(parser.parse("1+2*3-4/2", val));
+  EXPECT_EQ("((1+(2*3))-(4/2))", val);
+}
+
+TEST(PrecedenceTest, Precedence_climbing_with_temporary_grammar_text) {
+  // The operator names must not point into grammar text the caller frees.
+  auto grammar = std::make_unique<std::string>(R"(
+        EXPRESSION       <-  ATOM (OPERATOR ATOM)* {
+                               precedence
+                                 L + -
+                                 L * /
+                             }
+        ATOM             <-  < [0-9]+ >
+        OPERATOR         <-  < [-+*/] >
+	)");
+  parser parser(*grammar);
+  grammar.reset();
+
+  EXPECT_TRUE(!!parser);
+
+  parser["EXPRESSION"] = [](const SemanticValues &vs) {
+    auto result = std::any_cast<std::string>(vs[0]);
+    if (vs.size() > 1) {
+      result = "(" + result + std::any_cast<std::string>(vs[1]) +
+               std::any_cast<std::string>(vs[2]) + ")";
+    }
+    return result;
+  };
+  parser["ATOM"] = [](const SemanticValues &vs) {
+    return vs.token_to_string();
+  };
+  parser["OPERATOR"] = [](const SemanticValues &vs) {
+    return vs.token_to_string();
+  };
+
+  std::string val;
+  EXPECT_TRUE(parser.parse("1+2*3-4", val));
+  EXPECT_EQ("((1+(2*3))-4)", val);
+}
+
+TEST(PrecedenceTest, Precedence_climbing_concurrent_parses) {
+  parser parser(R"(
+        EXPRESSION       <-  ATOM (OPERATOR ATOM)* {
+                               precedence
+                                 L + -
+                                 L * /
+                             }
+        ATOM             <-  NUMBER / '(' EXPRESSION ')'
+        OPERATOR         <-  < [-+*/] >
+        NUMBER           <-  < [0-9]+ >
+        %whitespace      <-  [ \t]*
+	)");
+
+  EXPECT_TRUE(!!parser);
+
+  parser["EXPRESSION"] = [](const SemanticValues &vs) -> long {
+    auto result = std::any_cast<long>(vs[0]);
+    if (vs.size() > 1) {
+      auto ope = std::any_cast<char>(vs[1]);
+      auto num = std::any_cast<long>(vs[2]);
+      switch (ope) {
+      case '+': result += num; break;
+      case '-': result -= num; break;
+      case '*': result *= num; break;
+      case '/': result /= num; break;
+      }
+    }
+    return result;
+  };
+  parser["OPERATOR"] = [](const SemanticValues &vs) { return *vs.sv().data(); };
+  parser["NUMBER"] = [](const SemanticValues &vs) {
+    return vs.token_to_number<long>();
+  };
+
+  // The parse leaves the grammar untouched, so one parser serves many
+  // threads at once.
+  std::atomic<int> failures{0};
+  std::vector<std::thread> threads;
+  for (auto t = 0; t < 4; t++) {
+    threads.emplace_back([&, t]() {
+      for (auto i = 0; i < 200; i++) {
+        auto expr =
+            std::to_string(t) + " + 2 * (3 - 1) * " + std::to_string(i);
+        long val = 0;
+        if (!parser.parse(expr, val) || val != t + 4 * i) { failures++; }
+      }
+    });
+  }
+  for (auto &th : threads) {
+    th.join();
+  }
+  EXPECT_EQ(0, failures);
+}
+
 TEST(PrecedenceTest, Precedence_climbing_error1) {
   parser parser(R"(
         START            <-  _ EXPRESSION
@@ -773,6 +973,35 @@ TEST(BackrefEdgeTest, Backreference_with_choices) {
   EXPECT_FALSE(pg.parse("(hello["));
 }
 
+TEST(BackrefEdgeTest, Backreference_after_capture_scope) {
+  // The scope drops its own $t, and $t refers to the outer capture again.
+  parser pg(R"(
+    S <- $t<[a-z]+> $($t<[0-9]+> '-' $t) '-' $t
+  )");
+  EXPECT_TRUE(pg);
+
+  EXPECT_TRUE(pg.parse("ab12-12-ab"));
+  EXPECT_FALSE(pg.parse("ab12-12-12"));
+  EXPECT_FALSE(pg.parse("ab12-ab-ab"));
+}
+
+TEST(BackrefEdgeTest, Backreference_with_temporary_grammar_text) {
+  // Capture names must not point into grammar text the caller frees.
+  auto grammar = std::make_unique<std::string>(R"(
+    S <- $tag<[a-z]+> '=' $tag
+  )");
+  parser pg(*grammar);
+  grammar.reset();
+  EXPECT_TRUE(pg);
+
+  std::string msg;
+  pg.set_logger([&](size_t, size_t, const std::string &m) { msg = m; });
+
+  EXPECT_TRUE(pg.parse("abc=abc"));
+  EXPECT_FALSE(pg.parse("abc=abd"));
+  EXPECT_EQ("syntax error, unexpected 'abd', expecting 'abc'.", msg);
+}
+
 // =============================================================================
 // Precedence Climbing Edge Cases
 
@@ -849,6 +1078,145 @@ TEST(DictionaryTest, Dictionary_choice_index) {
   EXPECT_TRUE(pg.parse("blue"));
 }
 
+TEST(DictionaryTest, Trie_matches_longest_item_in_one_pass) {
+  Trie trie({"in", "insert", "IN", "into", "x-ray"}, true);
+  EXPECT_EQ(5u, trie.items_count());
+  EXPECT_EQ(13u, trie.size()); // distinct prefixes
+
+  size_t id = 99;
+  EXPECT_EQ(6u, trie.match("INSERTX", 7, id));
+  EXPECT_EQ(1u, id);
+  EXPECT_EQ(2u, trie.match("Ins", 3, id)); // "ins" is no item
+  EXPECT_EQ(0u, id);                       // the duplicate keeps id 0
+  EXPECT_EQ(4u, trie.match("intO", 4, id));
+  EXPECT_EQ(3u, id);
+  EXPECT_EQ(5u, trie.match("X-Ray", 5, id));
+  EXPECT_EQ(4u, id);
+  EXPECT_EQ(0u, trie.match("x-ra", 4, id));
+  EXPECT_EQ(0u, trie.match("", 0, id));
+
+  Trie exact({"in", "IN"}, false);
+  EXPECT_EQ(2u, exact.match("IN", 2, id));
+  EXPECT_EQ(1u, id);
+  EXPECT_EQ(0u, exact.match("In", 2, id));
+}
+
+// =============================================================================
+// Literal Choice Tests
+// =============================================================================
+
+namespace {
+
+PrioritizedChoice *literal_choice(parser &pg, const char *name) {
+  return dynamic_cast<PrioritizedChoice *>(pg[name].get_core_operator().get());
+}
+
+} // namespace
+
+TEST(LiteralChoiceTest, Literal_choice_matches_as_dictionary) {
+  parser pg(R"(
+    S  <- Op+
+    Op <- '<=' / '>=' / '<' / '>' / '='
+  )");
+  ASSERT_TRUE(pg);
+  ASSERT_TRUE(literal_choice(pg, "Op"));
+  EXPECT_TRUE(literal_choice(pg, "Op")->dictionary_);
+  EXPECT_TRUE(literal_choice(pg, "Op")->use_dictionary_);
+
+  std::vector<size_t> choices;
+  pg["Op"] = [&](const SemanticValues &vs) { choices.push_back(vs.choice()); };
+
+  EXPECT_TRUE(pg.parse("<=<>>=="));
+  EXPECT_EQ((std::vector<size_t>{0, 2, 3, 1, 4}), choices);
+  EXPECT_FALSE(pg.parse("<=!"));
+}
+
+TEST(LiteralChoiceTest, Dictionary_and_loop_agree) {
+  auto grammar = R"(
+    S  <- (Kw / Op)+
+    Kw <- 'current'i / 'count'i / 'cast'i / 'case'i / 'and'i
+    Op <- '<=' / '<' / '='
+  )";
+
+  // The dictionary is used however few alternatives share a first byte
+  parser pg(grammar);
+  ASSERT_TRUE(pg);
+  ASSERT_TRUE(literal_choice(pg, "Kw"));
+  EXPECT_TRUE(literal_choice(pg, "Kw")->use_dictionary_);
+  ASSERT_TRUE(literal_choice(pg, "Op"));
+  EXPECT_TRUE(literal_choice(pg, "Op")->use_dictionary_);
+
+  parser loop(grammar);
+  ASSERT_TRUE(loop);
+  literal_choice(loop, "Kw")->use_dictionary_ = false;
+  literal_choice(loop, "Op")->use_dictionary_ = false;
+
+  std::vector<size_t> choices;
+  pg["Kw"] = [&](const SemanticValues &vs) { choices.push_back(vs.choice()); };
+  pg["Op"] = [&](const SemanticValues &vs) { choices.push_back(vs.choice()); };
+  std::vector<size_t> loop_choices;
+  loop["Kw"] = [&](const SemanticValues &vs) {
+    loop_choices.push_back(vs.choice());
+  };
+  loop["Op"] = [&](const SemanticValues &vs) {
+    loop_choices.push_back(vs.choice());
+  };
+
+  EXPECT_TRUE(pg.parse("CASTcase<=And<Count="));
+  EXPECT_EQ((std::vector<size_t>{2, 3, 0, 4, 1, 1, 2}), choices);
+  EXPECT_TRUE(loop.parse("CASTcase<=And<Count="));
+  EXPECT_EQ(choices, loop_choices);
+  EXPECT_FALSE(pg.parse("cas"));
+  EXPECT_FALSE(loop.parse("cas"));
+}
+
+TEST(LiteralChoiceTest, Only_order_preserving_choices_are_converted) {
+  parser pg(R"(
+    S     <- Later / Mixed / Other / Case
+    Later <- '<' / '<='
+    Mixed <- 'a' / [b]
+    Other <- 'c' / 'd'i
+    Case  <- 'ORDER'i / 'OR'i / 'AND'i
+  )");
+  ASSERT_TRUE(pg);
+
+  // '<' would win over '<=' in order, but the dictionary matches the longest
+  EXPECT_FALSE(literal_choice(pg, "Later")->dictionary_);
+  EXPECT_FALSE(literal_choice(pg, "Mixed")->dictionary_);
+  EXPECT_FALSE(literal_choice(pg, "Other")->dictionary_);
+  ASSERT_TRUE(literal_choice(pg, "Case")->dictionary_);
+  EXPECT_FALSE(literal_choice(pg, "Case")->dictionary_prefix_free_);
+
+  EXPECT_TRUE(pg.parse("<"));
+  EXPECT_FALSE(pg.parse("<="));
+  EXPECT_TRUE(pg.parse("order"));
+  EXPECT_TRUE(pg.parse("Or"));
+  EXPECT_FALSE(pg.parse("orde"));
+}
+
+TEST(LiteralChoiceTest, Word_boundaries_match_the_ordered_choice) {
+  parser pg(R"(
+    S     <- Open Kw [a-z0-9]*
+    Open  <- '(' / '['
+    Kw    <- 'a1' / 'a'
+    %word <- [a-z]+
+  )");
+  ASSERT_TRUE(pg);
+  ASSERT_TRUE(literal_choice(pg, "Open")->dictionary_);
+  ASSERT_TRUE(literal_choice(pg, "Kw")->dictionary_);
+
+  size_t kw = 0;
+  pg["Kw"] = [&](const SemanticValues &vs) { kw = vs.choice(); };
+
+  // '(' is not a word, so no word boundary is required after it; and 'a1'
+  // fails its boundary check where 'a' passes
+  EXPECT_TRUE(pg.parse("(a1b"));
+  EXPECT_EQ(1u, kw);
+  EXPECT_TRUE(pg.parse("[a1"));
+  EXPECT_EQ(0u, kw);
+  EXPECT_FALSE(pg.parse("(ab"));
+}
+
 // =============================================================================
 // Backreference Edge Cases
 
@@ -1045,3 +1413,219 @@ TEST(UserRuleTest, User_rule_combined_with_peg_rules) {
 
 // =============================================================================
 // Semantic Predicate Tests
+
+// Small non-recursive rules parse in place of the call when nothing observes
+// semantic values; actions and ASTs see every rule as before
+TEST(InliningTest, Small_rules_are_inline_candidates) {
+  auto grammar = R"(
+    List   <- LParen Item (Comma Item)* RParen
+    Item   <- Number / List / Name
+    Number <- < [0-9]+ >
+    Name   <- < [a-z]+ >
+    LParen <- '('
+    RParen <- ')'
+    Comma  <- ','
+    %whitespace <- [ \t]*
+  )";
+
+  parser pg(grammar);
+  ASSERT_TRUE(!!pg);
+  EXPECT_EQ(std::vector<std::string>({"Comma", "LParen", "Name", "Number",
+                                      "RParen"}),
+            pg.get_inline_candidates());
+
+  parser observed(grammar);
+  size_t numbers = 0;
+  observed["Number"] = [&](const SemanticValues &) { numbers++; };
+  // Still candidates: the action only keeps this parser off the inlined path
+  EXPECT_EQ(pg.get_inline_candidates(), observed.get_inline_candidates());
+
+  std::vector<std::string> inputs = {
+      "(1, a, (2, b))", "(1 , (a))", "(1,)", "((1)", "()", "(a b)", "",
+  };
+  for (auto packrat : {false, true}) {
+    if (packrat) {
+      pg.enable_packrat_parsing();
+      observed.enable_packrat_parsing();
+    }
+    for (const auto &input : inputs) {
+      EXPECT_EQ(observed.parse(input), pg.parse(input)) << input;
+    }
+  }
+  EXPECT_GT(numbers, 0u);
+
+  pg.enable_ast();
+  std::shared_ptr<Ast> ast;
+  ASSERT_TRUE(pg.parse("(1, a)", ast));
+  EXPECT_EQ("+ List\n"
+            "  - LParen (()\n"
+            "  - Item/0[Number] (1)\n"
+            "  - Comma (,)\n"
+            "  - Item/2[Name] (a)\n"
+            "  - RParen ())\n",
+            ast_to_s(pg.optimize_ast(ast)));
+
+  parser recursive(R"(
+    S <- A ';'
+    A <- 'a' A / 'b'
+  )");
+  ASSERT_TRUE(!!recursive);
+  EXPECT_TRUE(recursive.get_inline_candidates().empty());
+  EXPECT_TRUE(recursive.parse("aab;"));
+}
+
+// Alternatives that start with the same elements are each parsed from the
+// start, in order. A recognizing parse and one that reads vs.choice() agree
+// on what matches and which alternative wins.
+TEST(PrioritizedChoiceTest, Alternatives_with_common_prefixes_keep_order) {
+  auto grammar = R"(
+    S    <- Stmt !.
+    Stmt <- 'if' Cond 'then' Num 'else' Num
+          / 'if' Cond 'then' Num
+          / 'if' Cond
+          / Word
+    Cond <- '(' Word ')'
+    Word <- [a-z]+
+    Num  <- [0-9]+
+  )";
+
+  parser pg(grammar);
+  ASSERT_TRUE(!!pg);
+
+  parser observed(grammar);
+  ASSERT_TRUE(!!observed);
+  observed["Stmt"] = [](const SemanticValues &vs) { return vs.choice(); };
+
+  const std::vector<std::pair<std::string, size_t>> inputs = {
+      {"if(a)then1else2", 0}, {"if(a)then1", 1}, {"if(a)", 2},
+      {"iffy", 3},            {"if(a)then", 2},  {"if(a)then1else", 1},
+      {"if(", 3},
+  };
+  for (auto packrat : {false, true}) {
+    if (packrat) {
+      pg.enable_packrat_parsing();
+      observed.enable_packrat_parsing();
+    }
+    for (const auto &[input, expected] : inputs) {
+      auto r1 = pg["Stmt"].parse(input.data(), input.size());
+      size_t choice_id = 0;
+      auto r2 = observed["Stmt"].parse_and_get_value(input.data(),
+                                                     input.size(), choice_id);
+      EXPECT_EQ(r2.ret, r1.ret) << input;
+      EXPECT_EQ(r2.len, r1.len) << input;
+      if (r2.ret) { EXPECT_EQ(expected, choice_id) << input; }
+      EXPECT_EQ(observed.parse(input), pg.parse(input)) << input;
+    }
+  }
+}
+
+// A capture in a common prefix is made again by the alternative that
+// backtracks over it
+TEST(PrioritizedChoiceTest, Common_prefix_keeps_captures) {
+  parser pg(R"(
+    S <- $n<[a-z]+> ':' $n '!' / $n<[a-z]+> ':' $n '?'
+  )");
+  ASSERT_TRUE(!!pg);
+
+  EXPECT_TRUE(pg.parse("ab:ab!"));
+  EXPECT_TRUE(pg.parse("ab:ab?"));
+  EXPECT_FALSE(pg.parse("ab:ac?"));
+  EXPECT_FALSE(pg.parse("ab:ab."));
+}
+
+// Alternatives that start with the same elements parse them once. The
+// action on the rule sees the same choice, values and tokens as it does
+// when every alternative parses them again.
+TEST(PrioritizedChoiceTest, Shared_prefix_is_parsed_once) {
+  auto grammar = R"(
+    Stmt <- 'if' Cond 'then' Num 'else' Num
+          / 'if' Cond 'then' Num
+          / 'if' Cond
+          / Word
+    Cond <- '(' Word ')'
+    Word <- < [a-z]+ >
+    Num  <- < [0-9]+ >
+    %whitespace <- [ ]*
+  )";
+
+  parser factored(grammar);
+  parser plain(grammar);
+  ASSERT_TRUE(!!factored && !!plain);
+
+  auto choice = [](parser &pg) {
+    return dynamic_cast<PrioritizedChoice *>(
+        pg["Stmt"].get_core_operator().get());
+  };
+  ASSERT_TRUE(choice(factored));
+  EXPECT_EQ((std::vector<uint8_t>{0, 4, 2, 0}),
+            choice(factored)->shared_prefix_);
+  choice(plain)->shared_prefix_.clear();
+
+  auto describe = [](const SemanticValues &vs) {
+    auto out = std::to_string(vs.choice()) + "/" +
+               std::to_string(vs.choice_count()) + " " +
+               std::to_string(vs.size()) + " " + std::string(vs.sv());
+    for (const auto &token : vs.tokens) {
+      out += " " + std::string(token);
+    }
+    return out;
+  };
+  factored["Stmt"] = describe;
+  plain["Stmt"] = describe;
+
+  for (auto packrat : {false, true}) {
+    if (packrat) {
+      factored.enable_packrat_parsing();
+      plain.enable_packrat_parsing();
+    }
+    for (auto input : {"if (a) then 1 else 2", "if (a) then 1", "if (a)",
+                       "iffy", "if (a) then", "if (a) then 1 else", "if (",
+                       "if (a then 1"}) {
+      std::string v1, v2;
+      EXPECT_EQ(plain.parse(input, v2), factored.parse(input, v1)) << input;
+      EXPECT_EQ(v2, v1) << input;
+    }
+  }
+}
+
+// A callback on a rule the shared elements reach runs once per alternative,
+// as if nothing were shared
+TEST(PrioritizedChoiceTest, Shared_prefix_with_callbacks) {
+  parser pg(R"(
+    Stmt <- 'if' Cond 'then' / 'if' Cond 'do' / 'if' Cond
+    Cond <- [a-c]+
+  )");
+  ASSERT_TRUE(!!pg);
+
+  size_t conds = 0;
+  pg["Cond"] = [&](const SemanticValues &) { conds++; };
+  EXPECT_TRUE(pg.parse("ifa"));
+  EXPECT_EQ(3u, conds);
+
+  conds = 0;
+  pg["Cond"].action = Action();
+  pg["Cond"].enter = [&](const Context &, const char *, size_t, std::any &) {
+    conds++;
+  };
+  EXPECT_TRUE(pg.parse("ifabdo"));
+  EXPECT_EQ(2u, conds);
+}
+
+// Rules built from combinators may share a name, so a reference to a rule
+// is told apart by its Definition; otherwise two different rules would
+// compare equal
+TEST(OpeSignatureTest, Same_named_rules_have_different_signatures) {
+  Definition A, B;
+  A.name = "X";
+  B.name = "X";
+  A <= lit("a");
+  B <= lit("b");
+
+  auto signature = [](Definition &rule) {
+    OpeSignature vis;
+    rule.accept(vis);
+    return vis.s;
+  };
+  EXPECT_NE(signature(A), signature(B));
+  EXPECT_EQ(signature(A), signature(A));
+}
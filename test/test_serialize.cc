@@ -130,7 +130,7 @@ TEST(GrammarBlobTest, RoundTripPrecedence) {
     bool r1 = p1.parse(in, a1);
     bool r2 = p2.parse(in, a2);
     EXPECT_EQ(r1, r2) << in;
-    if (r1 && r2) EXPECT_EQ(peg::ast_to_s(a1), peg::ast_to_s(a2)) << in;
+    if (r1 && r2) { EXPECT_EQ(peg::ast_to_s(a1), peg::ast_to_s(a2)) << in; }
   }
 }
 
@@ -195,7 +195,7 @@ TEST(GrammarBlobTest, ParserLoadBlobWithAst) {
     bool r1 = p1.parse(in, a1);
     bool r2 = p2.parse(in, a2);
     EXPECT_EQ(r1, r2) << in;
-    if (r1 && r2) EXPECT_EQ(peg::ast_to_s(a1), peg::ast_to_s(a2)) << in;
+    if (r1 && r2) { EXPECT_EQ(peg::ast_to_s(a1), peg::ast_to_s(a2)) << in; }
   }
 }
 
@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+#include <peglib.h>
+
+using namespace peg;
+
+// The vector span kernels stop at the same byte as the scalar loop, for
+// every run length around the 16- and 32-byte block boundaries
+TEST(SpanKernelTest, Kernels_agree_with_scalar_loop) {
+  std::vector<std::bitset<256>> sets(4);
+  for (auto ch : std::string("abcdefghijklmnopqrstuvwxyz0123456789_")) {
+    sets[0].set(static_cast<unsigned char>(ch));
+  }
+  for (auto ch : std::string("0123456789")) {
+    sets[1].set(static_cast<unsigned char>(ch));
+  }
+  for (auto ch : std::string(" \t\r\n")) {
+    sets[2].set(static_cast<unsigned char>(ch));
+  }
+  for (size_t ch = 0x20; ch < 0x7F; ch++) {
+    if (ch != '"') { sets[3].set(ch); }
+  }
+
+  using Kernel = SpanSet::Kernel;
+  std::vector<Kernel> kernels = {Kernel::Scalar, SpanSet::best_kernel()};
+  if (SpanSet::best_kernel() == Kernel::AVX2) {
+    kernels.push_back(Kernel::SSSE3);
+  }
+
+  for (const auto &bits : sets) {
+    std::string member, outsider;
+    for (size_t ch = 0; ch < 256; ch++) {
+      (bits.test(ch) ? member : outsider) += static_cast<char>(ch);
+    }
+    for (auto kernel : kernels) {
+      SpanSet set(bits, kernel);
+      EXPECT_EQ(kernel, set.kernel());
+      for (size_t len = 0; len < 80; len++) {
+        std::string s;
+        for (size_t i = 0; i < len; i++) {
+          s += member[(i * 7) % member.size()];
+        }
+        // Stops at the first outsider, including non-ASCII bytes
+        for (auto stop : {outsider[len % outsider.size()], '\xC3'}) {
+          auto text = s + stop + s;
+          EXPECT_EQ(len, set.span(text.data(), text.size()));
+        }
+        EXPECT_EQ(len, set.span(s.data(), s.size()));
+        // and at the end of the input it is given
+        EXPECT_EQ(len / 2, set.span(s.data(), len / 2));
+      }
+    }
+  }
+}
+
+// `(!Stop .)*` loops become one search; it stops where the loop would,
+// including at invalid UTF-8 and at overlong encodings of stop bytes.
+TEST(ScanUntilTest, Matches_operator_tree) {
+  std::vector<const char *> grammars = {
+      R"(S <- (!'\n' .)*)",
+      R"(S <- (!'*/' .)*)",
+      R"(S <- (!["\\] .)*)",
+      R"(S <- (!('\r\n' / '\n' / '$$') .)+)",
+      R"(S <- < (!'end' .)* >
+         %whitespace <- [ ]*
+         %word <- [a-z]+)",
+  };
+  std::vector<std::string> inputs = {
+      "",
+      "\n",
+      "abc",
+      "line one\nline two",
+      "comment * / */ after",
+      R"(string \" body" after)",
+      "a\r\nb",
+      "cost $5 $$ end",
+      "caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80 */ x",
+      "bad \x80 byte\n",
+      "cut \xC3",
+      "cut \xC3\n",
+      "overlong \xC0\xA2 quote\"",
+      "the endless end",
+      std::string(200, 'x') + "*/" + std::string(50, 'y'),
+  };
+
+  for (auto grammar : grammars) {
+    parser pg(grammar);
+    ASSERT_TRUE(!!pg) << grammar;
+    auto &rule = pg["S"];
+    rule.eoi_check = false;
+
+    auto ope = rule.get_core_operator();
+    if (auto tb = dynamic_cast<TokenBoundary *>(ope.get())) { ope = tb->ope_; }
+    auto rep = dynamic_cast<Repetition *>(ope.get());
+    ASSERT_TRUE(rep && rep->until_) << grammar;
+
+    for (const auto &input : inputs) {
+      auto native = rule.parse(input.data(), input.size());
+      auto tree = rule.parse(input.data(), input.size(), nullptr,
+                             [](size_t, size_t, const std::string &,
+                                const std::string &) {});
+      EXPECT_EQ(tree.ret, native.ret) << grammar << " / " << input;
+      EXPECT_EQ(tree.len, native.len) << grammar << " / " << input;
+    }
+  }
+}
+
+// A stop literal that %word makes a word only matches at a word boundary,
+// and one outside a token may fail on the whitespace after it; both keep
+// the loop.
+TEST(ScanUntilTest, Keeps_word_and_whitespace_semantics) {
+  parser words(R"(
+    S     <- 'do' Body 'end'
+    Body  <- < (!'end' .)* >
+    %word <- [a-z]+
+  )");
+  ASSERT_TRUE(!!words);
+  EXPECT_TRUE(words.parse("do the endless end"));
+  EXPECT_FALSE(words.parse("do the endless"));
+
+  parser spaces(R"(
+    S           <- 'a' (!'b' .)* 'b'
+    %whitespace <- [ ]+ / !.
+  )");
+  ASSERT_TRUE(!!spaces);
+  EXPECT_TRUE(spaces.parse(" a x b"));
+  EXPECT_TRUE(spaces.parse(" a xbx b"));
+}
+
+// The compiled class matcher answers like a scan of the ranges, and its
+// span like a loop of single matches
+TEST(ClassMatcherTest, Agrees_with_ranges) {
+  using Ranges = std::vector<std::pair<char32_t, char32_t>>;
+  std::vector<Ranges> classes = {
+      {{'a', 'z'}, {0x3B1, 0x3C9}},
+      {{0x4E00, 0x9FAF}, {0x3041, 0x3093}, {'_', '_'}},
+      {{'"', '"'}, {'\\', '\\'}},
+      {{'A', 0xE9}, {0x100, 0x17F}, {0x150, 0x200}},
+      {{0x1F600, 0x1F64F}, {0, 0}},
+  };
+  std::vector<char32_t> cps;
+  for (char32_t cp = 0; cp < 0x400; cp++) {
+    cps.push_back(cp);
+  }
+  for (const auto &ranges : classes) {
+    for (const auto &[lo, hi] : ranges) {
+      for (auto cp : {lo, hi}) {
+        cps.push_back(cp + 1);
+        if (cp) { cps.push_back(cp - 1); }
+      }
+    }
+  }
+
+  for (const auto &ranges : classes) {
+    for (auto negated : {false, true}) {
+      for (auto ignore_case : {false, true}) {
+        CharacterClass cc(ranges, negated, ignore_case);
+        auto expected = [&](char32_t cp) {
+          auto fold = [&](char32_t x) {
+            return ignore_case ? static_cast<char32_t>(std::tolower(x)) : x;
+          };
+          auto in = std::any_of(ranges.begin(), ranges.end(), [&](auto r) {
+            return fold(r.first) <= fold(cp) && fold(cp) <= fold(r.second);
+          });
+          return in != negated;
+        };
+
+        std::string text;
+        size_t count = 0;
+        auto spanning = true;
+        for (auto cp : cps) {
+          auto s = encode_codepoint(cp);
+          auto len = cc.match(s.data(), s.size());
+          EXPECT_EQ(expected(cp), success(len)) << std::hex << cp;
+          if (success(len)) { EXPECT_EQ(s.size(), len); }
+          if (spanning && expected(cp)) {
+            text += s;
+            count++;
+          } else {
+            spanning = false;
+          }
+        }
+        auto size = text.size();
+        text += "\x80";
+        size_t n = 0;
+        EXPECT_EQ(size, cc.span(text.data(), text.size(), SIZE_MAX, n));
+        EXPECT_EQ(count, n);
+        if (count > 2) {
+          EXPECT_LE(cc.span(text.data(), text.size(), count - 2, n), size);
+          EXPECT_EQ(count - 2, n);
+        }
+      }
+    }
+  }
+
+  // The decode loop of a repetition matches like the per-character loop a
+  // logger keeps
+  parser pg(R"(
+    S    <- Word (' ' Word)* ' '? Text
+    Word <- < [a-zα-ωぁ-ん]+ >
+    Text <- '"' [^"]* '"'
+  )");
+  ASSERT_TRUE(!!pg);
+  std::vector<std::string> inputs = {
+      u8"abc αβγ ひらがな \"é 漢字\"",
+      u8"abéc \"x\"",
+      "abc \"\xC3\"",
+      "abc \"x",
+  };
+  for (const auto &input : inputs) {
+    auto fast = pg.parse(input);
+    pg.set_logger([](size_t, size_t, const std::string &) {});
+    EXPECT_EQ(pg.parse(input), fast) << input;
+    pg.set_logger(Log{});
+  }
+}
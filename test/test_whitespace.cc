@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <peglib.h>
+
+using namespace peg;
+
+// %whitespace bodies made of classes, literals and comments run as a native
+// scanner in parses without a logger; a logger keeps the operator tree.
+TEST(WhitespaceScannerTest, Matches_operator_tree) {
+  std::vector<const char *> bodies = {
+      R"(([ \t\r\n] / '--' (!'\n' .)* / '/*' (!'*/' .)* '*/')*)",
+      R"((Space / Comment)*
+         Space   <- [ \t]+ / EOL
+         Comment <- '#' (!EOL .)* EOL?
+         EOL     <- '\r\n' / '\n')",
+      R"(('--' (!'\n' .)* / [ -])*)",
+      R"(('(*' (!'*)' .)* '*)' / ' ')*)",
+  };
+  std::vector<std::string> inputs = {
+      "",
+      "   x",
+      " \t\r\n -- line\n /* block */ x",
+      "/* unterminated",
+      "# comment\r\n  # more\n x",
+      "#",
+      "- --x\n x",
+      "-- caf\xC3\xA9 \xE2\x82\xAC\n x",
+      "/* bad \x80 byte */ x",
+      "/* cut \xC3",
+      "(* long comment, long enough for a few vector blocks *) (**) x",
+      "(* *(* *) x",
+      std::string(100, ' ') + "--" + std::string(100, '.') + "\n x",
+  };
+
+  for (auto body : bodies) {
+    parser pg(std::string("S <- 'x'* !.\n%whitespace <- ") + body);
+    ASSERT_TRUE(!!pg) << body;
+    auto ws = dynamic_cast<Whitespace *>(
+        pg.get_grammar().at("S").whitespaceOpe.get());
+    ASSERT_TRUE(ws && ws->scanner_) << body;
+
+    const auto &rule = pg.get_grammar().at("S");
+    for (const auto &input : inputs) {
+      auto native = rule.parse(input.data(), input.size());
+      auto tree = rule.parse(input.data(), input.size(), nullptr,
+                             [](size_t, size_t, const std::string &,
+                                const std::string &) {});
+      EXPECT_EQ(tree.ret, native.ret) << body << " / " << input;
+      EXPECT_EQ(tree.len, native.len) << body << " / " << input;
+    }
+  }
+}
+
+// Rules with actions and literals that %word treats as words keep the
+// operator tree; other shapes get no scanner.
+TEST(WhitespaceScannerTest, Steps_aside) {
+  parser pg(R"(
+    S           <- 'x'*
+    %whitespace <- ([ \n] / Comment)*
+    Comment     <- '#' (!'\n' .)*
+  )");
+  ASSERT_TRUE(!!pg);
+  auto comments = 0;
+  pg["Comment"] = [&](const SemanticValues &) { comments++; };
+  EXPECT_TRUE(pg.parse("x # one\n x # two"));
+  EXPECT_EQ(2, comments);
+
+  parser words(R"(
+    S           <- 'x'*
+    %whitespace <- ([ \n] / 'rem' (!'\n' .)*)*
+    %word       <- [a-z]+
+  )");
+  ASSERT_TRUE(!!words);
+  EXPECT_TRUE(words.parse("x rem\n x"));
+  EXPECT_FALSE(words.parse("x remark\n x"));
+
+  parser other(R"(
+    S           <- 'x'*
+    %whitespace <- [ ]* ('#' [^\n]*)?
+  )");
+  ASSERT_TRUE(!!other);
+  auto ws = dynamic_cast<Whitespace *>(
+      other.get_grammar().at("S").whitespaceOpe.get());
+  ASSERT_TRUE(ws);
+  EXPECT_FALSE(ws->scanner_);
+  EXPECT_TRUE(other.parse("x x # c"));
+}
+
+// A comment whose closer the scanner cannot compare byte for byte (ignore
+// case, or empty) keeps the operator tree instead of failing to load.
+TEST(WhitespaceScannerTest, Unusual_comment_closers_keep_operator_tree) {
+  std::vector<std::pair<const char *, const char *>> cases = {
+      {R"(([ \t] / '/*' (!'*/' .)* '*/'i)*)", "x /* comment */ x"},
+      {R"(([ \t] / '/*' (!'*/' .)* '')*)", "x x /* comment"},
+  };
+  for (auto [body, input] : cases) {
+    parser pg(std::string("S <- 'x'* !.\n%whitespace <- ") + body);
+    ASSERT_TRUE(!!pg) << body;
+    auto ws = dynamic_cast<Whitespace *>(
+        pg.get_grammar().at("S").whitespaceOpe.get());
+    ASSERT_TRUE(ws) << body;
+    EXPECT_FALSE(ws->scanner_) << body;
+    EXPECT_TRUE(pg.parse(input)) << body;
+  }
+}